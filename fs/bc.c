@@ -1,4 +1,6 @@
 
+#include <inc/x86.h>
+
 #include "fs.h"
 
 #define CACHE_SIZE 10
@@ -133,6 +135,29 @@ flush_block(void *addr)
 	//panic("flush_block not implemented");
 }
 
+// Give the block containing 'addr' a page of its own before the file
+// system changes it, if the page is also mapped by another env (see
+// serve_map) or by the text cache.  Those mappings keep the contents
+// they had, and the block's new contents go only to the fresh page.
+void
+bc_unshare(void *addr)
+{
+	int r;
+
+	addr = ROUNDDOWN(addr, PGSIZE);
+	if (!va_is_mapped(addr) || pageref(addr) <= 1)
+		return;
+	// Start the copy clean: the caller's write will dirty it.
+	flush_block(addr);
+	if ((r = sys_page_alloc(0, UTEMP, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("in bc_unshare, sys_page_alloc: %e", r);
+	memmove(UTEMP, addr, BLKSIZE);
+	if ((r = sys_page_map(0, UTEMP, 0, addr, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("in bc_unshare, sys_page_map: %e", r);
+	if ((r = sys_page_unmap(0, UTEMP)) < 0)
+		panic("in bc_unshare, sys_page_unmap: %e", r);
+}
+
 // Test that the block cache works, by smashing the superblock and
 // reading it back.
 static void
@@ -195,8 +220,14 @@ void
 bc_init(void)
 {
 	struct Super super;
+	uint64_t start;
+
 	set_pgfault_handler(bc_pgfault);
+#ifndef JOS_NOCHECK
+	start = read_tsc();
 	check_bc();
+	cprintf("FS boot: check_bc %llu ticks\n", read_tsc() - start);
+#endif
 
 	// cache the super block by reading it once
 	memmove(&super, diskaddr(1), sizeof super);
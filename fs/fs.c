@@ -66,6 +66,8 @@ alloc_block(void)
 		if(block_is_free(blockno)){
 			bitmap[blockno/32] ^= 1<<(blockno%32);
 			flush_block(diskaddr(blockno));
+			// Envs that mapped the block's old contents keep them.
+			bc_unshare(diskaddr(blockno));
 			return blockno;
 		}
 	}
@@ -118,8 +120,9 @@ fs_init(void)
 
 	// Set "bitmap" to the beginning of the first bitmap block.
 	bitmap = diskaddr(2);
+#ifndef JOS_NOCHECK
 	check_bitmap();
-	
+#endif
 }
 
 // Find the disk block number slot for the 'filebno'th block in file 'f'.
@@ -236,6 +239,7 @@ dir_alloc_file(struct File *dir, struct File **file)
 	struct File *f;
 
 	assert((dir->f_size % BLKSIZE) == 0);
+	textcache_invalidate(dir);
 	nblock = dir->f_size / BLKSIZE;
 	for (i = 0; i < nblock; i++) {
 		if ((r = file_get_block(dir, i, &blk)) < 0)
@@ -243,10 +247,12 @@ dir_alloc_file(struct File *dir, struct File **file)
 		f = (struct File*) blk;
 		for (j = 0; j < BLKFILES; j++)
 			if (f[j].f_name[0] == '\0') {
+				bc_unshare(blk);
 				*file = &f[j];
 				return 0;
 			}
 	}
+	bc_unshare(dir);
 	dir->f_size += BLKSIZE;
 	if ((r = file_get_block(dir, i, &blk)) < 0)
 		return r;
@@ -393,6 +399,9 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 	off_t pos;
 	char *blk;
 
+	textcache_invalidate(f);
+	bc_unshare(f);
+
 	// Extend file if necessary
 	if (offset + count > f->f_size)
 		if ((r = file_set_size(f, offset + count)) < 0)
@@ -402,6 +411,7 @@ file_write(struct File *f, const void *buf, size_t count, off_t offset)
 		if ((r = file_get_block(f, pos / BLKSIZE, &blk)) < 0)
 			return r;
 		bn = MIN(BLKSIZE - pos % BLKSIZE, offset + count - pos);
+		bc_unshare(blk);
 		memmove(blk + pos % BLKSIZE, buf, bn);
 		pos += bn;
 		buf += bn;
@@ -458,6 +468,8 @@ file_truncate_blocks(struct File *f, off_t newsize)
 int
 file_set_size(struct File *f, off_t newsize)
 {
+	textcache_invalidate(f);
+	bc_unshare(f);
 	if (f->f_size > newsize)
 		file_truncate_blocks(f, newsize);
 	f->f_size = newsize;
@@ -11,6 +11,9 @@
 /* Maximum disk size we can handle (3GB) */
 #define DISKSIZE	0xC0000000
 
+/* Pages of the text cache (textcache.c) are mapped from here. */
+#define TEXTVA		0xD1000000
+
 struct Super *super;		// superblock
 uint32_t *bitmap;		// bitmap blocks mapped in memory
 
@@ -26,6 +29,7 @@ void*	diskaddr(uint32_t blockno);
 bool	va_is_mapped(void *va);
 bool	va_is_dirty(void *va);
 void	flush_block(void *addr);
+void	bc_unshare(void *addr);
 void	bc_init(void);
 
 /* fs.c */
@@ -44,6 +48,10 @@ void	fs_sync(void);
 bool	block_is_free(uint32_t blockno);
 int	alloc_block(void);
 
+/* textcache.c */
+int	textcache_map(struct File *f, uint32_t filebno, void **pg);
+void	textcache_invalidate(struct File *f);
+
 /* test.c */
 void	fs_test(void);
 
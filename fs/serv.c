@@ -28,8 +28,14 @@
 //    communicate with the server.  File IDs are a lot like
 //    environment IDs in the kernel.  Use openfile_lookup to translate
 //    file IDs to struct OpenFile.
+//
+// Free entries of the array wait in openfile_pool.  An entry is free
+// once no client maps its Fd page, which the server only notices when
+// it looks, so when the pool runs dry openfile_alloc refills it with
+// one sweep of the array.
 
 struct OpenFile {
+	uint32_t o_poolnext;	// link in openfile_pool while free
 	uint32_t o_fileid;	// file id
 	struct File *o_file;	// mapped descriptor for open file
 	int o_mode;		// open mode
@@ -42,12 +48,17 @@ struct OpenFile {
 
 // initialize to force into data section
 struct OpenFile opentab[MAXOPEN] = {
-	{ 0, 0, 1, 0 }
+	{ 0, 0, 0, 1, 0 }
 };
+static struct Pool openfile_pool;
 
 // Virtual address at which to receive page mappings containing client requests.
 union Fsipc *fsreq = (union Fsipc *)0x0ffff000;
 
+// Memory for serving one request, freed all at once before the next.
+#define REQARENA	0x0FF00000
+static struct Arena req_arena;
+
 void
 serve_init(void)
 {
@@ -58,29 +69,41 @@ serve_init(void)
 		opentab[i].o_fd = (struct Fd*) va;
 		va += PGSIZE;
 	}
+	pool_init(&openfile_pool, opentab, sizeof(struct OpenFile));
+	arena_init(&req_arena, (void *) REQARENA, (uintptr_t) fsreq - REQARENA);
 }
 
 // Allocate an open file.
 int
 openfile_alloc(struct OpenFile **o)
 {
+	struct OpenFile *of;
 	int i, r;
 
-	// Find an available open-file table entry
-	for (i = 0; i < MAXOPEN; i++) {
-		switch (pageref(opentab[i].o_fd)) {
-		case 0:
-			if ((r = sys_page_alloc(0, opentab[i].o_fd, PTE_P|PTE_U|PTE_W)) < 0)
-				return r;
-			/* fall through */
-		case 1:
-			opentab[i].o_fileid += MAXOPEN;
-			*o = &opentab[i];
-			memset(opentab[i].o_fd, 0, PGSIZE);
-			return (*o)->o_fileid;
-		}
+	if (!(of = pool_get(&openfile_pool))) {
+		// Backwards, so the lowest entries come out first
+		for (i = MAXOPEN - 1; i >= 0; i--)
+			if (pageref(opentab[i].o_fd) <= 1)
+				pool_put(&openfile_pool, &opentab[i]);
+		if (!(of = pool_get(&openfile_pool)))
+			return -E_MAX_OPEN;
+	}
+	if (pageref(of->o_fd) == 0
+	    && (r = sys_page_alloc(0, of->o_fd, PTE_P|PTE_U|PTE_W)) < 0) {
+		pool_put(&openfile_pool, of);
+		return r;
 	}
-	return -E_MAX_OPEN;
+	of->o_fileid += MAXOPEN;
+	*o = of;
+	memset(of->o_fd, 0, PGSIZE);
+	return of->o_fileid;
+}
+
+// Return open file 'o', which no client has been given, to the pool.
+static void
+openfile_free(struct OpenFile *o)
+{
+	pool_put(&openfile_pool, o);
 }
 
 // Look up an open file for envid.
@@ -103,7 +126,7 @@ int
 serve_open(envid_t envid, struct Fsreq_open *req,
 	   void **pg_store, int *perm_store)
 {
-	char path[MAXPATHLEN];
+	char *path;
 	struct File *f;
 	int fileid;
 	int r;
@@ -113,8 +136,8 @@ serve_open(envid_t envid, struct Fsreq_open *req,
 		cprintf("serve_open %08x %s 0x%x\n", envid, req->req_path, req->req_omode);
 
 	// Copy in the path, making sure it's null-terminated
-	memmove(path, req->req_path, MAXPATHLEN);
-	path[MAXPATHLEN-1] = 0;
+	if (!(path = arena_strndup(&req_arena, req->req_path, MAXPATHLEN - 1)))
+		return -E_NO_MEM;
 
 	// Find an open file ID
 	if ((r = openfile_alloc(&o)) < 0) {
@@ -131,14 +154,14 @@ serve_open(envid_t envid, struct Fsreq_open *req,
 				goto try_open;
 			if (debug)
 				cprintf("file_create failed: %e", r);
-			return r;
+			goto fail;
 		}
 	} else {
 try_open:
 		if ((r = file_open(path, &f)) < 0) {
 			if (debug)
 				cprintf("file_open failed: %e", r);
-			return r;
+			goto fail;
 		}
 	}
 
@@ -147,14 +170,9 @@ try_open:
 		if ((r = file_set_size(f, 0)) < 0) {
 			if (debug)
 				cprintf("file_set_size failed: %e", r);
-			return r;
+			goto fail;
 		}
 	}
-	if ((r = file_open(path, &f)) < 0) {
-		if (debug)
-			cprintf("file_open failed: %e", r);
-		return r;
-	}
 
 	// Save the file pointer
 	o->o_file = f;
@@ -174,6 +192,10 @@ try_open:
 	*perm_store = PTE_P|PTE_U|PTE_W|PTE_SHARE;
 
 	return 0;
+
+fail:
+	openfile_free(o);
+	return r;
 }
 
 // Set the size of req->req_fileid to req->req_size bytes, truncating
@@ -291,6 +313,48 @@ serve_flush(envid_t envid, struct Fsreq_flush *req)
 	return 0;
 }
 
+// Map the block of req->req_fileid holding byte req->req_offset, which
+// must be block-aligned and inside the file, to the caller.  The page
+// from the text cache is returned read-only in *pg_store, so the caller
+// shares it with every other env that maps the same block.  A later
+// write to the file goes to a copy of the page, not to this one.
+int
+serve_map(envid_t envid, struct Fsreq_map *req,
+	  void **pg_store, int *perm_store)
+{
+	struct OpenFile *o;
+	int r;
+
+	if (debug)
+		cprintf("serve_map %08x %08x %08x\n", envid, req->req_fileid, req->req_offset);
+
+	if ((r = openfile_lookup(envid, req->req_fileid, &o)) < 0)
+		return r;
+	if (req->req_offset < 0 || req->req_offset % BLKSIZE != 0
+	    || req->req_offset >= o->o_file->f_size)
+		return -E_INVAL;
+	if ((r = textcache_map(o->o_file, req->req_offset / BLKSIZE, pg_store)) < 0)
+		return r;
+	*perm_store = PTE_P | PTE_U;
+	return 0;
+}
+
+// Map a block for a page fault by 'envid' in a region it demand-pages
+// from the file (see lib/spawn.c).  This is serve_map, but a writable
+// region gets the page copy-on-write.
+int
+serve_pagein(envid_t envid, struct Fsreq_pagein *req,
+	     void **pg_store, int *perm_store)
+{
+	struct Fsreq_map map = { req->req_fileid, req->req_offset };
+	int r;
+
+	if ((r = serve_map(envid, &map, pg_store, perm_store)) < 0)
+		return r;
+	if (req->req_perm & PTE_W)
+		*perm_store |= PTE_COW;
+	return 0;
+}
 
 int
 serve_sync(envid_t envid, union Fsipc *req)
@@ -316,40 +380,75 @@ void
 serve(void)
 {
 	uint32_t req, whom;
-	int perm, r;
+	int perm, r, reply_perm, i;
 	void *pg;
-
+	union Fsipc *req_args;
+	static uint32_t short_args[IPC_NWORDS - 1];
+
+	static_assert(sizeof(struct Fsreq_set_size) <= sizeof(short_args));
+	static_assert(sizeof(struct Fsreq_pagein) <= sizeof(short_args));
+
+	// Each trip around the loop replies to the previous request, if
+	// any, and waits for the next one in a single system call.
+	// Clients move their request page to us, and it is moved back with
+	// the reply, except for open and map, whose replies carry another
+	// page and whose request page is shared instead.  The next
+	// request's page is mapped at fsreq.
+	whom = 0;
+	r = 0;
+	pg = NULL;
+	reply_perm = 0;
 	while (1) {
+		arena_reset(&req_arena);
 		perm = 0;
-		req = ipc_recv((int32_t *) &whom, fsreq, &perm);
+		req = ipc_reply_wait(whom, r, pg, reply_perm,
+				     (int32_t *) &whom, fsreq, &perm);
 		if (debug)
 			cprintf("fs req %d from %08x [page %08x: %s]\n",
 				req, whom, uvpt[PGNUM(fsreq)], fsreq);
 
-		// All requests must contain an argument page
-		if (!(perm & PTE_P)) {
+		// Short requests carry their arguments in the message words;
+		// all others must contain an argument page
+		req_args = fsreq;
+		if (!(perm & PTE_P) && (req == FSREQ_SET_SIZE || req == FSREQ_FLUSH
+					|| req == FSREQ_SYNC || req == FSREQ_PAGEIN)) {
+			for (i = 0; i < ARRAY_SIZE(short_args); i++)
+				short_args[i] = thisenv->env_ipc_words[i + 1];
+			req_args = (union Fsipc *) short_args;
+		} else if (!(perm & PTE_P)) {
 			cprintf("Invalid request from %08x: no argument page\n",
 				whom);
+			whom = 0;
+			pg = NULL;
 			continue; // just leave it hanging...
 		}
 
 		pg = NULL;
+		reply_perm = 0;
+		if (req_args == fsreq && req != FSREQ_OPEN && req != FSREQ_MAP) {
+			pg = fsreq;
+			reply_perm = PTE_P | PTE_U | PTE_W | IPC_PERM_MOVE;
+		}
 		if (req == FSREQ_OPEN) {
-			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &perm);
+			r = serve_open(whom, (struct Fsreq_open*)fsreq, &pg, &reply_perm);
+		} else if (req == FSREQ_MAP) {
+			r = serve_map(whom, (struct Fsreq_map*)fsreq, &pg, &reply_perm);
+		} else if (req == FSREQ_PAGEIN) {
+			r = serve_pagein(whom, (struct Fsreq_pagein*)req_args, &pg, &reply_perm);
 		} else if (req < ARRAY_SIZE(handlers) && handlers[req]) {
-			r = handlers[req](whom, fsreq);
+			r = handlers[req](whom, req_args);
 		} else {
 			cprintf("Invalid request code %d from %08x\n", req, whom);
 			r = -E_INVAL;
 		}
-		ipc_send(whom, r, pg, perm);
-		sys_page_unmap(0, fsreq);
 	}
 }
 
 void
 umain(int argc, char **argv)
 {
+	uint64_t t0, t1, t2;
+
 	static_assert(sizeof(struct File) == 256);
 	binaryname = "fs";
 	cprintf("FS is running\n");
@@ -358,9 +457,15 @@ umain(int argc, char **argv)
 	outw(0x8A00, 0x8A00);
 	cprintf("FS can do I/O\n");
 
+	t0 = read_tsc();
 	serve_init();
 	fs_init();
-        fs_test();
+	t1 = read_tsc();
+#ifndef JOS_NOCHECK
+	fs_test();
+#endif
+	t2 = read_tsc();
+	cprintf("FS boot: fs_init %llu, fs_test %llu ticks\n", t1 - t0, t2 - t1);
 	serve();
 }
 
@@ -0,0 +1,98 @@
+// A cache of file pages handed out by FSREQ_MAP, so that every env
+// running the same program maps the same physical text pages.
+//
+// The block cache keeps only a few blocks and gives up a page once it
+// is evicted, after which the next spawn would read a fresh copy from
+// disk.  Pages here stay mapped read-only at TEXTVA, keyed by file and
+// block number, for as long as the file is unchanged.  A page that no
+// env but us maps any more may be reused for another block.
+
+#include "fs.h"
+
+#define NTEXT		256
+
+static struct TextPage {
+	struct File *t_file;		// File, or NULL if the slot is free
+	uint32_t t_filebno;		// Block number within t_file
+	char *t_blk;			// The block's address in the block cache
+	uint32_t t_lastuse;		// textcache_time when last mapped
+} text[NTEXT];
+
+static uint32_t textcache_time;
+
+static void *
+textcache_va(int i)
+{
+	return (char *) TEXTVA + i * PGSIZE;
+}
+
+// Does any env other than us map the page of slot 'i'?
+static bool
+textcache_inuse(int i)
+{
+	void *va = textcache_va(i);
+	int refs = pageref(va) - 1;
+
+	if (va_is_mapped(text[i].t_blk)
+	    && PTE_ADDR(uvpt[PGNUM(text[i].t_blk)]) == PTE_ADDR(uvpt[PGNUM(va)]))
+		refs--;
+	return refs > 0;
+}
+
+// Find the cached page for block 'filebno' of 'f', caching the block
+// if it is not there, and store its address in *pg.
+// Returns 0 on success, < 0 on error.  If every slot is in use by
+// some env, the block cache page is returned uncached.
+int
+textcache_map(struct File *f, uint32_t filebno, void **pg)
+{
+	int i, free = -1, lru = -1, slot, r;
+	char *blk;
+
+	textcache_time++;
+	for (i = 0; i < NTEXT; i++) {
+		if (!text[i].t_file) {
+			if (free < 0)
+				free = i;
+		} else if (text[i].t_file == f && text[i].t_filebno == filebno) {
+			text[i].t_lastuse = textcache_time;
+			*pg = textcache_va(i);
+			return 0;
+		} else if ((lru < 0 || text[i].t_lastuse < text[lru].t_lastuse)
+			   && !textcache_inuse(i))
+			lru = i;
+	}
+	slot = free >= 0 ? free : lru;
+
+	if ((r = file_get_block(f, filebno, &blk)) < 0)
+		return r;
+	// Fault the block in, so there is a page to map.
+	*(volatile char *) blk;
+	if (slot < 0) {
+		*pg = blk;
+		return 0;
+	}
+	if ((r = sys_page_map(0, blk, 0, textcache_va(slot), PTE_P | PTE_U)) < 0)
+		return r;
+	text[slot].t_file = f;
+	text[slot].t_filebno = filebno;
+	text[slot].t_blk = blk;
+	text[slot].t_lastuse = textcache_time;
+	*pg = textcache_va(slot);
+	return 0;
+}
+
+// Drop the cached pages of 'f', which is about to change.  Envs that
+// already map them keep the old contents, since the file system gives
+// a block a fresh page before writing it (see bc_unshare).
+void
+textcache_invalidate(struct File *f)
+{
+	int i;
+
+	for (i = 0; i < NTEXT; i++)
+		if (text[i].t_file == f) {
+			sys_page_unmap(0, textcache_va(i));
+			text[i].t_file = NULL;
+		}
+}
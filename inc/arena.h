@@ -0,0 +1,32 @@
+#ifndef JOS_INC_ARENA_H
+#define JOS_INC_ARENA_H
+
+#include <inc/types.h>
+
+// An arena hands out memory from a bump pointer over a reserved range
+// of virtual addresses, mapping pages with sys_page_alloc as it grows
+// (see lib/arena.c).  Nothing is freed on its own: arena_reset makes
+// all of it available again, keeping the pages mapped for reuse, and
+// arena_free_all also unmaps them.  This suits work, such as serving
+// one request, whose allocations all die together.
+struct Arena {
+	char *a_base;			// Start of the range, page-aligned
+	size_t a_size;			// Bytes reserved there
+	size_t a_mapped;		// Bytes mapped from a_base
+	size_t a_used;			// Bytes handed out from a_base
+};
+
+// A pool holds up to 65535 free objects of one size in a caller's
+// array (see lib/arena.c).  Free objects are linked through their
+// first word.  The list head packs the first free object's index + 1
+// in its low 16 bits with a count bumped by every change in its high
+// 16 bits, so pool_get and pool_put can update it with cmpxchg and no
+// lock without an object that was taken and put back in between
+// fooling them.
+struct Pool {
+	volatile uint32_t p_head;	// Count << 16 | (first free index + 1)
+	char *p_objs;			// The array
+	size_t p_objsize;		// Object size, at least 4
+};
+
+#endif /* !JOS_INC_ARENA_H */
@@ -0,0 +1,33 @@
+#ifndef JOS_INC_CHAN_H
+#define JOS_INC_CHAN_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// A channel is a single-producer, single-consumer ring of variable-size
+// records in PTE_SHARE memory (see lib/chan.c).  fork and spawn keep
+// PTE_SHARE pages shared, so a channel made before either is visible
+// at the same address in the child.
+//
+// The region is one header page holding this struct, followed by
+// c_size bytes of ring.  c_head and c_tail count bytes written and read
+// since creation.  Each record is a 32-bit length followed by the data,
+// padded to 4 bytes.  A record that would run off the end of the ring
+// is preceded by a CHAN_PAD length, which skips to the start.
+struct Chan {
+	volatile uint32_t c_head;	// Written only by the producer
+	volatile uint32_t c_tail;	// Written only by the consumer
+	uint32_t c_size;		// Ring bytes, a power of 2
+	volatile uint32_t c_closed;	// Producer has closed the channel
+	volatile uint32_t c_rwait;	// Consumer may be asleep on c_rseq
+	volatile uint32_t c_wwait;	// Producer may be asleep on c_wseq
+	volatile uint32_t c_rseq;	// Bumped to wake the consumer
+	volatile uint32_t c_wseq;	// Bumped to wake the producer
+};
+
+#define CHAN_PAD	0xFFFFFFFF
+
+// The ring of channel 'c'
+#define CHAN_RING(c)	((char *) (c) + PGSIZE)
+
+#endif /* !JOS_INC_CHAN_H */
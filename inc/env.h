@@ -38,6 +38,62 @@ enum {
 	ENV_NOT_RUNNABLE
 };
 
+// Number of 32-bit words in an IPC message.  A T_IPCCALL trap carries
+// them in eax, ecx, ebx, edi, esi and ebp; the receiver finds them in
+// env_ipc_words.
+#define IPC_NWORDS		6
+
+// A range of pages sent by sys_ipc_sendv.
+struct IpcVec {
+	void *iv_va;			// Page-aligned start of the range
+	uint32_t iv_npages;		// Number of pages
+	int iv_perm;			// Perm to map them with in the receiver
+};
+
+#define IPC_MAXVEC		8	// Most ranges in one sys_ipc_sendv
+#define IPC_MOVE		0x1	// sys_ipc_sendv: unmap pages from sender
+
+// Or'd into the perm of a one-page send (sys_ipc_send, sys_ipc_call,
+// sys_ipc_reply_wait and so on) to move the page as IPC_MOVE does.
+// It lies above the PTE flags and is never stored in a PTE.
+#define IPC_PERM_MOVE		0x1000
+
+// Notification bits usable with sys_notify.  Bit 31 is reserved so
+// that sys_notify_wait can return the bits taken as a nonnegative int.
+#define NOTIFY_ALL		0x7FFFFFFF
+
+// A range of an env's address space whose pages are mapped on first
+// touch instead of up front (see sys_env_set_pager).  Pages below
+// pr_fileend come from the env 'pr_pager', which is sent the message
+// words { pr_req, pr_key, offset, pr_perm }, where offset is
+// pr_off + (va - pr_va), and must reply with the page.  The pages from
+// pr_fileend to pr_end are zero-filled.  Writable pages are mapped
+// copy-on-write until first written.
+struct PagerRegion {
+	uintptr_t pr_va;		// Page-aligned start of the region
+	uintptr_t pr_fileend;		// Page-aligned end of the paged-in part
+	uintptr_t pr_end;		// Page-aligned end of the region
+	envid_t pr_pager;		// Env that supplies the pages
+	uint32_t pr_req;		// Request value to send it
+	uint32_t pr_key;		// Names the object to the pager
+	uint32_t pr_off;		// Pager's offset of pr_va
+	int pr_perm;			// PTE_P|PTE_U, and PTE_W if writable
+};
+
+#define NPAGER			6	// Most regions per env
+
+// sys_page_populate flag: resolve the pages for writing, copying
+// copy-on-write pages and giving zero-filled ones pages of their own.
+#define POPULATE_WRITE		0x1
+
+// How an env means to use a range of its memory (see sys_madvise).
+enum {
+	MADV_NORMAL = 0,	// No special treatment
+	MADV_SEQUENTIAL,	// Resolve each fault a few pages ahead
+	MADV_WILLNEED,		// Read soon: map what can be mapped now
+	MADV_DONTNEED,		// Done with: unmap the pages
+};
+
 // Special environment types
 enum EnvType {
 	ENV_TYPE_USER = 0,
@@ -53,19 +109,70 @@ struct Env {
 	unsigned env_status;		// Status of the environment
 	uint32_t env_runs;		// Number of times environment has run
 	int env_cpunum;			// The CPU that the env is running on
+	envid_t env_trace;		// Env reading our traced calls, or 0
 
 	// Address space
 	pde_t *env_pgdir;		// Kernel virtual address of page dir
 
 	// Exception handling
 	void *env_pgfault_upcall;	// Page fault upcall entry point
+	uintptr_t env_xstacktop;	// Top of our user exception stack
+
+	// Threads (sys_thread_create)
+	uint32_t env_tls;		// Thread-local slot, for the user's use
+	uint32_t *env_thread_exit;	// Word zeroed and woken when we exit
+	envid_t env_vfork_parent;	// Suspended in sys_vfork until we exit
 
 	// Lab 4 IPC
 	bool env_ipc_recving;		// Env is blocked receiving
+	envid_t env_ipc_recvfrom;	// Only receive from this env, or 0
+	uint32_t env_ipc_recvtag;	// Only receive values whose bits under
+	uint32_t env_ipc_recvmask;	//   env_ipc_recvmask match this tag
+	struct Env *env_ipc_fromq;	// Envs receiving only from us
+	struct Env *env_ipc_fromnext;	// Next env in our env_ipc_recvfrom's queue
+	bool env_ipc_call;		// Receive the reply once our send completes
 	void *env_ipc_dstva;		// VA at which to map received page
+	uint32_t env_ipc_dstnpages;	// Pages in the window at env_ipc_dstva
+	uint32_t env_ipc_npages;	// Number of pages received
 	uint32_t env_ipc_value;		// Data value sent to us
+	uint32_t env_ipc_words[IPC_NWORDS]; // Message words; [0] is the value
 	envid_t env_ipc_from;		// envid of the sender
 	int env_ipc_perm;		// Perm of page mapping received
+
+	// Blocking IPC send (sys_ipc_send)
+	struct Env *env_ipc_sendq;	// First env blocked sending to us
+	struct Env *env_ipc_sendq_tail;	// Last env blocked sending to us
+	struct Env *env_ipc_sendnext;	// Next env in our target's queue
+	envid_t env_ipc_sendto;		// Env we are blocked sending to, or 0
+	uint32_t env_ipc_sendval;	// Value we are sending
+	struct IpcVec env_ipc_sendvec[IPC_MAXVEC]; // Pages we are sending
+	int env_ipc_sendnvec;		// Number of ranges in env_ipc_sendvec
+	int env_ipc_sendflags;		// IPC_MOVE, or 0
+	bool env_ipc_sendregs;		// Message words are in our env_tf
+
+	// Demand paging (see kern/pager.c)
+	struct PagerRegion env_pager[NPAGER]; // Unused if pr_end is 0
+	uint32_t env_pager_words[IPC_NWORDS]; // Page-in request being sent
+	bool env_pager_wait;		// Blocked on a page-in request
+	bool env_pager_failed;		// The last page-in got no page
+	uintptr_t env_seq_va;		// MADV_SEQUENTIAL range start
+	uintptr_t env_seq_end;		//   and end, or 0
+
+	// Asynchronous notifications (sys_notify)
+	uint32_t env_notify_pending;	// Bits posted but not yet taken
+	uint32_t env_notify_waitmask;	// Bits we are blocked waiting for, or 0
+
+	// Futex wait (see kern/futex.c)
+	physaddr_t env_futex_key;	// Physical address waited on, or 0
+	unsigned int env_futex_deadline; // time_msec() to time out at, or 0
+	struct Env *env_futex_next;	// Next waiter in the hash bucket
+
+	// Batched system calls
+	struct PageInfo *env_ring;	// Page holding the struct SysRing
+
+	// Lazily switched FPU/SSE state (see env_fpu_save)
+	uint8_t env_fxsave[512] __attribute__((aligned(16)));
+	int env_fpu_cpu;		// CPU whose registers hold env_fxsave
 };
 
 #endif // !JOS_INC_ENV_H
@@ -8,6 +8,14 @@
 #include <inc/types.h>
 #include <inc/fs.h>
 
+// Maximum number of file descriptors a program may hold open concurrently
+#define MAXFD		32
+// Bottom of file descriptor area
+#define FDTABLE		0xD0000000
+// Bottom of file data area.  We reserve one data page for each FD,
+// which devices can use if they choose.
+#define FILEDATA	(FDTABLE + MAXFD*PGSIZE)
+
 struct Fd;
 struct Stat;
 struct Dev;
@@ -49,6 +57,7 @@ int	fd2num(struct Fd *fd);
 int	fd_alloc(struct Fd **fd_store);
 int	fd_close(struct Fd *fd, bool must_exist);
 int	fd_lookup(int fdnum, struct Fd **fd_store);
+int	fd_map(int fdnum, envid_t dstenv, int dstfdnum);
 int	dev_lookup(int devid, struct Dev **dev_store);
 
 extern struct Dev devfile;
@@ -60,6 +60,9 @@ struct Super {
 };
 
 // Definitions for requests from clients to file system
+// SET_SIZE, FLUSH and SYNC are short: they are sent as IPC message
+// words (see fsipc_short in lib/file.c) rather than on a request page.
+// So is PAGEIN, which the kernel sends for a demand-paged env.
 enum {
 	FSREQ_OPEN = 1,
 	FSREQ_SET_SIZE,
@@ -70,7 +73,11 @@ enum {
 	FSREQ_STAT,
 	FSREQ_FLUSH,
 	FSREQ_REMOVE,
-	FSREQ_SYNC
+	FSREQ_SYNC,
+	// Map replies with the file's block cache page, read-only
+	FSREQ_MAP,
+	// Pagein is map on behalf of a page fault (see struct PagerRegion)
+	FSREQ_PAGEIN
 };
 
 union Fsipc {
@@ -108,6 +115,15 @@ union Fsipc {
 	struct Fsreq_remove {
 		char req_path[MAXPATHLEN];
 	} remove;
+	struct Fsreq_map {
+		int req_fileid;
+		off_t req_offset;
+	} map;
+	struct Fsreq_pagein {
+		int req_fileid;
+		off_t req_offset;
+		int req_perm;
+	} pagein;
 
 	// Ensure Fsipc is one page
 	char _pad[PGSIZE];
@@ -0,0 +1,35 @@
+#ifndef JOS_INC_GTHREAD_H
+#define JOS_INC_GTHREAD_H
+
+#include <inc/types.h>
+#include <inc/mmu.h>
+
+// Green threads are scheduled in user space, many to one env or
+// kernel thread (see lib/gthread.c).  Each has a stack slot in the
+// region at GSTACKBASE, with unmapped guard pages below the stack and
+// its struct GThread at the top.  Slots return to a pool when their
+// thread is joined and keep their pages mapped for the next thread.
+
+#define GSTACKBASE	0xA0000000	// Slots of green thread stacks
+#define GSTKPAGES	4		// Stack pages per green thread
+#define GSLOTSIZE	(8 * PGSIZE)	// guard, stack
+#define NGSLOT		((0xB0000000 - GSTACKBASE) / GSLOTSIZE)
+
+enum {
+	GT_READY = 0,		// On the ready queue, or running
+	GT_BLOCKED,		// In gthread_join
+	GT_DEAD			// Exited, waiting to be joined
+};
+
+struct GThread {
+	uint32_t g_esp;			// Saved by gthread_switch
+	struct GThread *g_next;		// Ready queue or pool link
+	int g_state;			// GT_*
+	bool g_waiting;			// Yielded in gthread_wait
+	struct GThread *g_joiner;	// Blocked in gthread_join on us
+	void *(*g_func)(void *);	// Function the thread runs
+	void *g_arg;			// Its argument
+	void *g_ret;			// Its result
+};
+
+#endif /* !JOS_INC_GTHREAD_H */
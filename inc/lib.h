@@ -20,6 +20,14 @@
 #include <inc/fs.h>
 #include <inc/fd.h>
 #include <inc/args.h>
+#include <inc/trace.h>
+#include <inc/prof.h>
+#include <inc/sync.h>
+#include <inc/gthread.h>
+#include <inc/chan.h>
+#include <inc/arena.h>
+#include <inc/thread.h>
+#include <inc/spawn.h>
 
 #define USED(x)		(void)(x)
 
@@ -52,12 +60,36 @@ static envid_t sys_exofork(void);
 int	sys_env_set_status(envid_t env, int status);
 int	sys_env_set_trapframe(envid_t env, struct Trapframe *tf);
 int	sys_env_set_pgfault_upcall(envid_t env, void *upcall);
+int	sys_env_set_pager(envid_t env, const struct PagerRegion *pr);
+envid_t	sys_thread_create(void *entry, void *stack, void *arg, void *xstack,
+			  uint32_t *exitword);
+int	sys_env_share_pts(envid_t env);
+int	sys_page_populate(envid_t env, void *va, size_t len, int flags);
+int	sys_madvise(envid_t env, void *va, size_t len, int advice);
 int	sys_page_alloc(envid_t env, void *pg, int perm);
 int	sys_page_map(envid_t src_env, void *src_pg,
 		     envid_t dst_env, void *dst_pg, int perm);
 int	sys_page_unmap(envid_t env, void *pg);
 int	sys_ipc_try_send(envid_t to_env, uint32_t value, void *pg, int perm);
+int	sys_ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int	sys_ipc_recv(void *rcv_pg);
+int	sys_ipc_sendv(envid_t to_env, uint32_t value, const struct IpcVec *vec, int nvec, int flags);
+int	sys_ipc_recvv(void *rcv_pg, uint32_t npages);
+int	sys_ipc_call(envid_t to_env, uint32_t value, void *pg, int perm, void *rcv_pg);
+int	sys_ipc_reply_wait(envid_t to_env, uint32_t value, void *pg, int perm, void *rcv_pg);
+int	sys_ipc_callw(envid_t to_env, const uint32_t *words);
+int	sys_ipc_recvsel(envid_t from, uint32_t tag, uint32_t mask,
+			void *rcv_pg, uint32_t npages);
+int	sys_notify(envid_t envid, uint32_t bits);
+int	sys_notify_wait(uint32_t mask);
+int	sys_ring_setup(void *va);
+int	sys_enter_ring(uint32_t n);
+int	sys_trace_ctl(envid_t env, bool on);
+int	sys_trace_read(struct TraceRec *buf, uint32_t n);
+int	sys_prof_ctl(bool on);
+int	sys_prof_read(struct ProfSample *buf, uint32_t n);
+int	sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout);
+int	sys_futex_wake(volatile uint32_t *addr, int n);
 
 // This must be inlined.  Exercise for reader: why?
 static inline envid_t __attribute__((always_inline))
@@ -70,15 +102,50 @@ sys_exofork(void)
 	return ret;
 }
 
+// Start a child that runs in our address space, on our stack, while
+// we are suspended until it exits; see sys_vfork.  This must be
+// inlined for the same reason as sys_exofork, and the child must not
+// return from the function that called it.  The child ends with
+// exit(), which leaves our file descriptors open for us.
+static inline envid_t __attribute__((always_inline))
+sys_vfork(void)
+{
+	envid_t ret;
+	asm volatile("int %2"
+		     : "=a" (ret)
+		     : "a" (SYS_vfork), "i" (T_SYSCALL)
+		     : "memory");
+	return ret;
+}
+
 // ipc.c
 void	ipc_send(envid_t to_env, uint32_t value, void *pg, int perm);
 int32_t ipc_recv(envid_t *from_env_store, void *pg, int *perm_store);
+int32_t ipc_call(envid_t to_env, uint32_t value, void *pg, int perm,
+		 void *rcv_pg, int *perm_store);
+int32_t ipc_reply_wait(envid_t to_env, uint32_t value, void *pg, int perm,
+		       envid_t *from_env_store, void *rcv_pg, int *perm_store);
+int32_t ipc_callw(envid_t to_env, const uint32_t *words);
+void	ipc_sendv(envid_t to_env, uint32_t value, const struct IpcVec *vec, int nvec, int flags);
+int32_t ipc_recvv(envid_t *from_env_store, void *pg, uint32_t npages, uint32_t *npages_store);
+int32_t ipc_recvsel(envid_t from, uint32_t tag, uint32_t mask,
+		    envid_t *from_env_store, void *pg, int *perm_store);
 envid_t	ipc_find_env(enum EnvType type);
 
+// sysring.c
+// The env's ring page is at USYSRING, and kernel thread i's is i + 1
+// pages below it, down to USYSRINGBOT.
+#define	USYSRING	(PFTEMP - PGSIZE)
+#define	USYSRINGBOT	(USYSRING - NTHREAD * PGSIZE)
+void	sysring_push(int num, uint32_t a1, uint32_t a2, uint32_t a3,
+		     uint32_t a4, uint32_t a5);
+int	sysring_flush(void);
+void	sysring_release(int slot);
+
 // fork.c
-#define	PTE_SHARE	0x400
 envid_t	fork(void);
 envid_t	sfork(void);	// Challenge!
+envid_t	lazyfork(void);
 
 // fd.c
 int	close(int fd);
@@ -96,6 +163,8 @@ int	open(const char *path, int mode);
 int	ftruncate(int fd, off_t size);
 int	remove(const char *path);
 int	sync(void);
+int	file_map(int fd, off_t offset, void *dstva);
+int	file_pager(int fd, envid_t envid, struct PagerRegion *pr);
 
 // pageref.c
 int	pageref(void *addr);
@@ -104,6 +173,13 @@ int	pageref(void *addr);
 // spawn.c
 envid_t	spawn(const char *program, const char **argv);
 envid_t	spawnl(const char *program, const char *arg0, ...);
+envid_t	spawnfa(const char *program, const char **argv,
+		const struct SpawnFileActions *fa);
+void	spawn_file_actions_init(struct SpawnFileActions *fa);
+int	spawn_file_actions_addopen(struct SpawnFileActions *fa, int fd,
+				   const char *path, int mode);
+int	spawn_file_actions_adddup2(struct SpawnFileActions *fa, int fd, int newfd);
+int	spawn_file_actions_addclose(struct SpawnFileActions *fa, int fd);
 
 // console.c
 void	cputchar(int c);
@@ -118,6 +194,58 @@ int	pipeisclosed(int pipefd);
 // wait.c
 void	wait(envid_t env);
 
+// sync.c
+void	mutex_lock(struct Mutex *m);
+int	mutex_trylock(struct Mutex *m);
+void	mutex_unlock(struct Mutex *m);
+void	cond_wait(struct Cond *c, struct Mutex *m);
+void	cond_signal(struct Cond *c);
+void	cond_broadcast(struct Cond *c);
+void	sem_wait(struct Sem *s);
+void	sem_post(struct Sem *s);
+
+// chan.c
+int	chan_create(struct Chan *c, size_t size);
+size_t	chan_maxrec(struct Chan *c);
+int	chan_send(struct Chan *c, const void *buf, size_t n);
+ssize_t	chan_recv(struct Chan *c, void *buf, size_t n);
+void	chan_close(struct Chan *c);
+
+// thread.c
+int	thread_create(struct Thread **tp, void *(*func)(void *), void *arg);
+void	thread_join(struct Thread *t, void **ret);
+void	thread_exit(void *ret) __attribute__((noreturn));
+struct Thread *thread_self(void);
+int	thread_index(struct Thread *t);
+
+// gthread.c
+int	gthread_create(struct GThread **gp, void *(*func)(void *), void *arg);
+int	gthread_yield(void);
+int	gthread_wait(void);
+int	gthread_alone(void);
+void	gthread_preempt(void);
+void	gthread_set_quantum(uint64_t ticks);
+void	gthread_exit(void *ret) __attribute__((noreturn));
+void	gthread_join(struct GThread *g, void **ret);
+struct GThread *gthread_self(void);
+
+// arena.c
+void	arena_init(struct Arena *a, void *va, size_t size);
+void	*arena_alloc(struct Arena *a, size_t n);
+char	*arena_strndup(struct Arena *a, const char *s, size_t max);
+void	arena_reset(struct Arena *a);
+void	arena_free_all(struct Arena *a);
+void	pool_init(struct Pool *p, void *objs, size_t objsize);
+void	*pool_get(struct Pool *p);
+void	pool_put(struct Pool *p, void *obj);
+
+// malloc.c
+void	*malloc(size_t n);
+void	free(void *v);
+void	*calloc(size_t nmemb, size_t size);
+void	*realloc(void *v, size_t n);
+void	*memalign(size_t align, size_t n);
+
 /* File open modes */
 #define	O_RDONLY	0x0000		/* open for reading only */
 #define	O_WRONLY	0x0001		/* open for writing only */
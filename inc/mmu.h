@@ -73,6 +73,15 @@
 // hardware, so user processes are allowed to set them arbitrarily.
 #define PTE_AVAIL	0xE00	// Available for software use
 
+// PTE_COW marks copy-on-write page table entries.  It is one of the
+// PTE_AVAIL bits, but the kernel resolves write faults on such pages
+// itself (see page_fault_handler), so no upcall is needed for them.
+#define PTE_COW		0x800
+
+// PTE_SHARE marks pages that fork and spawn share with the child
+// rather than copy.  It is only interpreted by user code.
+#define PTE_SHARE	0x400
+
 // Flags in PTE_SYSCALL may be used in system calls.  (Others may not.)
 #define PTE_SYSCALL	(PTE_AVAIL | PTE_P | PTE_W | PTE_U)
 
@@ -93,6 +102,8 @@
 #define CR0_CD		0x40000000	// Cache Disable
 #define CR0_PG		0x80000000	// Paging
 
+#define CR4_OSXMMEXCPT	0x00000400	// Unmasked SIMD FP exceptions enable
+#define CR4_OSFXSR	0x00000200	// FXSAVE/FXRSTOR and SSE enable
 #define CR4_PCE		0x00000100	// Performance counter enable
 #define CR4_MCE		0x00000040	// Machine Check Enable
 #define CR4_PSE		0x00000010	// Page Size Extensions
@@ -0,0 +1,14 @@
+#ifndef JOS_INC_PROF_H
+#define JOS_INC_PROF_H
+
+#include <inc/types.h>
+
+// One profiler sample, taken on a timer interrupt.
+struct ProfSample {
+	uintptr_t ps_eip;		// Interrupted instruction
+	uintptr_t ps_caller;		// Return address in the caller's frame, or 0
+	int32_t ps_envid;		// Interrupted environment, or 0 if idle
+	uint32_t ps_cpu;		// CPU that took the sample
+};
+
+#endif /* !JOS_INC_PROF_H */
@@ -0,0 +1,31 @@
+#ifndef JOS_INC_SPAWN_H
+#define JOS_INC_SPAWN_H
+
+#include <inc/types.h>
+
+#define SPAWN_MAXACTIONS	16
+
+enum {
+	SPAWN_OPEN,			// Open sa_path with sa_mode as sa_fd
+	SPAWN_DUP2,			// Make sa_newfd a copy of sa_fd
+	SPAWN_CLOSE,			// Close sa_fd
+};
+
+// Changes to make to a child's file descriptors, in order, when
+// spawnfa starts it (see lib/spawn.c).  The child starts with a copy
+// of the caller's descriptors, and descriptor numbers in the actions
+// name the child's, so the caller's own descriptors are left alone.
+// This does the redirection a shell would otherwise do by forking,
+// then calling dup and close in the child before spawn.
+struct SpawnFileActions {
+	int sfa_n;			// Actions used
+	struct SpawnAction {
+		int sa_op;		// SPAWN_OPEN, SPAWN_DUP2 or SPAWN_CLOSE
+		int sa_fd;
+		int sa_newfd;		// For SPAWN_DUP2
+		const char *sa_path;	// For SPAWN_OPEN
+		int sa_mode;		// For SPAWN_OPEN
+	} sfa_act[SPAWN_MAXACTIONS];
+};
+
+#endif /* !JOS_INC_SPAWN_H */
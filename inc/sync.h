@@ -0,0 +1,23 @@
+#ifndef JOS_INC_SYNC_H
+#define JOS_INC_SYNC_H
+
+#include <inc/types.h>
+
+// Sleeping synchronization built on futexes (see lib/sync.c).
+// To synchronize several environments, put these in a PTE_SHARE page.
+// All-zero is the initial state: unlocked, no waiters, count 0.
+
+struct Mutex {
+	volatile uint32_t m_state;	// 0 unlocked, 1 locked, 2 locked with waiters
+};
+
+struct Cond {
+	volatile uint32_t c_seq;	// Bumped by every signal and broadcast
+};
+
+struct Sem {
+	volatile uint32_t s_count;	// Available units
+	volatile uint32_t s_nwaiters;	// Envs about to sleep or sleeping
+};
+
+#endif /* !JOS_INC_SYNC_H */
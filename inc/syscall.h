@@ -17,6 +17,29 @@ enum {
 	SYS_yield,
 	SYS_ipc_try_send,
 	SYS_ipc_recv,
+	SYS_ring_setup,
+	SYS_enter_ring,
+	SYS_trace_ctl,
+	SYS_trace_read,
+	SYS_prof_ctl,
+	SYS_prof_read,
+	SYS_ipc_send,
+	SYS_ipc_call,
+	SYS_ipc_reply_wait,
+	SYS_ipc_callw,
+	SYS_ipc_sendv,
+	SYS_ipc_recvv,
+	SYS_futex_wait,
+	SYS_futex_wake,
+	SYS_ipc_recvsel,
+	SYS_notify,
+	SYS_notify_wait,
+	SYS_env_set_pager,
+	SYS_thread_create,
+	SYS_env_share_pts,
+	SYS_vfork,
+	SYS_page_populate,
+	SYS_madvise,
 	NSYSCALLS
 };
 
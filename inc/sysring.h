@@ -0,0 +1,37 @@
+#ifndef JOS_INC_SYSRING_H
+#define JOS_INC_SYSRING_H
+
+#include <inc/types.h>
+
+// Number of entries in each ring.  Must be powers of two.
+#define SYSRING_NSQE	64
+#define SYSRING_NCQE	64
+
+// A queued system call.  Only calls that never block may be queued;
+// see sys_enter_ring in kern/syscall.c for the list.
+struct SysRingSqe {
+	uint32_t sqe_num;		// SYS_* number
+	uint32_t sqe_args[5];		// Arguments, as for the syscall trap
+	uint32_t sqe_tag;		// Copied into the completion
+};
+
+// The result of one queued call.
+struct SysRingCqe {
+	uint32_t cqe_tag;
+	int32_t cqe_ret;
+};
+
+// The page an environment shares with the kernel for batched system
+// calls.  Indices run freely and are taken modulo the ring size.
+// The env advances sr_sq_tail and sr_cq_head; the kernel advances
+// sr_sq_head and sr_cq_tail.
+struct SysRing {
+	volatile uint32_t sr_sq_head;
+	volatile uint32_t sr_sq_tail;
+	volatile uint32_t sr_cq_head;
+	volatile uint32_t sr_cq_tail;
+	struct SysRingSqe sr_sq[SYSRING_NSQE];
+	struct SysRingCqe sr_cq[SYSRING_NCQE];
+};
+
+#endif /* !JOS_INC_SYSRING_H */
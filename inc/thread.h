@@ -0,0 +1,28 @@
+#ifndef JOS_INC_THREAD_H
+#define JOS_INC_THREAD_H
+
+#include <inc/types.h>
+#include <inc/env.h>
+
+// A thread is an environment sharing its creator's address space
+// (see lib/thread.c and sys_thread_create).  Each has its own stack
+// and exception stack in a slot of the region at THREADBASE, and its
+// env_tls slot points at its struct Thread.  Threads synchronize with
+// the futex-based struct Mutex, Cond and Sem of inc/sync.h, which
+// work in ordinary memory since all threads map the same pages.
+
+#define THREADBASE	0xB0000000	// Slots of thread stacks
+#define NTHREAD		32		// Most threads at once
+#define TSTKPAGES	8		// Stack pages per thread
+#define TSLOTSIZE	(16 * PGSIZE)	// xstack, gap, stack, gap
+
+struct Thread {
+	envid_t t_env;			// The thread's env
+	volatile uint32_t t_alive;	// Zeroed by the kernel when it exits
+	void *(*t_func)(void *);	// Function the thread runs
+	void *t_arg;			// Its argument
+	void *t_ret;			// Its result, or thread_exit's argument
+	bool t_used;			// Slot is taken
+};
+
+#endif /* !JOS_INC_THREAD_H */
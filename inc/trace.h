@@ -0,0 +1,22 @@
+#ifndef JOS_INC_TRACE_H
+#define JOS_INC_TRACE_H
+
+#include <inc/types.h>
+
+// Values of tr_flags in struct TraceRec
+#define TRACE_PENDING	0x1	// Call had not returned when the record was read
+#define TRACE_OVERRUN	0x2	// Earlier records from this CPU were lost
+
+// One traced system call, as returned by sys_trace_read.
+struct TraceRec {
+	int32_t tr_envid;		// Calling environment
+	uint32_t tr_num;		// SYS_* number
+	uint32_t tr_args[5];
+	int32_t tr_ret;			// Return value, if it returned
+	uint32_t tr_cpu;		// CPU the call ran on
+	uint32_t tr_flags;
+	uint64_t tr_start;		// TSC at entry
+	uint64_t tr_cycles;		// TSC ticks spent in the call
+};
+
+#endif /* !JOS_INC_TRACE_H */
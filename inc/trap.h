@@ -27,6 +27,8 @@
 // These are arbitrarily chosen, but with care not to overlap
 // processor defined exceptions or interrupt vectors.
 #define T_SYSCALL   48		// system call
+#define T_IPCCALL   49		// IPC call with the message in registers
+#define T_TLBFLUSH  50		// TLB shootdown IPI between CPUs
 #define T_DEFAULT   500		// catchall
 
 #define IRQ_OFFSET	32	// IRQ 0 corresponds to int IRQ_OFFSET
@@ -185,6 +185,24 @@ rcr4(void)
 	return cr4;
 }
 
+static inline void
+clts(void)
+{
+	asm volatile("clts");
+}
+
+static inline void
+fxsave(void *area)
+{
+	asm volatile("fxsave (%0)" : : "r" (area) : "memory");
+}
+
+static inline void
+fxrstor(const void *area)
+{
+	asm volatile("fxrstor (%0)" : : "r" (area) : "memory");
+}
+
 static inline void
 tlbflush(void)
 {
@@ -261,4 +279,29 @@ xchg(volatile uint32_t *addr, uint32_t newval)
 	return result;
 }
 
+// If *addr is 'oldval', atomically replace it with 'newval'.
+// Returns the value *addr held before.
+static inline uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t oldval, uint32_t newval)
+{
+	uint32_t result;
+
+	asm volatile("lock; cmpxchgl %2, %1"
+		     : "=a" (result), "+m" (*addr)
+		     : "r" (newval), "0" (oldval)
+		     : "cc");
+	return result;
+}
+
+// Atomically add 'inc' to *addr, returning the old value.
+static inline uint32_t
+atomic_add(volatile uint32_t *addr, uint32_t inc)
+{
+	asm volatile("lock; xaddl %0, %1"
+		     : "+r" (inc), "+m" (*addr)
+		     :
+		     : "cc");
+	return inc;
+}
+
 #endif /* !JOS_INC_X86_H */
@@ -0,0 +1,60 @@
+// Boot phase timing.
+//
+// Each CPU keeps a list of TSC timestamps taken as boot phases end.
+// boot_report prints how long each phase took.
+
+#include <inc/x86.h>
+#include <inc/stdio.h>
+
+#include <kern/boottime.h>
+#include <kern/cpu.h>
+
+#define NBOOTMARK	16
+
+static struct BootMark {
+	const char *bm_phase;		// Phase that ended here
+	uint64_t bm_tsc;
+} boot_marks[NCPU][NBOOTMARK];
+static int boot_nmarks[NCPU];
+
+// Record that 'phase' just finished on CPU 'cpu'.
+// The first mark of each CPU only sets the starting point.
+void
+boot_mark_cpu(int cpu, const char *phase)
+{
+	struct BootMark *bm;
+
+	if (boot_nmarks[cpu] == NBOOTMARK)
+		return;
+	bm = &boot_marks[cpu][boot_nmarks[cpu]++];
+	bm->bm_phase = phase;
+	bm->bm_tsc = read_tsc();
+}
+
+void
+boot_mark(const char *phase)
+{
+	boot_mark_cpu(cpunum(), phase);
+}
+
+void
+boot_report(void)
+{
+	struct BootMark *bm;
+	uint64_t total, ticks;
+	int cpu, i;
+
+	cprintf("Boot time breakdown (TSC ticks):\n");
+	for (cpu = 0; cpu < ncpu; cpu++) {
+		if (boot_nmarks[cpu] < 2)
+			continue;
+		bm = boot_marks[cpu];
+		total = bm[boot_nmarks[cpu] - 1].bm_tsc - bm[0].bm_tsc;
+		cprintf("  CPU %d: %llu total\n", cpu, total);
+		for (i = 1; i < boot_nmarks[cpu]; i++) {
+			ticks = bm[i].bm_tsc - bm[i - 1].bm_tsc;
+			cprintf("    %-20s %12llu  %3d%%\n", bm[i].bm_phase, ticks,
+				total ? (int) (ticks * 100 / total) : 0);
+		}
+	}
+}
@@ -0,0 +1,11 @@
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+void boot_mark(const char *phase);
+void boot_mark_cpu(int cpu, const char *phase);
+void boot_report(void);
+
+#endif /* !JOS_KERN_BOOTTIME_H */
@@ -14,6 +14,9 @@
 #include <kern/sched.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/syscall.h>
+#include <kern/futex.h>
+#include <kern/pager.h>
 
 struct Env *envs = NULL;		// All environments
 static struct Env *env_free_list;	// Free environment list
@@ -238,6 +241,7 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 	e->env_type = ENV_TYPE_USER;
 	e->env_status = ENV_RUNNABLE;
 	e->env_runs = 0;
+	e->env_trace = 0;
 
 	// Clear out all the saved register state,
 	// to prevent the register values
@@ -266,9 +270,46 @@ env_alloc(struct Env **newenv_store, envid_t parent_id)
 
 	// Clear the page fault handler until user installs one.
 	e->env_pgfault_upcall = 0;
+	e->env_xstacktop = UXSTACKTOP;
 
-	// Also clear the IPC receiving flag.
+	// Not a thread until sys_thread_create makes it one.
+	e->env_tls = 0;
+	e->env_thread_exit = NULL;
+	e->env_vfork_parent = 0;
+
+	// Also clear the IPC receiving flag and send queue.
 	e->env_ipc_recving = 0;
+	e->env_ipc_call = 0;
+	e->env_ipc_sendregs = 0;
+	e->env_ipc_recvfrom = 0;
+	e->env_ipc_recvtag = e->env_ipc_recvmask = 0;
+	e->env_ipc_sendq = e->env_ipc_sendq_tail = NULL;
+	e->env_ipc_sendto = 0;
+	e->env_ipc_fromq = NULL;
+
+	// Nothing is paged in on demand until spawn asks.
+	memset(e->env_pager, 0, sizeof(e->env_pager));
+	e->env_pager_wait = 0;
+	e->env_pager_failed = 0;
+	e->env_seq_va = e->env_seq_end = 0;
+
+	// No notifications yet.
+	e->env_notify_pending = 0;
+	e->env_notify_waitmask = 0;
+
+	// Not waiting on a futex.
+	e->env_futex_key = 0;
+	e->env_futex_deadline = 0;
+
+	// No syscall ring until the env asks for one.
+	e->env_ring = NULL;
+
+	// Start with the FPU state fninit would produce: all exceptions
+	// masked in both the x87 control word and MXCSR.
+	memset(e->env_fxsave, 0, sizeof(e->env_fxsave));
+	*(uint16_t *) &e->env_fxsave[0] = 0x037f;	// FCW
+	*(uint32_t *) &e->env_fxsave[24] = 0x1f80;	// MXCSR
+	e->env_fpu_cpu = -1;
 
 	// commit the allocation
 	env_free_list = e->env_link;
@@ -312,6 +353,111 @@ region_alloc(struct Env *e, void *va, size_t len)
 	}
 }
 
+// Read-only pages of the binaries built into the kernel, shared by
+// every env that load_icode loads from the same binary.  Each entry
+// holds a reference to its page, so the page outlives its envs.
+#define NICODE_TEXT	128
+
+static struct IcodeText {
+	const uint8_t *it_binary;	// Binary the page belongs to
+	uintptr_t it_va;		// Page-aligned va it is loaded at
+	struct PageInfo *it_page;
+} icode_text[NICODE_TEXT];
+
+// Return the page at 'va' of the read-only segment 'ph' of 'binary',
+// loading it if this is the first env to need it.
+static struct PageInfo *
+icode_text_page(const uint8_t *binary, struct Proghdr *ph, uintptr_t va)
+{
+	struct IcodeText *it, *free = NULL;
+	struct PageInfo *pp;
+	uintptr_t start, end;
+
+	for (it = icode_text; it < icode_text + NICODE_TEXT; it++) {
+		if (it->it_page && it->it_binary == binary && it->it_va == va)
+			return it->it_page;
+		if (!it->it_page && !free)
+			free = it;
+	}
+
+	if (!(pp = page_alloc(ALLOC_ZERO)))
+		panic("page_alloc() failed");
+	start = MAX(va, ph->p_va);
+	end = MIN(va + PGSIZE, ph->p_va + ph->p_filesz);
+	if (start < end)
+		memcpy(page2kva(pp) + (start - va),
+		       binary + ph->p_offset + (start - ph->p_va), end - start);
+	if (free) {
+		free->it_binary = binary;
+		free->it_va = va;
+		free->it_page = pp;
+		pp->pp_ref++;
+	}
+	return pp;
+}
+
+// Is 'e' using the page directory of an earlier env, as threads and
+// vfork children do?
+static bool
+env_pgdir_seen(struct Env *e)
+{
+	struct Env *o;
+
+	for (o = envs; o < e; o++)
+		if (o->env_status != ENV_FREE && o->env_pgdir == e->env_pgdir)
+			return 1;
+	return 0;
+}
+
+// Print how much memory sharing read-only pages between envs saves:
+// each address space's read-only user mappings (other than PTE_SHARE
+// pages), and how many of them map the same page at the same address
+// as some earlier address space, as envs running the same binary do
+// for its text.  Envs sharing one page directory count once.
+void
+env_text_report(void)
+{
+	uint32_t nmap = 0, nshared = 0, ncached = 0;
+	struct Env *e, *o;
+	uintptr_t va;
+	pte_t *pte, *opte;
+	int i;
+
+	for (e = envs; e < envs + NENV; e++) {
+		if (e->env_status == ENV_FREE || env_pgdir_seen(e))
+			continue;
+		for (va = 0; va < UTOP; va += PGSIZE) {
+			if (!(e->env_pgdir[PDX(va)] & PTE_P)) {
+				va = ROUNDUP(va + 1, PTSIZE) - PGSIZE;
+				continue;
+			}
+			pte = pgdir_walk(e->env_pgdir, (void *) va, 0);
+			if ((*pte & (PTE_P | PTE_U | PTE_W | PTE_COW | PTE_SHARE))
+			    != (PTE_P | PTE_U))
+				continue;
+			nmap++;
+			for (o = envs; o < e; o++) {
+				if (o->env_status == ENV_FREE
+				    || o->env_pgdir == e->env_pgdir)
+					continue;
+				opte = pgdir_walk(o->env_pgdir, (void *) va, 0);
+				if (opte && (*opte & PTE_P)
+				    && PTE_ADDR(*opte) == PTE_ADDR(*pte)) {
+					nshared++;
+					break;
+				}
+			}
+		}
+	}
+	for (i = 0; i < NICODE_TEXT; i++)
+		if (icode_text[i].it_page)
+			ncached++;
+	cprintf("read-only pages: %u mappings, %u shared with another env\n",
+		nmap, nshared);
+	cprintf("memory saved: %uK\n", nshared * PGSIZE / 1024);
+	cprintf("kernel binary text cache: %u pages\n", ncached);
+}
+
 //
 // Set up the initial program binary, stack, and processor flags
 // for a user process.
@@ -369,6 +515,7 @@ load_icode(struct Env *e, uint8_t *binary)
 
 	struct Elf *ELFHDR = (struct Elf *) binary;
 	struct Proghdr *ph, *eph;
+	uintptr_t va;
 	if (ELFHDR->e_magic != ELF_MAGIC){
 		panic("ELF header invalid");
 	}
@@ -380,6 +527,17 @@ load_icode(struct Env *e, uint8_t *binary)
 		if(ph->p_filesz > ph->p_memsz){
 			panic("ph->p_filesz > ph->p_memsz");
 		}
+		// Read-only segments share their pages with every other
+		// env loaded from this binary.
+		if (!(ph->p_flags & ELF_PROG_FLAG_WRITE)) {
+			for (va = ROUNDDOWN(ph->p_va, PGSIZE);
+			     va < ph->p_va + ph->p_memsz; va += PGSIZE)
+				if (page_insert(e->env_pgdir,
+						icode_text_page(binary, ph, va),
+						(void *) va, PTE_U) < 0)
+					panic("page_insert() failed");
+			continue;
+		}
 		region_alloc(e, (void *)ph->p_va, ph->p_memsz);
 		memset((void *)ph->p_va, 0, ph->p_memsz);
 		memcpy((void *)ph->p_va, binary + ph->p_offset, ph->p_filesz);
@@ -420,15 +578,73 @@ env_create(uint8_t *binary, enum EnvType type)
 	}
 }
 
+//
+// Make 'e', just allocated, share the address space of 'src' as one
+// of its threads.  The page directory's pp_ref counts the envs using
+// it, and env_free tears the address space down only for the last.
+//
+void
+env_share_vm(struct Env *e, struct Env *src)
+{
+	page_decref(pa2page(PADDR(e->env_pgdir)));
+	e->env_pgdir = src->env_pgdir;
+	pa2page(PADDR(e->env_pgdir))->pp_ref++;
+}
+
+//
+// Zero the word thread 'e' gave sys_thread_create and wake anyone
+// waiting on it, as a thread joining e expects.  If the word's page,
+// or its page table, is copy-on-write, as after a fork or lazy fork,
+// the threads get their own copy first.
+//
+static void
+env_thread_exited(struct Env *e)
+{
+	uintptr_t va = (uintptr_t) e->env_thread_exit;
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	e->env_thread_exit = NULL;
+	if (!page_lookup(e->env_pgdir, (void *) va, &pte))
+		return;
+	if ((!(*pte & PTE_W) || !(e->env_pgdir[PDX(va)] & PTE_W)
+	     || (e->env_pgdir[PDX(va)] & PTE_COW))
+	    && pager_fault(e, va, true, false) < 0)
+		return;
+	pp = page_lookup(e->env_pgdir, (void *) va, NULL);
+	*(uint32_t *) (page2kva(pp) + PGOFF(va)) = 0;
+	futex_wake_pa(page2pa(pp) + PGOFF(va), NENV);
+}
+
 //
 // Frees env e and all memory it uses.
 //
 void
 env_free(struct Env *e)
 {
+	struct Env *parent;
 	pte_t *pt;
 	uint32_t pdeno, pteno;
 	physaddr_t pa;
+	bool last;
+	int i;
+
+	// Tell any thread joining us that we are gone.
+	if (e->env_thread_exit)
+		env_thread_exited(e);
+
+	// Resume the parent that lent us its address space.
+	// A ring the child registered is the parent's, at the same place.
+	if (e->env_vfork_parent && envid2env(e->env_vfork_parent, &parent, 0) == 0
+	    && parent->env_status == ENV_NOT_RUNNABLE) {
+		parent->env_status = ENV_RUNNABLE;
+		if (e->env_ring && parent->env_ring != e->env_ring) {
+			if (parent->env_ring)
+				page_decref(parent->env_ring);
+			parent->env_ring = e->env_ring;
+			parent->env_ring->pp_ref++;
+		}
+	}
 
 	// If freeing the current environment, switch to kern_pgdir
 	// before freeing the page directory, just in case the page
@@ -436,12 +652,22 @@ env_free(struct Env *e)
 	if (e == curenv)
 		lcr3(PADDR(kern_pgdir));
 
+	// Forget any CPU's cached copy of our FPU state.  If it is still
+	// live on this CPU, make the next FPU user trap so it cannot see it.
+	if (thiscpu->cpu_fpu_env == e)
+		lcr0(rcr0() | CR0_TS);
+	for (i = 0; i < ncpu; i++)
+		if (cpus[i].cpu_fpu_env == e)
+			cpus[i].cpu_fpu_env = NULL;
+
 	// Note the environment's demise.
 	// cprintf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
 
-	// Flush all mapped pages in the user portion of the address space
+	// Flush all mapped pages in the user portion of the address space,
+	// unless other threads still use it.
 	static_assert(UTOP % PTSIZE == 0);
-	for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
+	last = pa2page(PADDR(e->env_pgdir))->pp_ref == 1;
+	for (pdeno = 0; last && pdeno < PDX(UTOP); pdeno++) {
 
 		// only look at mapped page tables
 		if (!(e->env_pgdir[pdeno] & PTE_P))
@@ -451,6 +677,14 @@ env_free(struct Env *e)
 		pa = PTE_ADDR(e->env_pgdir[pdeno]);
 		pt = (pte_t*) KADDR(pa);
 
+		// a table shared by a lazy fork keeps its pages for the
+		// envs still using it
+		if ((e->env_pgdir[pdeno] & PTE_COW) && pa2page(pa)->pp_ref > 1) {
+			e->env_pgdir[pdeno] = 0;
+			page_decref(pa2page(pa));
+			continue;
+		}
+
 		// unmap all PTEs in this page table
 		for (pteno = 0; pteno <= PTX(~0); pteno++) {
 			if (pt[pteno] & PTE_P)
@@ -462,6 +696,16 @@ env_free(struct Env *e)
 		page_decref(pa2page(pa));
 	}
 
+	// wake anyone blocked sending to us, and leave any send queue
+	ipc_env_free(e);
+	futex_env_free(e);
+
+	// drop the kernel's reference to the syscall ring
+	if (e->env_ring) {
+		page_decref(e->env_ring);
+		e->env_ring = NULL;
+	}
+
 	// free the page directory
 	pa = PADDR(e->env_pgdir);
 	e->env_pgdir = 0;
@@ -471,6 +715,9 @@ env_free(struct Env *e)
 	e->env_status = ENV_FREE;
 	e->env_link = env_free_list;
 	env_free_list = e;
+
+	// wake envs sleeping in wait() on our status (see lib/wait.c)
+	futex_wake_pa(PADDR(&e->env_status), NENV);
 }
 
 //
@@ -498,6 +745,43 @@ env_destroy(struct Env *e)
 }
 
 
+//
+// Called when this CPU stops running its current environment.
+// If the environment that owns the FPU has used it since it was last
+// switched in (CR0.TS is clear), write its state back to its Env so
+// that it can resume on any CPU.  Then set CR0.TS so that the next FPU
+// instruction traps to env_fpu_restore.  Environments that never touch
+// the FPU only pay for reading CR0.
+//
+void
+env_fpu_save(void)
+{
+	uint32_t cr0 = rcr0();
+
+	if (cr0 & CR0_TS)
+		return;
+	if (thiscpu->cpu_fpu_env)
+		fxsave(thiscpu->cpu_fpu_env->env_fxsave);
+	lcr0(cr0 | CR0_TS);
+}
+
+//
+// Handles the device-not-available trap taken by curenv.
+// The registers still hold curenv's state if it was the last FPU user
+// on this CPU and has not run anywhere else since, in which case only
+// CR0.TS needs to be cleared.
+//
+void
+env_fpu_restore(void)
+{
+	clts();
+	if (thiscpu->cpu_fpu_env == curenv && curenv->env_fpu_cpu == cpunum())
+		return;
+	fxrstor(curenv->env_fxsave);
+	thiscpu->cpu_fpu_env = curenv;
+	curenv->env_fpu_cpu = cpunum();
+}
+
 //
 // Restores the register values in the Trapframe with the 'iret' instruction.
 // This exits the kernel and starts executing some environment's code.
@@ -554,10 +838,14 @@ env_run(struct Env *e)
 			curenv->env_status = ENV_RUNNABLE;
 		}
 	}
-	if(curenv != e) e->env_runs ++;
+	if(curenv != e) {
+		e->env_runs ++;
+		env_fpu_save();
+	}
 	curenv = e;
 	e->env_status = ENV_RUNNING;
 	lcr3(PADDR(e->env_pgdir));
+	xchg(&thiscpu->cpu_in_user, 1);
 	unlock_kernel();
 	env_pop_tf(&e->env_tf);
 	
@@ -14,8 +14,13 @@ void	env_init(void);
 void	env_init_percpu(void);
 int	env_alloc(struct Env **e, envid_t parent_id);
 void	env_free(struct Env *e);
+void	env_share_vm(struct Env *e, struct Env *src);
 void	env_create(uint8_t *binary, enum EnvType type);
 void	env_destroy(struct Env *e);	// Does not return if e == curenv
+void	env_text_report(void);
+
+void	env_fpu_save(void);
+void	env_fpu_restore(void);
 
 int	envid2env(envid_t envid, struct Env **env_store, bool checkperm);
 // The following two functions do not return
@@ -0,0 +1,171 @@
+// Futexes: sleep until another env wakes the same user word.
+//
+// A futex is named by the physical address of the word, so envs that
+// map the same page (PTE_SHARE pages, or the read-only envs array at
+// UENVS) share it wherever they map it.  Waiting envs hang off a small
+// hash table, linked through env_futex_next.
+
+#include <inc/error.h>
+#include <inc/assert.h>
+
+#include <kern/futex.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/pager.h>
+#include <kern/sched.h>
+#include <kern/time.h>
+
+#define NFUTEXBUCKET	64
+
+static struct Env *futex_buckets[NFUTEXBUCKET];
+static int futex_ntimed;	// Waiters with a timeout
+
+static struct Env **
+futex_bucket(physaddr_t key)
+{
+	return &futex_buckets[(key >> 2) % NFUTEXBUCKET];
+}
+
+// Find the futex key for 'addr' in the current environment, paging it
+// in first if need be.  Called before a futex call does any work.
+// A copy-on-write page, or a writable one in a page table shared by a
+// lazy fork, gets its own copy first: the first write to the word
+// would move it to a new page anyway, and a waker that writes the
+// word before waking uses that page's key.
+// Destroys the environment if 'addr' is not a user-readable word.
+static physaddr_t
+futex_key(uint32_t *addr)
+{
+	struct PageInfo *pp;
+	pte_t *pte;
+
+	user_mem_fault_in(curenv, addr, sizeof(*addr), PTE_U);
+	user_mem_assert(curenv, addr, sizeof(*addr), PTE_U);
+	pp = page_lookup(curenv->env_pgdir, addr, &pte);
+	if (((*pte & PTE_COW)
+	     || ((*pte & PTE_W) && (curenv->env_pgdir[PDX(addr)] & PTE_COW)))
+	    && pager_fault(curenv, (uintptr_t) addr, true, false) == 0)
+		pp = page_lookup(curenv->env_pgdir, addr, NULL);
+	return page2pa(pp) + PGOFF(addr);
+}
+
+// Take 'e' off its wait queue and make it runnable, returning 'ret'
+// from sys_futex_wait.
+static void
+futex_unblock(struct Env **pe, int ret)
+{
+	struct Env *e = *pe;
+
+	*pe = e->env_futex_next;
+	if (e->env_futex_deadline)
+		futex_ntimed--;
+	e->env_futex_key = 0;
+	e->env_futex_deadline = 0;
+	e->env_tf.tf_regs.reg_eax = ret;
+	if (e->env_status == ENV_NOT_RUNNABLE)
+		e->env_status = ENV_RUNNABLE;
+}
+
+// If *addr still holds 'expected', sleep until a futex_wake on the same
+// word, or until 'timeout' milliseconds pass (0 means no timeout).
+// Waiters on one word wake in the order they went to sleep.
+//
+// Returns 0 when woken, or
+//	-E_INVAL if addr is not 4-byte aligned,
+//	-E_AGAIN if *addr != expected,
+//	-E_TIMEOUT if the timeout expired first.
+int
+futex_wait(uint32_t *addr, uint32_t expected, uint32_t timeout)
+{
+	struct Env **pe;
+	physaddr_t key;
+
+	if ((uintptr_t) addr % sizeof(*addr) != 0)
+		return -E_INVAL;
+	key = futex_key(addr);
+	if (*addr != expected)
+		return -E_AGAIN;
+
+	for (pe = futex_bucket(key); *pe; pe = &(*pe)->env_futex_next)
+		;
+	*pe = curenv;
+	curenv->env_futex_next = NULL;
+	curenv->env_futex_key = key;
+	curenv->env_futex_deadline = 0;
+	if (timeout) {
+		curenv->env_futex_deadline = time_msec() + timeout;
+		futex_ntimed++;
+	}
+
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Wake up to 'n' envs sleeping on the futex at physical address 'pa'.
+// Returns the number woken.
+int
+futex_wake_pa(physaddr_t pa, int n)
+{
+	struct Env **pe;
+	int woken = 0;
+
+	for (pe = futex_bucket(pa); *pe && woken < n; )
+		if ((*pe)->env_futex_key == pa) {
+			futex_unblock(pe, 0);
+			woken++;
+		} else
+			pe = &(*pe)->env_futex_next;
+	return woken;
+}
+
+// Wake up to 'n' envs sleeping on the word at 'addr'.
+// Returns the number woken, or -E_INVAL if addr is not 4-byte aligned.
+int
+futex_wake(uint32_t *addr, int n)
+{
+	if ((uintptr_t) addr % sizeof(*addr) != 0)
+		return -E_INVAL;
+	return futex_wake_pa(futex_key(addr), n);
+}
+
+// Called on every clock tick: time out expired waiters.
+void
+futex_tick(void)
+{
+	struct Env **pe;
+	unsigned int now;
+	int i;
+
+	if (futex_ntimed == 0)
+		return;
+	now = time_msec();
+	for (i = 0; i < NFUTEXBUCKET; i++)
+		for (pe = &futex_buckets[i]; *pe; )
+			if ((*pe)->env_futex_deadline
+			    && (int) (now - (*pe)->env_futex_deadline) >= 0)
+				futex_unblock(pe, -E_TIMEOUT);
+			else
+				pe = &(*pe)->env_futex_next;
+}
+
+// Will some sleeping env wake up on its own?
+bool
+futex_timed_waiters(void)
+{
+	return futex_ntimed > 0;
+}
+
+// Called as 'e' is freed: take it off any futex queue.
+void
+futex_env_free(struct Env *e)
+{
+	struct Env **pe;
+
+	if (!e->env_futex_key)
+		return;
+	for (pe = futex_bucket(e->env_futex_key); *pe; pe = &(*pe)->env_futex_next)
+		if (*pe == e) {
+			futex_unblock(pe, 0);
+			break;
+		}
+}
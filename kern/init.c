@@ -14,6 +14,8 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/boottime.h>
+#include <kern/time.h>
 
 static void boot_aps(void);
 
@@ -21,9 +23,12 @@ static void boot_aps(void);
 void
 i386_init(void)
 {
+	boot_mark(NULL);
+
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boot_mark("cons_init");
 
 	cprintf("6828 decimal is %o octal!\n", 6828);
 
@@ -32,20 +37,28 @@ i386_init(void)
 
 	// Lab 3 user environment initialization functions
 	env_init();
+	boot_mark("env_init");
 	trap_init();
+	boot_mark("trap_init");
 
 	// Lab 4 multiprocessor initialization functions
 	mp_init();
+	boot_mark("mp_init");
 	lapic_init();
+	boot_mark("lapic_init");
 
 	// Lab 4 multitasking initialization functions
 	pic_init();
+	time_init();
+	boot_mark("pic_init");
 
 	// Acquire the big kernel lock before waking up APs
 	// Your code here:
 	lock_kernel();
 	// Starting non-boot CPUs
 	boot_aps();
+	boot_mark("boot_aps");
+	boot_report();
 
 	// Start fs.
 	ENV_CREATE(fs_fs, ENV_TYPE_FS);
@@ -89,6 +102,7 @@ boot_aps(void)
 
 		// Tell mpentry.S what stack to use 
 		mpentry_kstack = percpu_kstacks[c - cpus] + KSTKSIZE;
+		boot_mark_cpu(c - cpus, NULL);
 		// Start the CPU at mpentry_start
 		lapic_startap(c->cpu_id, PADDR(code));
 		// Wait for the CPU to finish some basic setup in mp_main()
@@ -103,11 +117,15 @@ mp_main(void)
 {
 	// We are in high EIP now, safe to switch to kern_pgdir 
 	lcr3(PADDR(kern_pgdir));
+	boot_mark("startap");
 	cprintf("SMP: CPU %d starting\n", cpunum());
 
 	lapic_init();
+	boot_mark("lapic_init");
 	env_init_percpu();
+	boot_mark("env_init_percpu");
 	trap_init_percpu();
+	boot_mark("trap_init_percpu");
 	xchg(&thiscpu->cpu_status, CPU_STARTED); // tell boot_aps() we're up
 
 	// Now that we have finished some basic setup, call sched_yield()
@@ -112,6 +112,17 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 //
 int
 debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
+{
+	return debuginfo_env_eip(curenv, addr, info);
+}
+
+// debuginfo_env_eip(e, addr, info)
+//
+//	Like debuginfo_eip, but user addresses are looked up in the stabs
+//	of environment 'e', whose page directory must be loaded.
+//
+int
+debuginfo_env_eip(struct Env *e, uintptr_t addr, struct Eipdebuginfo *info)
 {
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
@@ -143,7 +154,7 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 		// Return -1 if it is not.  Hint: Call user_mem_check.
 		// LAB 3: Your code here.
 
-		if(user_mem_check(curenv, usd, sizeof(struct UserStabData), PTE_U) < 0){
+		if(!e || user_mem_check(e, usd, sizeof(struct UserStabData), PTE_U) < 0){
 			return -1;
 		}
 
@@ -155,10 +166,10 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 		// Make sure the STABS and string table memory is valid.
 		// LAB 3: Your code here.
 
-		if(user_mem_check(curenv, stabs, (size_t)(stab_end - stabs), PTE_U) < 0){
+		if(user_mem_check(e, stabs, (size_t)(stab_end - stabs), PTE_U) < 0){
 			return -1;
 		}
-		if(user_mem_check(curenv, stabstr, (size_t)(stabstr_end - stabstr), PTE_U) < 0){
+		if(user_mem_check(e, stabstr, (size_t)(stabstr_end - stabstr), PTE_U) < 0){
 			return -1;
 		}
 	}
@@ -13,6 +13,7 @@
 #include <kern/pmap.h>
 #include <kern/trap.h>
 #include <kern/env.h>
+#include <kern/prof.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -34,6 +35,8 @@ static struct Command commands[] = {
 	{ "dumppmem", "Dump the physical memory", mon_dumppmem },
 	{ "stepi", "Step one instruction exactly", mon_stepi},
 	{ "continue", "Continue program being debugged", mon_continue },
+	{ "profile", "Control the sampling profiler", mon_profile },
+	{ "textshare", "Display memory saved by sharing program text", mon_textshare },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -235,6 +238,27 @@ mon_continue(int argc, char **argv, struct Trapframe *tf)
 	env_run(curenv);
 	return 0;
 }
+int
+mon_profile(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 2 && strcmp(argv[1], "start") == 0)
+		prof_start(0);
+	else if (argc == 2 && strcmp(argv[1], "stop") == 0)
+		prof_stop();
+	else if (argc == 2 && strcmp(argv[1], "report") == 0)
+		prof_report();
+	else
+		cprintf("Usage: profile start|stop|report\n");
+	return 0;
+}
+
+int
+mon_textshare(int argc, char **argv, struct Trapframe *tf)
+{
+	env_text_report();
+	return 0;
+}
+
 /***** Kernel monitor command interpreter *****/
 
 #define WHITESPACE "\t\r\n "
@@ -21,4 +21,6 @@ int mon_dumpvmem(int argc, char **argv, struct Trapframe *tf);
 int mon_dumppmem(int argc, char **argv, struct Trapframe *tf);
 int mon_stepi(int argc, char **argv, struct Trapframe *tf);
 int mon_continue(int argc, char **argv, struct Trapframe *tf);
+int mon_profile(int argc, char **argv, struct Trapframe *tf);
+int mon_textshare(int argc, char **argv, struct Trapframe *tf);
 #endif	// !JOS_KERN_MONITOR_H
@@ -0,0 +1,224 @@
+// Page faults the kernel resolves without an upcall: copy-on-write
+// pages, and pages of the regions an env was set up to demand-page
+// with sys_env_set_pager.
+//
+// A region's zero-filled pages are mapped from one shared zero page,
+// copy-on-write if the region is writable, so bss that is only read
+// costs no memory.  Its other pages belong to a pager env, normally
+// the file server: the faulting env sends the pager a request as if
+// by sys_ipc_call and blocks until the reply maps the page (see
+// ipc_pagein), then retries the faulting instruction.
+//
+// Faults that need no pager can also be resolved ahead of time for a
+// whole range (see pager_populate and sys_page_populate), or a few
+// pages ahead of each fault in a range advised MADV_SEQUENTIAL.
+
+#include <inc/mmu.h>
+#include <inc/error.h>
+#include <inc/string.h>
+
+#include <kern/pager.h>
+#include <kern/env.h>
+#include <kern/pmap.h>
+#include <kern/syscall.h>
+
+#define PAGER_AHEAD	8	// Pages resolved ahead of a MADV_SEQUENTIAL fault
+
+static struct PageInfo *zero_page;
+
+// Add 'pr' to e's demand-paged regions.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if the region is empty, misaligned, reaches UTOP,
+//		overlaps another region, or pr_perm is not PTE_P|PTE_U
+//		with at most PTE_W besides.
+//	-E_NO_MEM if e already has NPAGER regions.
+int
+pager_add(struct Env *e, const struct PagerRegion *pr)
+{
+	struct PagerRegion *slot = NULL;
+	int i;
+
+	if (pr->pr_va % PGSIZE || pr->pr_fileend % PGSIZE || pr->pr_end % PGSIZE
+	    || pr->pr_va >= pr->pr_end || pr->pr_end > UTOP
+	    || pr->pr_fileend < pr->pr_va || pr->pr_fileend > pr->pr_end
+	    || (pr->pr_perm & (PTE_P | PTE_U)) != (PTE_P | PTE_U)
+	    || (pr->pr_perm & ~(PTE_P | PTE_U | PTE_W)))
+		return -E_INVAL;
+	for (i = 0; i < NPAGER; i++) {
+		if (!e->env_pager[i].pr_end)
+			slot = slot ? slot : &e->env_pager[i];
+		else if (pr->pr_va < e->env_pager[i].pr_end
+			 && e->env_pager[i].pr_va < pr->pr_end)
+			return -E_INVAL;
+	}
+	if (!slot)
+		return -E_NO_MEM;
+	*slot = *pr;
+	return 0;
+}
+
+static struct PagerRegion *
+pager_region(struct Env *e, uintptr_t va)
+{
+	int i;
+
+	for (i = 0; i < NPAGER; i++)
+		if (e->env_pager[i].pr_va <= va && va < e->env_pager[i].pr_end)
+			return &e->env_pager[i];
+	return NULL;
+}
+
+// Give 'e' its own writable copy of the copy-on-write page 'pp'
+// mapped at 'va', or just make the mapping writable if e holds the
+// only reference.
+static int
+pager_cow(struct Env *e, uintptr_t va, struct PageInfo *pp, pte_t *pte)
+{
+	struct PageInfo *np;
+	int r;
+
+	if (pp->pp_ref == 1) {
+		*pte = (*pte & ~PTE_COW) | PTE_W;
+		tlb_invalidate(e->env_pgdir, (void *) va);
+		return 0;
+	}
+	if (!(np = page_alloc(0)))
+		return -E_NO_MEM;
+	memcpy(page2kva(np), page2kva(pp), PGSIZE);
+	if ((r = page_insert(e->env_pgdir, np, (void *) va,
+			     ((*pte & PTE_SYSCALL) & ~PTE_COW) | PTE_W)) < 0) {
+		page_free(np);
+		return r;
+	}
+	return 0;
+}
+
+// Map a zero-filled page at 'va' in 'e' with 'perm'.  Unless it is
+// being written, this is the shared zero page.
+static int
+pager_zero(struct Env *e, uintptr_t va, int perm, bool write)
+{
+	struct PageInfo *pp;
+	int r;
+
+	if (write && (perm & PTE_W)) {
+		if (!(pp = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		if ((r = page_insert(e->env_pgdir, pp, (void *) va, perm)) < 0)
+			page_free(pp);
+		return r;
+	}
+	if (!zero_page) {
+		if (!(zero_page = page_alloc(ALLOC_ZERO)))
+			return -E_NO_MEM;
+		zero_page->pp_ref++;	// never freed
+	}
+	if (perm & PTE_W)
+		perm = (perm & ~PTE_W) | PTE_COW;
+	return page_insert(e->env_pgdir, zero_page, (void *) va, perm);
+}
+
+// Resolve a fault by 'e' on the page holding 'va' without an upcall,
+// as pager_fault describes, but without resolving any pages ahead.
+static int
+pager_resolve(struct Env *e, uintptr_t va, bool write, bool can_wait)
+{
+	struct PagerRegion *pr;
+	struct PageInfo *pp;
+	uint32_t words[IPC_NWORDS];
+	pte_t *pte;
+	int r, shared = 0;
+
+	va = ROUNDDOWN(va, PGSIZE);
+	if (va >= UTOP)
+		return -E_FAULT;
+	if (write && (shared = pt_unshare(e->env_pgdir, va)) < 0)
+		return shared;
+	if ((pp = page_lookup(e->env_pgdir, (void *) va, &pte)) != NULL) {
+		// Copying a page table shared by a lazy fork may be all
+		// the write needed.
+		if (write && shared && (*pte & PTE_W))
+			return 0;
+		return write && (*pte & PTE_COW) ? pager_cow(e, va, pp, pte) : -E_FAULT;
+	}
+
+	if (!(pr = pager_region(e, va)))
+		return -E_FAULT;
+	if (va >= pr->pr_fileend)
+		return pager_zero(e, va, pr->pr_perm, write);
+	if (!can_wait || e != curenv)
+		return -E_FAULT;
+	if (e->env_pager_failed) {
+		e->env_pager_failed = 0;
+		return -E_FAULT;
+	}
+
+	memset(words, 0, sizeof(words));
+	words[0] = pr->pr_req;
+	words[1] = pr->pr_key;
+	words[2] = pr->pr_off + (va - pr->pr_va);
+	words[3] = pr->pr_perm;
+	if ((r = ipc_pagein(pr->pr_pager, words, (void *) va)) < 0)
+		return r;
+	return 1;
+}
+
+// Resolve a fault by 'e' on the page holding 'va' without an upcall:
+// a write to a copy-on-write page or in a page table shared by a lazy
+// fork, or a touch of an unmapped page in one of e's demand-paged
+// regions.  Pages that must come from a pager
+// are only requested if 'can_wait', and e is curenv; e must then
+// block, and retry the access once it runs again.  In the range e
+// advised MADV_SEQUENTIAL, the next PAGER_AHEAD pages are resolved
+// too, as far as pager_populate can.
+//
+// Returns 0 if the page is now mapped, 1 if a page-in request was
+// sent, or < 0 if the fault is not ours to resolve or resolving it
+// failed.  After a page-in that got no page, the next fault that
+// needs the pager fails, so a retried access cannot loop.
+int
+pager_fault(struct Env *e, uintptr_t va, bool write, bool can_wait)
+{
+	int r;
+
+	if ((r = pager_resolve(e, va, write, can_wait)) != 0)
+		return r;
+	va = ROUNDDOWN(va, PGSIZE);
+	if (e->env_seq_va <= va && va < e->env_seq_end)
+		pager_populate(e, va + PGSIZE,
+			       MIN(va + (PAGER_AHEAD + 1) * PGSIZE, e->env_seq_end), write);
+	return 0;
+}
+
+// Is the page at 'va' in 'e' mapped, and writable without a fault if
+// 'write'?
+static bool
+pager_mapped(struct Env *e, uintptr_t va, bool write)
+{
+	pte_t *pte;
+
+	if (!page_lookup(e->env_pgdir, (void *) va, &pte))
+		return 0;
+	return !write || ((*pte & PTE_W) && !(e->env_pgdir[PDX(va)] & PTE_COW));
+}
+
+// Resolve now the faults that touching each page in [va, end) would
+// take in 'e', writing if 'write', wherever that needs no pager.
+// Pages that need one, and pages no fault could map, are skipped.
+//
+// Returns the number of pages in the range now mapped (writable if
+// 'write'), or -E_NO_MEM.
+int
+pager_populate(struct Env *e, uintptr_t va, uintptr_t end, bool write)
+{
+	int n = 0;
+
+	for (va = ROUNDDOWN(va, PGSIZE); va < end; va += PGSIZE) {
+		if (!pager_mapped(e, va, write)
+		    && pager_resolve(e, va, write, false) == -E_NO_MEM)
+			return -E_NO_MEM;
+		if (pager_mapped(e, va, write))
+			n++;
+	}
+	return n;
+}
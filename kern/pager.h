@@ -0,0 +1,13 @@
+#ifndef JOS_KERN_PAGER_H
+#define JOS_KERN_PAGER_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+
+int pager_add(struct Env *e, const struct PagerRegion *pr);
+int pager_fault(struct Env *e, uintptr_t va, bool write, bool can_wait);
+int pager_populate(struct Env *e, uintptr_t va, uintptr_t end, bool write);
+
+#endif /* !JOS_KERN_PAGER_H */
@@ -10,6 +10,9 @@
 #include <kern/kclock.h>
 #include <kern/env.h>
 #include <kern/cpu.h>
+#include <kern/boottime.h>
+#include <kern/pager.h>
+#include <kern/sched.h>
 
 // These variables are set by i386_detect_memory()
 size_t npages;			// Amount of physical memory (in pages)
@@ -163,6 +166,7 @@ mem_init(void)
 	//////////////////////////////////////////////////////////////////////
 	// Make 'envs' point to an array of size 'NENV' of 'struct Env'.
 	// LAB 3: Your code here.
+	static_assert(sizeof(struct Env) * NENV <= PTSIZE);	// fits in UENVS
 	envs = (struct Env*)boot_alloc(sizeof(struct Env) * NENV);
 	memset(envs, 0, sizeof(struct Env) * NENV);
 	//////////////////////////////////////////////////////////////////////
@@ -173,9 +177,15 @@ mem_init(void)
 	// or page_insert
 	page_init();
 
+	// check_page_free_list(1) also moves low pages to the front of the
+	// free list, so it runs even when the self-checks are compiled out.
 	check_page_free_list(1);
+	boot_mark("page_init");
+#ifndef JOS_NOCHECK
 	check_page_alloc();
 	check_page();
+	boot_mark("check_page");
+#endif
 
 	//////////////////////////////////////////////////////////////////////
 	// Now we set up virtual memory
@@ -223,9 +233,13 @@ mem_init(void)
 	
 	// Initialize the SMP-related parts of the memory map
 	mem_init_mp();
+	boot_mark("kern_pgdir");
 
+#ifndef JOS_NOCHECK
 	// Check that the initial page directory has been set up correctly.
 	check_kern_pgdir();
+	boot_mark("check_kern_pgdir");
+#endif
 
 	// Switch from the minimal entry page directory to the full kern_pgdir
 	// page table we just created.	Our instruction pointer should be
@@ -241,7 +255,9 @@ mem_init(void)
 	//lcr4(cr4);
 	
 	lcr3(PADDR(kern_pgdir));
+#ifndef JOS_NOCHECK
 	check_page_free_list(0);
+#endif
 
 	// entry.S set the really important flags in cr0 (including enabling
 	// paging).  Here we configure the rest of the flags that we care about.
@@ -250,8 +266,11 @@ mem_init(void)
 	cr0 &= ~(CR0_TS|CR0_EM);
 	lcr0(cr0);
 
+#ifndef JOS_NOCHECK
 	// Some more checks, only possible after kern_pgdir is installed.
 	check_page_installed_pgdir();
+	boot_mark("check_installed");
+#endif
 }
 
 // Modify mappings in kern_pgdir to support SMP
@@ -422,6 +441,10 @@ pgdir_walk(pde_t *pgdir, const void *va, int create)
 	uint32_t ptx = PTX(va);
 	pte_t *pte;
 	struct PageInfo* pginfo = NULL;
+	// A page table shared by a lazy fork must be copied before
+	// anything in it can change.
+	if(create && (*pde & PTE_COW) && pt_unshare(pgdir, (uintptr_t)va) < 0)
+		return NULL;
 	if(*pde & PTE_P){
 		pte = (pte_t *)KADDR(PTE_ADDR(*pde));
 		return &pte[ptx];
@@ -501,7 +524,7 @@ page_insert(pde_t *pgdir, struct PageInfo *pp, void *va, int perm)
 	pp->pp_ref ++;
 	if(*pte & PTE_P) page_remove(pgdir, va);
 	*pte = page2pa(pp) | perm | PTE_P;
-	pgdir[PDX(va)] |= perm;
+	pgdir[PDX(va)] |= perm & (PTE_W | PTE_U);
 	return 0;
 }
 
@@ -547,6 +570,9 @@ page_remove(pde_t *pgdir, void *va)
 {
 	pte_t *pte;
 	struct PageInfo *page = page_lookup(pgdir, va, &pte);
+	// Callers unshare a page table that other envs may share first.
+	if(page != NULL && pt_unshare(pgdir, (uintptr_t)va) < 0)
+		panic("page_remove: page table at %08x is shared", va);
 	if(page != NULL){
 		*pte = 0;
 		page_decref(page);
@@ -556,9 +582,50 @@ page_remove(pde_t *pgdir, void *va)
 	// Fill this function in
 }
 
+//
+// Flush the TLBs of the other CPUs running user code with 'pgdir',
+// which threads sharing it can be doing, and wait until they have.
+// A CPU in the kernel needs no interrupt: env_run reloads cr3 before
+// it runs user code again.  Since the kernel lock is held, any CPU
+// that is in user mode takes the T_TLBFLUSH interrupt, and the trap
+// entry answers it (see tlb_shootdown_ack) before waiting for the lock.
+//
+static void
+tlb_shootdown(pde_t *pgdir)
+{
+	struct CpuInfo *c;
+
+	for (c = cpus; c < cpus + ncpu; c++) {
+		if (c == thiscpu || !c->cpu_env || c->cpu_env->env_pgdir != pgdir)
+			continue;
+		xchg(&c->cpu_tlb_flush, 1);
+		if (c->cpu_in_user)
+			lapic_ipi_cpu(c->cpu_id, T_TLBFLUSH);
+	}
+	for (c = cpus; c < cpus + ncpu; c++)
+		while (c != thiscpu && c->cpu_in_user && c->cpu_tlb_flush)
+			asm volatile("pause");
+}
+
+//
+// Called on entry to the kernel from user mode, before taking the
+// kernel lock: note that we have left user mode, and flush our TLB
+// if a shootdown is waiting for it.
+//
+void
+tlb_shootdown_ack(void)
+{
+	xchg(&thiscpu->cpu_in_user, 0);
+	if (thiscpu->cpu_tlb_flush) {
+		lcr3(rcr3());
+		thiscpu->cpu_tlb_flush = 0;
+	}
+}
+
 //
 // Invalidate a TLB entry, but only if the page tables being
 // edited are the ones currently in use by the processor.
+// If threads share the page tables, other CPUs may be using them too.
 //
 void
 tlb_invalidate(pde_t *pgdir, void *va)
@@ -566,6 +633,85 @@ tlb_invalidate(pde_t *pgdir, void *va)
 	// Flush the entry only if we're modifying the current address space.
 	if (!curenv || curenv->env_pgdir == pgdir)
 		invlpg(va);
+	if (pgdir != kern_pgdir && pa2page(PADDR(pgdir))->pp_ref > 1)
+		tlb_shootdown(pgdir);
+}
+
+//
+// Flush every TLB entry for 'pgdir' on each CPU that may be using it.
+//
+static void
+tlb_flush_pgdir(pde_t *pgdir)
+{
+	if (curenv && curenv->env_pgdir == pgdir)
+		lcr3(rcr3());
+	if (pa2page(PADDR(pgdir))->pp_ref > 1)
+		tlb_shootdown(pgdir);
+}
+
+//
+// Share the user page tables of 'src' with 'dst', whose user address
+// space must be empty, for a lazy fork.  Both page directories then
+// map each table read-only, with PTE_COW set in the PDE, and the
+// table's pp_ref counts the directories using it.  The first write
+// to a table's 4MB region copies it (see pt_unshare), so sharing
+// costs one step per page table, not per page.  The table for UTEMP,
+// which holds the scratch pages and the syscall ring, is not shared.
+//
+void
+pt_share(pde_t *dst, pde_t *src)
+{
+	uint32_t pdx;
+
+	for (pdx = 0; pdx < PDX(UTOP); pdx++) {
+		if (!(src[pdx] & PTE_P) || pdx == PDX(UTEMP))
+			continue;
+		src[pdx] = (src[pdx] & ~PTE_W) | PTE_COW;
+		dst[pdx] = src[pdx];
+		pa2page(PTE_ADDR(src[pdx]))->pp_ref++;
+	}
+	tlb_flush_pgdir(src);
+}
+
+//
+// If the page table for 'va' in 'pgdir' is shared by a lazy fork,
+// give 'pgdir' its own copy.  Writable pages other than PTE_SHARE
+// ones become copy-on-write in both copies, since neither may now
+// write them in place.  If 'pgdir' holds the last reference, the
+// table only becomes writable again.
+//
+// Returns 1 if the table was shared, 0 if not, or -E_NO_MEM.
+//
+int
+pt_unshare(pde_t *pgdir, uintptr_t va)
+{
+	pde_t *pde = &pgdir[PDX(va)];
+	struct PageInfo *pt, *npt;
+	pte_t *opt, *npt_kva;
+	int i;
+
+	if ((*pde & (PTE_P | PTE_COW)) != (PTE_P | PTE_COW))
+		return 0;
+	pt = pa2page(PTE_ADDR(*pde));
+	if (pt->pp_ref > 1) {
+		if (!(npt = page_alloc(0)))
+			return -E_NO_MEM;
+		opt = page2kva(pt);
+		npt_kva = page2kva(npt);
+		for (i = 0; i < NPTENTRIES; i++) {
+			if ((opt[i] & (PTE_P | PTE_W | PTE_SHARE)) == (PTE_P | PTE_W))
+				opt[i] = (opt[i] & ~PTE_W) | PTE_COW;
+			npt_kva[i] = opt[i];
+			if (opt[i] & PTE_P)
+				pa2page(PTE_ADDR(opt[i]))->pp_ref++;
+		}
+		npt->pp_ref++;
+		pt->pp_ref--;
+		*pde = page2pa(npt) | PGOFF(*pde);
+	}
+	*pde = (*pde & ~PTE_COW) | PTE_W;
+	tlb_flush_pgdir(pgdir);
+	return 1;
 }
 
 //
@@ -657,6 +803,36 @@ user_mem_check(struct Env *env, const void *va, size_t len, int perm)
 	return 0;
 }
 
+//
+// Resolve, as faults would, the copy-on-write and demand-paged pages
+// of [va, va+len) that 'env' cannot yet access with 'perm | PTE_P', so
+// that a following user_mem_check or user_mem_assert passes and the
+// kernel can touch the range.  System calls call this on entry, before
+// doing any work: if a page must come from a pager and env is making
+// a system call, the call is rewound to run again from the start once
+// the page arrives, and this does not return.  Pages that cannot be
+// resolved are left for the check to report.
+//
+void
+user_mem_fault_in(struct Env *env, const void *va, size_t len, int perm)
+{
+	uintptr_t i = ROUNDDOWN((uintptr_t) va, PGSIZE);
+	uintptr_t end = ROUNDUP((uintptr_t) va + len, PGSIZE);
+	int r;
+
+	for (; i < end && i < ULIM; i += PGSIZE) {
+		if (user_mem_check(env, (void *) i, 1, perm | PTE_P) == 0)
+			continue;
+		r = pager_fault(env, i, perm & PTE_W,
+				env == curenv && env->env_tf.tf_trapno == T_SYSCALL);
+		if (r == 1) {
+			env->env_tf.tf_eip -= 2;	// size of int $T_SYSCALL
+			env->env_status = ENV_NOT_RUNNABLE;
+			sched_yield();
+		}
+	}
+}
+
 //
 // Checks that environment 'env' is allowed to access the range
 // of memory [va, va+len) with permissions 'perm | PTE_U | PTE_P'.
@@ -0,0 +1,198 @@
+// Sampling profiler.
+//
+// While the profiler runs, every LAPIC timer interrupt records the
+// interrupted EIP, the return address in the interrupted frame, the CPU
+// and the env in a ring of samples.  Samples are read out by user space
+// with sys_prof_read, or summarized by function with 'profile report'
+// in the kernel monitor.  The env that started the profiler owns it:
+// only the owner may stop it or read its samples.
+
+#include <inc/x86.h>
+#include <inc/string.h>
+#include <inc/memlayout.h>
+
+#include <kern/prof.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+#include <kern/pmap.h>
+#include <kern/kdebug.h>
+
+// Samples kept.  Must be a power of two.
+#define NPROF		4096
+
+bool prof_running;
+envid_t prof_owner;			// 0 if started from the monitor
+static struct ProfSample prof_samples[NPROF];
+static uint32_t prof_head;		// Next sample to write
+static uint32_t prof_tail;		// Next sample prof_read returns
+
+void
+prof_start(envid_t owner)
+{
+	prof_owner = owner;
+	prof_head = prof_tail = 0;
+	prof_running = 1;
+}
+
+void
+prof_stop(void)
+{
+	prof_running = 0;
+}
+
+// Can the two words at user address 'va' be read without faulting?
+// Only looks at the page tables, so a sample never maps anything.
+static bool
+prof_user_readable(struct Env *e, uintptr_t va)
+{
+	uintptr_t end = va + 2 * sizeof(uintptr_t) - 1;
+	pte_t *pte;
+
+	if (end < va || end >= ULIM)
+		return 0;
+	for (va = ROUNDDOWN(va, PGSIZE); va <= end; va += PGSIZE) {
+		if (!(e->env_pgdir[PDX(va)] & PTE_U)
+		    || !page_lookup(e->env_pgdir, (void *) va, &pte)
+		    || (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+			return 0;
+	}
+	return 1;
+}
+
+// Record a sample for the timer interrupt described by 'tf'.
+// Called with the big kernel lock held and, for interrupts from user
+// mode, with the interrupted env's page directory still loaded.
+// A kernel frame pointer is followed only if it points into this
+// CPU's kernel stack.
+void
+prof_tick(struct Trapframe *tf)
+{
+	struct ProfSample *ps = &prof_samples[prof_head++ % NPROF];
+	uintptr_t *frame = (uintptr_t *) tf->tf_regs.reg_ebp;
+	uintptr_t kstacktop = KSTACKTOP - cpunum() * (KSTKSIZE + KSTKGAP);
+
+	ps->ps_eip = tf->tf_eip;
+	ps->ps_caller = 0;
+	ps->ps_envid = 0;
+	ps->ps_cpu = cpunum();
+	if ((tf->tf_cs & 3) == 3) {
+		ps->ps_envid = curenv->env_id;
+		if (prof_user_readable(curenv, (uintptr_t) frame))
+			ps->ps_caller = frame[1];
+	} else if ((uintptr_t) frame >= kstacktop - KSTKSIZE
+		   && (uintptr_t) (frame + 2) <= kstacktop)
+		ps->ps_caller = frame[1];
+}
+
+// Copy up to 'n' unread samples into 'buf', which must already have
+// been checked.  Samples overwritten before they were read are lost.
+// Returns the number copied.
+int
+prof_read(struct ProfSample *buf, uint32_t n)
+{
+	uint32_t done = 0;
+
+	if (prof_head - prof_tail > NPROF)
+		prof_tail = prof_head - NPROF;
+	while (prof_tail != prof_head && done < n)
+		buf[done++] = prof_samples[prof_tail++ % NPROF];
+	return done;
+}
+
+
+/***** Flat profile for the kernel monitor *****/
+
+// Distinct functions tracked by prof_report
+#define NPROFFN		64
+
+static struct ProfFn {
+	int32_t pf_envid;		// 0 for kernel functions
+	uintptr_t pf_addr;		// Start of the function
+	char pf_name[32];
+	uint32_t pf_self;		// Samples in the function itself
+	uint32_t pf_caller;		// Samples whose return address is in it
+} prof_fns[NPROFFN];
+static int prof_nfns;
+
+// Find or add the function containing 'eip' in 'envid'.
+// User addresses can only be symbolized while their env still exists,
+// and only if it was built with stabs (see USER_STABS in user/Makefrag).
+static struct ProfFn *
+prof_fn(int32_t envid, uintptr_t eip)
+{
+	struct Eipdebuginfo info;
+	struct Env *e = NULL;
+	uint32_t cr3 = rcr3();
+	int i, len;
+
+	if (eip >= ULIM)
+		envid = 0;
+	else if (!envid || envid2env(envid, &e, 0) < 0)
+		e = NULL;
+
+	// On failure debuginfo leaves the name "<unknown>" and the
+	// function address set to eip.
+	if (e)
+		lcr3(PADDR(e->env_pgdir));
+	debuginfo_env_eip(e, eip, &info);
+	for (i = 0; i < prof_nfns; i++)
+		if (prof_fns[i].pf_envid == envid && prof_fns[i].pf_addr == info.eip_fn_addr)
+			break;
+	if (i == prof_nfns && prof_nfns < NPROFFN) {
+		prof_fns[i].pf_envid = envid;
+		prof_fns[i].pf_addr = info.eip_fn_addr;
+		len = MIN(info.eip_fn_namelen, (int) sizeof(prof_fns[i].pf_name) - 1);
+		memmove(prof_fns[i].pf_name, info.eip_fn_name, len);
+		prof_fns[i].pf_name[len] = 0;
+		prof_fns[i].pf_self = prof_fns[i].pf_caller = 0;
+		prof_nfns++;
+	}
+	if (e)
+		lcr3(cr3);
+	return i < prof_nfns ? &prof_fns[i] : NULL;
+}
+
+// Print the samples gathered since prof_start, by function, busiest
+// function first.
+void
+prof_report(void)
+{
+	struct ProfSample *ps;
+	struct ProfFn *fn, tmp;
+	uint32_t i, n, lost = 0;
+	int j, k;
+
+	n = MIN(prof_head, NPROF);
+	prof_nfns = 0;
+	for (i = prof_head - n; i != prof_head; i++) {
+		ps = &prof_samples[i % NPROF];
+		if ((fn = prof_fn(ps->ps_envid, ps->ps_eip)) == NULL) {
+			lost++;
+			continue;
+		}
+		fn->pf_self++;
+		if (ps->ps_caller && (fn = prof_fn(ps->ps_envid, ps->ps_caller)))
+			fn->pf_caller++;
+	}
+
+	for (j = 1; j < prof_nfns; j++)
+		for (k = j; k > 0 && prof_fns[k].pf_self > prof_fns[k - 1].pf_self; k--) {
+			tmp = prof_fns[k];
+			prof_fns[k] = prof_fns[k - 1];
+			prof_fns[k - 1] = tmp;
+		}
+
+	cprintf("%d samples%s\n", n, prof_running ? " (still running)" : "");
+	cprintf("   self  caller  env       function\n");
+	for (j = 0; j < prof_nfns; j++) {
+		fn = &prof_fns[j];
+		cprintf("%7d %7d  ", fn->pf_self, fn->pf_caller);
+		if (fn->pf_envid)
+			cprintf("%08x  ", fn->pf_envid);
+		else
+			cprintf("kernel    ");
+		cprintf("%s (%08x)\n", fn->pf_name, fn->pf_addr);
+	}
+	if (lost)
+		cprintf("%d samples in functions beyond the first %d\n", lost, NPROFFN);
+}
@@ -0,0 +1,20 @@
+#ifndef JOS_KERN_PROF_H
+#define JOS_KERN_PROF_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+#include <inc/prof.h>
+#include <inc/trap.h>
+
+extern bool prof_running;
+extern envid_t prof_owner;
+
+void prof_start(envid_t owner);
+void prof_stop(void);
+void prof_tick(struct Trapframe *tf);
+int prof_read(struct ProfSample *buf, uint32_t n);
+void prof_report(void);
+
+#endif /* !JOS_KERN_PROF_H */
@@ -4,6 +4,7 @@
 #include <kern/env.h>
 #include <kern/pmap.h>
 #include <kern/monitor.h>
+#include <kern/futex.h>
 
 void sched_halt(void);
 
@@ -66,13 +67,14 @@ sched_halt(void)
 		     envs[i].env_status == ENV_DYING))
 			break;
 	}
-	if (i == NENV) {
+	if (i == NENV && !futex_timed_waiters()) {
 		cprintf("No runnable environments in the system!\n");
 		while (1)
 			monitor(NULL);
 	}
 
 	// Mark that no environment is running on this CPU
+	env_fpu_save();
 	curenv = NULL;
 	lcr3(PADDR(kern_pgdir));
 
@@ -4,6 +4,7 @@
 #include <inc/error.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/sysring.h>
 
 #include <kern/env.h>
 #include <kern/pmap.h>
@@ -11,6 +12,10 @@
 #include <kern/syscall.h>
 #include <kern/console.h>
 #include <kern/sched.h>
+#include <kern/trace.h>
+#include <kern/prof.h>
+#include <kern/futex.h>
+#include <kern/pager.h>
 
 // Print a string to the system console.
 // The string is exactly 'len' characters long.
@@ -22,6 +27,7 @@ sys_cputs(const char *s, size_t len)
 	// Destroy the environment if not.
 
 	// LAB 3: Your code here.
+	user_mem_fault_in(curenv, s, len, PTE_U);
 	user_mem_assert(curenv, s, len, 0);
 	// Print the string supplied by the user.
 	cprintf("%.*s", len, s);
@@ -88,6 +94,12 @@ sys_exofork(void)
 	env->env_status = ENV_NOT_RUNNABLE;
 	env->env_tf = curenv->env_tf;
 	env->env_tf.tf_regs.reg_eax = 0;
+	env->env_trace = curenv->env_trace;
+	// The child inherits our FPU state; flush it out of the
+	// registers first if we have used the FPU this time slice.
+	if (thiscpu->cpu_fpu_env == curenv && !(rcr0() & CR0_TS))
+		fxsave(curenv->env_fxsave);
+	memcpy(env->env_fxsave, curenv->env_fxsave, sizeof(env->env_fxsave));
 	return env->env_id;
 //	panic("sys_exofork not implemented");
 }
@@ -117,6 +129,10 @@ sys_env_set_status(envid_t envid, int status)
 	if(status != ENV_RUNNABLE && status != ENV_NOT_RUNNABLE){
 		return -E_INVAL;
 	}
+	// An env blocked in IPC leaves its queue, so it is not found
+	// there once it runs again.
+	if (e != curenv)
+		ipc_cancel(e, -E_IPC_NOT_RECV);
 	e->env_status = status;
 	return 0;
 //	panic("sys_env_set_status not implemented");
@@ -140,7 +156,8 @@ sys_env_set_trapframe(envid_t envid, struct Trapframe *tf)
 	if(ret < 0){
 		return ret;
 	}
-	user_mem_assert(e, tf, sizeof(struct Trapframe), PTE_U | PTE_P);
+	user_mem_fault_in(curenv, tf, sizeof(struct Trapframe), PTE_U);
+	user_mem_assert(curenv, tf, sizeof(struct Trapframe), PTE_U | PTE_P);
 	e->env_tf = *tf;
   	e->env_tf.tf_eflags |= FL_IF;
 	e->env_tf.tf_eflags &= ~FL_IOPL_MASK;
@@ -170,6 +187,143 @@ sys_env_set_pgfault_upcall(envid_t envid, void *func)
 //	panic("sys_env_set_pgfault_upcall not implemented");
 }
 
+// Create a thread: a new environment that shares the current one's
+// address space, page fault upcall and demand-paged regions, and
+// starts running at 'entry' with stack pointer 'stack'.  Its page
+// fault upcall runs on the exception stack page at 'xstack', and its
+// env_tls slot holds 'arg'.  When it exits, the kernel zeroes the
+// word at 'exitword' and wakes futex waiters on it, so other threads
+// can wait for it without touching its stack after it is gone.
+// The thread has no syscall ring until it registers its own.
+// The address space is freed when the last env using it exits.
+//
+// Returns envid of new thread, < 0 on error.  Errors are:
+//	-E_INVAL if entry, stack or xstack is at or above UTOP, xstack
+//		is not page-aligned, or exitword is not an aligned word
+//		below UTOP.
+//	-E_NO_FREE_ENV if no free environment is available.
+static envid_t
+sys_thread_create(void *entry, void *stack, void *arg, void *xstack, uint32_t *exitword)
+{
+	struct Env *e;
+	int ret;
+
+	if ((uintptr_t) entry >= UTOP || (uintptr_t) stack > UTOP
+	    || (uintptr_t) xstack >= UTOP || PGOFF(xstack) != 0
+	    || (uintptr_t) exitword >= UTOP || (uintptr_t) exitword % 4 != 0)
+		return -E_INVAL;
+	if ((ret = env_alloc(&e, curenv->env_id)) < 0)
+		return ret;
+	env_share_vm(e, curenv);
+	e->env_tf.tf_eip = (uintptr_t) entry;
+	e->env_tf.tf_esp = (uintptr_t) stack;
+	e->env_tf.tf_eflags |= curenv->env_tf.tf_eflags & FL_IOPL_MASK;
+	e->env_type = curenv->env_type;
+	e->env_trace = curenv->env_trace;
+	e->env_pgfault_upcall = curenv->env_pgfault_upcall;
+	e->env_xstacktop = (uintptr_t) xstack + PGSIZE;
+	e->env_tls = (uint32_t) arg;
+	e->env_thread_exit = exitword;
+	memcpy(e->env_pager, curenv->env_pager, sizeof(e->env_pager));
+	return e->env_id;
+}
+
+// Create a child that borrows the caller's address space, as a thread
+// does, and suspend the caller until the child exits (see env_free).
+// The child resumes from this call with 0 in eax, on the caller's
+// stack and exception stack, and the caller then resumes with the
+// child's envid.  Since everything the child writes lands in the
+// caller's memory, including its file descriptor table, the child
+// should do little more than spawn a program and exit (exit in
+// lib/exit.c skips close_all for a vfork child).  The child shares the
+// caller's syscall ring, which is safe as only one of them runs.
+//
+// Returns envid of the child, < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if no free environment is available.
+static envid_t
+sys_vfork(void)
+{
+	struct Env *e;
+	int ret;
+
+	if ((ret = env_alloc(&e, curenv->env_id)) < 0)
+		return ret;
+	env_share_vm(e, curenv);
+	e->env_tf = curenv->env_tf;
+	e->env_tf.tf_regs.reg_eax = 0;
+	e->env_type = curenv->env_type;
+	e->env_trace = curenv->env_trace;
+	e->env_pgfault_upcall = curenv->env_pgfault_upcall;
+	e->env_xstacktop = curenv->env_xstacktop;
+	e->env_tls = curenv->env_tls;
+	memcpy(e->env_pager, curenv->env_pager, sizeof(e->env_pager));
+	if (thiscpu->cpu_fpu_env == curenv && !(rcr0() & CR0_TS))
+		fxsave(curenv->env_fxsave);
+	memcpy(e->env_fxsave, curenv->env_fxsave, sizeof(e->env_fxsave));
+	e->env_vfork_parent = curenv->env_id;
+	// The child submits through our syscall ring while we wait.
+	if ((e->env_ring = curenv->env_ring))
+		e->env_ring->pp_ref++;
+
+	curenv->env_tf.tf_regs.reg_eax = e->env_id;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Share the caller's page tables with 'envid', a child just made by
+// sys_exofork, for a lazy fork (see pt_share).  The child then sees
+// all of the caller's memory below UTOP except the UTEMP region, and
+// whichever of the two first writes in a 4MB region copies its page
+// table.  The caller must still give the child an exception stack.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if envid shares the caller's address space, is
+//		runnable, or already has pages below UTOP.
+static int
+sys_env_share_pts(envid_t envid)
+{
+	struct Env *e;
+	uint32_t pdx;
+	int ret;
+
+	if ((ret = envid2env(envid, &e, 1)) < 0)
+		return ret;
+	if (e->env_pgdir == curenv->env_pgdir || e->env_status != ENV_NOT_RUNNABLE)
+		return -E_INVAL;
+	for (pdx = 0; pdx < PDX(UTOP); pdx++)
+		if (e->env_pgdir[pdx] & PTE_P)
+			return -E_INVAL;
+	pt_share(e->env_pgdir, curenv->env_pgdir);
+	return 0;
+}
+
+// Have the pages of the region 'pr' in envid's address space mapped
+// when envid first touches them, rather than now: zero-filled, or
+// supplied by the pager env the region names (see struct PagerRegion
+// and kern/pager.c).  Pages already mapped in the region are used as
+// they are.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if the region is misaligned, reaches UTOP, overlaps
+//		another of envid's regions, or has a bad pr_perm.
+//	-E_NO_MEM if envid already has NPAGER regions.
+static int
+sys_env_set_pager(envid_t envid, const struct PagerRegion *pr)
+{
+	struct Env *e;
+	int ret;
+
+	if ((ret = envid2env(envid, &e, 1)) < 0)
+		return ret;
+	user_mem_fault_in(curenv, pr, sizeof(*pr), PTE_U);
+	user_mem_assert(curenv, pr, sizeof(*pr), PTE_U);
+	return pager_add(e, pr);
+}
+
 // Allocate a page of memory and map it at 'va' with permission
 // 'perm' in the address space of 'envid'.
 // The page's contents are set to 0.
@@ -269,6 +423,11 @@ sys_page_map(envid_t srcenvid, void *srcva,
 	if(!(perm & PTE_P) || !(perm & PTE_U) || (perm & (~PTE_SYSCALL))){
 		return -E_INVAL;
 	}
+	// A writable page in a page table shared by a lazy fork is
+	// really copy-on-write; unsharing the table shows which it is.
+	if((perm & PTE_W) && (ret = pt_unshare(src->env_pgdir, (uintptr_t)srcva)) < 0){
+		return ret;
+	}
 	struct PageInfo *pg = page_lookup(src->env_pgdir, srcva, &pte);
 	if(pg == NULL){
 		return -E_INVAL;
@@ -305,11 +464,482 @@ sys_page_unmap(envid_t envid, void *va)
 	if((uintptr_t)va >= UTOP || (uintptr_t)va % PGSIZE != 0){
 		return -E_INVAL;
 	}
+	if((ret = pt_unshare(e->env_pgdir, (uintptr_t)va)) < 0){
+		return ret;
+	}
 	page_remove(e->env_pgdir, va);
 	return 0;
 //	panic("sys_page_unmap not implemented");
 }
 
+// Map now the pages in [va, va + len) of envid's address space that
+// faults there would have the kernel map without an upcall (see
+// pager_fault): copy-on-write pages, pages in page tables shared by a
+// lazy fork, and zero-filled pages of demand-paged regions.  With
+// POPULATE_WRITE in 'flags' they are resolved as writes would be.
+// This takes one system call instead of a fault per page.  Pages a
+// pager must supply, and pages no fault could map, are left alone.
+//
+// Returns the number of pages in the range now mapped (writable, with
+// POPULATE_WRITE), < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if the range reaches above UTOP, or flags is invalid.
+//	-E_NO_MEM if there's no memory for a page or page table.
+static int
+sys_page_populate(envid_t envid, void *va, size_t len, int flags)
+{
+	struct Env *e;
+	int ret;
+
+	if ((ret = envid2env(envid, &e, 1)) < 0)
+		return ret;
+	if ((uintptr_t) va >= UTOP || len > UTOP - (uintptr_t) va
+	    || (flags & ~POPULATE_WRITE))
+		return -E_INVAL;
+	return pager_populate(e, (uintptr_t) va, (uintptr_t) va + len,
+			      flags & POPULATE_WRITE);
+}
+
+// Tell the kernel how envid will use [va, va + len):
+//	MADV_NORMAL: no special treatment, ending any MADV_SEQUENTIAL
+//		range it overlaps.
+//	MADV_SEQUENTIAL: each fault in the range also resolves the
+//		pages after it (see pager_fault).  An env has one such
+//		range; advising another replaces it.
+//	MADV_WILLNEED: map now, for reading, what sys_page_populate can.
+//	MADV_DONTNEED: unmap the range's pages.  In a demand-paged
+//		region, they read back as zeros or from the pager.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+//	-E_INVAL if va is not page-aligned, the range reaches above
+//		UTOP, or advice is invalid.
+//	-E_NO_MEM if there's no memory for a page or page table.
+static int
+sys_madvise(envid_t envid, void *va, size_t len, int advice)
+{
+	struct Env *e;
+	uintptr_t a = (uintptr_t) va, end;
+	int ret;
+
+	if ((ret = envid2env(envid, &e, 1)) < 0)
+		return ret;
+	if (a % PGSIZE || a >= UTOP || len > UTOP - a)
+		return -E_INVAL;
+	end = ROUNDUP(a + len, PGSIZE);
+
+	switch (advice) {
+	case MADV_NORMAL:
+		if (e->env_seq_va < end && a < e->env_seq_end)
+			e->env_seq_va = e->env_seq_end = 0;
+		return 0;
+	case MADV_SEQUENTIAL:
+		e->env_seq_va = a;
+		e->env_seq_end = end;
+		return 0;
+	case MADV_WILLNEED:
+		ret = pager_populate(e, a, end, 0);
+		return ret < 0 ? ret : 0;
+	case MADV_DONTNEED:
+		while (a < end) {
+			// skip whole page tables that are not there
+			if (!(e->env_pgdir[PDX(a)] & PTE_P)) {
+				a = ROUNDDOWN(a, PTSIZE) + PTSIZE;
+				continue;
+			}
+			if ((ret = pt_unshare(e->env_pgdir, a)) < 0)
+				return ret;
+			page_remove(e->env_pgdir, (void *) a);
+			a += PGSIZE;
+		}
+		return 0;
+	default:
+		return -E_INVAL;
+	}
+}
+
+// Check that 'src' may send the page at 'srcva' with 'perm'.
+// Returns 0 or -E_INVAL, as described for sys_ipc_try_send, or
+// -E_NO_MEM if a page table shared by a lazy fork cannot be copied.
+static int
+ipc_check_page(struct Env *src, void *srcva, unsigned perm)
+{
+	pte_t *pte;
+
+	if ((uintptr_t) srcva % PGSIZE != 0)
+		return -E_INVAL;
+	if ((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P) || (perm & ~PTE_SYSCALL))
+		return -E_INVAL;
+	if ((perm & PTE_W) && pt_unshare(src->env_pgdir, (uintptr_t) srcva) < 0)
+		return -E_NO_MEM;
+	if (!page_lookup(src->env_pgdir, srcva, &pte))
+		return -E_INVAL;
+	if ((perm & PTE_W) && !(*pte & PTE_W))
+		return -E_INVAL;
+	return 0;
+}
+
+// Describe the page at 'srcva' as a one-range vector in 'v', and
+// store IPC_MOVE in *flags if 'perm' includes IPC_PERM_MOVE, else 0.
+// Returns the number of ranges: 1 if srcva < UTOP, otherwise 0.
+static int
+ipc_page_vec(struct IpcVec *v, void *srcva, unsigned perm, int *flags)
+{
+	*flags = (perm & IPC_PERM_MOVE) ? IPC_MOVE : 0;
+	v->iv_va = srcva;
+	v->iv_npages = 1;
+	v->iv_perm = perm & ~IPC_PERM_MOVE;
+	return (uintptr_t) srcva < UTOP;
+}
+
+// Check that 'src' may send every page of the 'nvec' ranges in 'vec',
+// and store their total page count in *npages.
+// Returns 0, or an error from ipc_check_page.
+static int
+ipc_check_vec(struct Env *src, const struct IpcVec *vec, int nvec, uint32_t *npages)
+{
+	uintptr_t va;
+	uint32_t j;
+	int i, ret;
+
+	*npages = 0;
+	for (i = 0; i < nvec; i++) {
+		va = (uintptr_t) vec[i].iv_va;
+		if (va >= UTOP || vec[i].iv_npages > (UTOP - va) / PGSIZE)
+			return -E_INVAL;
+		for (j = 0; j < vec[i].iv_npages; j++)
+			if ((ret = ipc_check_page(src, (void *) (va + j * PGSIZE),
+						  vec[i].iv_perm)) < 0)
+				return ret;
+		*npages += vec[i].iv_npages;
+	}
+	return 0;
+}
+
+// Move the pages of 'vec' from 'src' into the window dst declared,
+// all or nothing.  Each page's PTE is handed over as it stands, so
+// page reference counts are untouched.  The ranges must not overlap.
+static int
+ipc_move_vec(struct Env *src, struct Env *dst, const struct IpcVec *vec, int nvec,
+	     uint32_t npages)
+{
+	uintptr_t va, dstva = (uintptr_t) dst->env_ipc_dstva;
+	pte_t *spte, *dpte;
+	uint32_t j, n;
+	int i, k;
+
+	for (i = 0; i < nvec; i++)
+		for (k = 0; k < i; k++)
+			if ((uintptr_t) vec[i].iv_va < (uintptr_t) vec[k].iv_va + vec[k].iv_npages * PGSIZE
+			    && (uintptr_t) vec[k].iv_va < (uintptr_t) vec[i].iv_va + vec[i].iv_npages * PGSIZE)
+				return -E_INVAL;
+	// Allocate the page tables first, and unshare the sender's, so
+	// nothing can fail once pages start to move.
+	for (n = 0; n < npages; n++)
+		if (!pgdir_walk(dst->env_pgdir, (void *) (dstva + n * PGSIZE), 1))
+			return -E_NO_MEM;
+	for (i = 0; i < nvec; i++)
+		for (j = 0; j < vec[i].iv_npages; j++)
+			if (pt_unshare(src->env_pgdir, (uintptr_t) vec[i].iv_va + j * PGSIZE) < 0)
+				return -E_NO_MEM;
+
+	n = 0;
+	for (i = 0; i < nvec; i++)
+		for (j = 0; j < vec[i].iv_npages; j++, n++) {
+			va = (uintptr_t) vec[i].iv_va + j * PGSIZE;
+			spte = pgdir_walk(src->env_pgdir, (void *) va, 0);
+			dpte = pgdir_walk(dst->env_pgdir, (void *) (dstva + n * PGSIZE), 0);
+			if (*dpte & PTE_P)
+				page_remove(dst->env_pgdir, (void *) (dstva + n * PGSIZE));
+			*dpte = PTE_ADDR(*spte) | vec[i].iv_perm | PTE_P;
+			*spte = 0;
+			tlb_invalidate(src->env_pgdir, (void *) va);
+			if (n == 0)
+				dst->env_ipc_perm = vec[i].iv_perm;
+		}
+	dst->env_ipc_npages = npages;
+	return 0;
+}
+
+// Map the pages of 'vec' from 'src' into the window dst declared,
+// all or nothing.  With IPC_MOVE in 'flags', the pages are moved
+// instead: they are unmapped from 'src' as they are mapped in 'dst'.
+static int
+ipc_map_vec(struct Env *src, struct Env *dst, const struct IpcVec *vec, int nvec, int flags)
+{
+	uintptr_t va, dstva = (uintptr_t) dst->env_ipc_dstva;
+	uint32_t j, n, npages;
+	int i, ret;
+
+	if ((ret = ipc_check_vec(src, vec, nvec, &npages)) < 0)
+		return ret;
+	if (npages > dst->env_ipc_dstnpages)
+		return -E_INVAL;
+	if (flags & IPC_MOVE)
+		return ipc_move_vec(src, dst, vec, nvec, npages);
+
+	// Allocate (and unshare) the window's page tables first, so no
+	// page_insert can fail after an earlier one replaced a mapping.
+	for (n = 0; n < npages; n++)
+		if (!pgdir_walk(dst->env_pgdir, (void *) (dstva + n * PGSIZE), 1))
+			return -E_NO_MEM;
+
+	n = 0;
+	for (i = 0; i < nvec; i++)
+		for (j = 0; j < vec[i].iv_npages; j++, n++) {
+			va = (uintptr_t) vec[i].iv_va + j * PGSIZE;
+			ret = page_insert(dst->env_pgdir,
+					  page_lookup(src->env_pgdir, (void *) va, NULL),
+					  (void *) (dstva + n * PGSIZE), vec[i].iv_perm);
+			assert(ret == 0);
+			if (n == 0)
+				dst->env_ipc_perm = vec[i].iv_perm;
+		}
+	dst->env_ipc_npages = npages;
+	return 0;
+}
+
+// Is 'dst' blocked receiving, and willing to take a message with
+// value 'value' from 'src'?
+static bool
+ipc_accepts(struct Env *dst, struct Env *src, uint32_t value)
+{
+	return dst->env_ipc_recving
+		&& (!dst->env_ipc_recvfrom || dst->env_ipc_recvfrom == src->env_id)
+		&& (value & dst->env_ipc_recvmask) == dst->env_ipc_recvtag;
+}
+
+// Start 'e' receiving.  If it receives only from env_ipc_recvfrom, it
+// joins that env's queue, so that ipc_env_free can wake it.
+static void
+ipc_recv_start(struct Env *e)
+{
+	struct Env *from;
+
+	e->env_ipc_recving = 1;
+	if (e->env_ipc_recvfrom) {
+		from = &envs[ENVX(e->env_ipc_recvfrom)];
+		e->env_ipc_fromnext = from->env_ipc_fromq;
+		from->env_ipc_fromq = e;
+	}
+}
+
+// Stop 'e' receiving, taking it off the queue ipc_recv_start put it on.
+static void
+ipc_recv_stop(struct Env *e)
+{
+	struct Env **pe;
+
+	if (e->env_ipc_recving && e->env_ipc_recvfrom) {
+		pe = &envs[ENVX(e->env_ipc_recvfrom)].env_ipc_fromq;
+		for (; *pe && *pe != e; pe = &(*pe)->env_ipc_fromnext)
+			;
+		if (*pe)
+			*pe = e->env_ipc_fromnext;
+	}
+	e->env_ipc_recving = 0;
+}
+
+// Deliver a message from 'src' to 'dst', which must be blocked in
+// sys_ipc_recv, and fill in dst's ipc fields.  The pages of 'vec'
+// are mapped only if dst declared a receive window.  If src sent
+// with T_IPCCALL, the message words come from its registers; if it
+// is sending a page-in request, from env_pager_words; otherwise the
+// only word is 'value'.
+// Does not wake dst.  Errors are as for sys_ipc_try_send and
+// sys_ipc_sendv.
+static int
+ipc_deliver(struct Env *src, struct Env *dst, uint32_t value,
+	    const struct IpcVec *vec, int nvec, int flags)
+{
+	struct PushRegs *regs = &src->env_tf.tf_regs;
+	uint32_t npages;
+	int perm, ret;
+
+	if (dst->env_pager_wait) {
+		// The reply to a page-in request.  The faulting code may
+		// be between a receive and its use of the ipc fields, so
+		// they are left as they were.
+		perm = dst->env_ipc_perm;
+		npages = dst->env_ipc_npages;
+		dst->env_ipc_npages = 0;
+		if (nvec > 0)
+			ipc_map_vec(src, dst, vec, nvec, flags);
+		dst->env_pager_failed = dst->env_ipc_npages == 0;
+		dst->env_ipc_perm = perm;
+		dst->env_ipc_npages = npages;
+		ipc_recv_stop(dst);
+		return 0;
+	}
+
+	dst->env_ipc_perm = 0;
+	dst->env_ipc_npages = 0;
+	if (nvec > 0 && dst->env_ipc_dstnpages > 0
+	    && (ret = ipc_map_vec(src, dst, vec, nvec, flags)) < 0)
+		return ret;
+	if (src->env_ipc_sendregs) {
+		dst->env_ipc_words[0] = regs->reg_eax;
+		dst->env_ipc_words[1] = regs->reg_ecx;
+		dst->env_ipc_words[2] = regs->reg_ebx;
+		dst->env_ipc_words[3] = regs->reg_edi;
+		dst->env_ipc_words[4] = regs->reg_esi;
+		dst->env_ipc_words[5] = regs->reg_ebp;
+	} else if (src->env_pager_wait) {
+		memmove(dst->env_ipc_words, src->env_pager_words,
+			sizeof(dst->env_ipc_words));
+	} else {
+		memset(dst->env_ipc_words, 0, sizeof(dst->env_ipc_words));
+		dst->env_ipc_words[0] = value;
+	}
+	ipc_recv_stop(dst);
+	dst->env_ipc_from = src->env_id;
+	dst->env_ipc_value = dst->env_ipc_words[0];
+	return 0;
+}
+
+// Wake 'e' from a blocking IPC system call, which returns 'ret'.
+// An env blocked on a page-in request instead retries the access
+// that faulted, which fails if there was an error.
+static void
+ipc_wake(struct Env *e, int ret)
+{
+	e->env_ipc_call = 0;
+	e->env_ipc_sendregs = 0;
+	ipc_recv_stop(e);
+	if (e->env_pager_wait) {
+		e->env_pager_wait = 0;
+		if (ret < 0)
+			e->env_pager_failed = 1;
+	} else
+		e->env_tf.tf_regs.reg_eax = ret;
+	if (e->env_status == ENV_NOT_RUNNABLE)
+		e->env_status = ENV_RUNNABLE;
+}
+
+// Remove 's' from the queue of envs blocked sending to 't'.
+static void
+ipc_unqueue(struct Env *t, struct Env *s)
+{
+	struct Env *p, *prev = NULL;
+
+	for (p = t->env_ipc_sendq; p && p != s; p = p->env_ipc_sendnext)
+		prev = p;
+	if (!p)
+		return;
+	if (prev)
+		prev->env_ipc_sendnext = s->env_ipc_sendnext;
+	else
+		t->env_ipc_sendq = s->env_ipc_sendnext;
+	if (t->env_ipc_sendq_tail == s)
+		t->env_ipc_sendq_tail = prev;
+	s->env_ipc_sendto = 0;
+}
+
+// Take 'e' out of any blocking IPC call, off the queue of the env it
+// was sending to and no longer receiving, and have the call return
+// 'ret'.  For when something other than IPC wakes e, or changes its
+// status, so that a later send or receive cannot find it still queued.
+void
+ipc_cancel(struct Env *e, int ret)
+{
+	if (!e->env_ipc_sendto && !e->env_ipc_recving && !e->env_pager_wait)
+		return;
+	if (e->env_ipc_sendto)
+		ipc_unqueue(&envs[ENVX(e->env_ipc_sendto)], e);
+	ipc_wake(e, ret);
+}
+
+// Send from curenv to 'e'.  If 'e' is waiting for us the message is
+// delivered at once and 'e' woken; otherwise curenv is queued on 'e'.
+// Returns 0 if delivered, 1 if queued (the caller must block),
+// or < 0 on error.
+static int
+ipc_send_or_queue(struct Env *e, uint32_t value, const struct IpcVec *vec,
+		  int nvec, int flags)
+{
+	int ret;
+
+	if (ipc_accepts(e, curenv, value)) {
+		if ((ret = ipc_deliver(curenv, e, value, vec, nvec, flags)) < 0)
+			return ret;
+		ipc_wake(e, 0);
+		return 0;
+	}
+	if (e->env_status == ENV_DYING)
+		return -E_BAD_ENV;
+
+	// Never be on two queues, or on one twice.
+	if (curenv->env_ipc_sendto)
+		ipc_unqueue(&envs[ENVX(curenv->env_ipc_sendto)], curenv);
+	curenv->env_ipc_sendto = e->env_id;
+	curenv->env_ipc_sendval = value;
+	memmove(curenv->env_ipc_sendvec, vec, nvec * sizeof(*vec));
+	curenv->env_ipc_sendnvec = nvec;
+	curenv->env_ipc_sendflags = flags;
+	curenv->env_ipc_sendnext = NULL;
+	if (e->env_ipc_sendq_tail)
+		e->env_ipc_sendq_tail->env_ipc_sendnext = curenv;
+	else
+		e->env_ipc_sendq = curenv;
+	e->env_ipc_sendq_tail = curenv;
+	return 1;
+}
+
+// Deliver to 'dst', which is receiving, from the first env queued on it
+// that dst accepts and whose message can be delivered.  A plain sender
+// is woken; a sender in sys_ipc_call moves on to waiting for its reply.
+// Senders whose message fails are woken with the error.
+// Returns true if a message was delivered.
+static bool
+ipc_recv_queued(struct Env *dst)
+{
+	struct Env *s, *next;
+	int ret;
+
+	for (s = dst->env_ipc_sendq; s; s = next) {
+		next = s->env_ipc_sendnext;
+		if (!ipc_accepts(dst, s, s->env_ipc_sendval))
+			continue;
+		ipc_unqueue(dst, s);
+		ret = ipc_deliver(s, dst, s->env_ipc_sendval, s->env_ipc_sendvec,
+				  s->env_ipc_sendnvec, s->env_ipc_sendflags);
+		if (ret == 0 && s->env_ipc_call) {
+			s->env_ipc_call = 0;
+			s->env_ipc_sendregs = 0;
+			ipc_recv_start(s);
+		} else
+			ipc_wake(s, ret);
+		if (ret == 0)
+			return 1;
+	}
+	return 0;
+}
+
+// The body of sys_ipc_send and sys_ipc_sendv, once 'vec' is in
+// kernel memory.
+static int
+ipc_sendv(envid_t envid, uint32_t value, const struct IpcVec *vec, int nvec, int flags)
+{
+	struct Env *e;
+	uint32_t npages;
+	int ret;
+
+	if ((ret = envid2env(envid, &e, 0)) < 0)
+		return ret;
+	if (e == curenv)
+		return -E_INVAL;
+	if ((ret = ipc_check_vec(curenv, vec, nvec, &npages)) < 0)
+		return ret;
+	if ((ret = ipc_send_or_queue(e, value, vec, nvec, flags)) <= 0)
+		return ret;
+
+	// sys_ipc_recv or ipc_env_free sets our return value.
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
 // Try to send 'value' to the target env 'envid'.
 // If srcva < UTOP, then also send page currently mapped at 'srcva',
 // so that receiver gets a duplicate mapping of the same page.
@@ -338,7 +968,8 @@ sys_page_unmap(envid_t envid, void *va)
 //	-E_BAD_ENV if environment envid doesn't currently exist.
 //		(No need to check permissions.)
 //	-E_IPC_NOT_RECV if envid is not currently blocked in sys_ipc_recv,
-//		or another environment managed to send first.
+//		or another environment managed to send first, or envid
+//		is waiting for a reply from some other environment.
 //	-E_INVAL if srcva < UTOP but srcva is not page-aligned.
 //	-E_INVAL if srcva < UTOP and perm is inappropriate
 //		(see sys_page_alloc).
@@ -353,44 +984,140 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 {
 	// LAB 4: Your code here.
 	struct Env *e;
+	struct IpcVec v;
+	int flags, nvec = ipc_page_vec(&v, srcva, perm, &flags);
 	int ret = envid2env(envid, &e, 0);
 	if(ret < 0){
 		return ret;
 	}
-	if(!e->env_ipc_recving){
+	if(!ipc_accepts(e, curenv, value)){
 		return -E_IPC_NOT_RECV;
 	}
-	e->env_ipc_perm = 0;
-	if((uint32_t)srcva < UTOP && e->env_ipc_dstva != NULL){
-		if((uint32_t)srcva % PGSIZE != 0){
-			return -E_INVAL;
-		}
-		if((perm & (PTE_U | PTE_P)) != (PTE_U | PTE_P) || perm & (~PTE_SYSCALL)){
-			return -E_INVAL;
-		}
-		pte_t *pte;
-		struct PageInfo *pginfo = page_lookup(curenv->env_pgdir, srcva, &pte);
-		if(pginfo == NULL){
-			return -E_INVAL;
-		}
-		if((perm & PTE_W) && !(*pte & PTE_W)) {
-			return -E_INVAL;
-		}
-		ret = page_insert(e->env_pgdir, pginfo, e->env_ipc_dstva, perm);
-		if(ret < 0){
-			return ret;
-		}
-		e->env_ipc_perm = perm;
+	ret = ipc_deliver(curenv, e, value, &v, nvec, flags);
+	if(ret < 0){
+		return ret;
 	}
-	e->env_ipc_recving = 0;
-	e->env_ipc_from = curenv->env_id;
-	e->env_ipc_value = value;
-	e->env_tf.tf_regs.reg_eax = 0;
-	e->env_status = ENV_RUNNABLE;
+	ipc_wake(e, 0);
 	return 0;
 	//panic("sys_ipc_try_send not implemented");
 }
 
+// Like sys_ipc_try_send, but if 'envid' is not currently receiving,
+// block until it is rather than failing.  Blocked senders wait in a
+// FIFO queue on the target, and sys_ipc_recv delivers from the head
+// of that queue.  The page, if any, is checked before blocking and
+// looked up again at delivery time.
+//
+// Returns 0 on success, < 0 on error.  Errors are as for
+// sys_ipc_try_send, except that -E_IPC_NOT_RECV is never returned, and:
+//	-E_INVAL if envid is the current environment.
+//	-E_BAD_ENV if the target exits while we are waiting.
+static int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
+{
+	struct IpcVec v;
+	int flags, nvec = ipc_page_vec(&v, srcva, perm, &flags);
+
+	return ipc_sendv(envid, value, &v, nvec, flags);
+}
+
+// Send 'value' and the pages of the 'nvec' ranges in 'vec' to 'envid',
+// blocking as sys_ipc_send does.  The pages are mapped one after another
+// into the receive window the target declared with sys_ipc_recvv,
+// together with the message and all or nothing.  If the target declared
+// no window, only the value is sent.  With IPC_MOVE in 'flags', the pages
+// are unmapped from the sender once delivered.
+//
+// Returns 0 on success, < 0 on error.  Errors are as for sys_ipc_send
+// applied to every page, plus:
+//	-E_INVAL if nvec < 0 or nvec > IPC_MAXVEC, or flags is invalid.
+//	-E_INVAL if the pages do not fit in the target's window.
+static int
+sys_ipc_sendv(envid_t envid, uint32_t value, const struct IpcVec *vec, int nvec, int flags)
+{
+	struct IpcVec v[IPC_MAXVEC];
+
+	if (nvec < 0 || nvec > IPC_MAXVEC || (flags & ~IPC_MOVE))
+		return -E_INVAL;
+	user_mem_fault_in(curenv, vec, nvec * sizeof(*vec), PTE_U);
+	user_mem_assert(curenv, vec, nvec * sizeof(*vec), PTE_U);
+	memmove(v, vec, nvec * sizeof(*vec));
+	return ipc_sendv(envid, value, v, nvec, flags);
+}
+
+// Set 'e's receive window to 'npages' pages at 'dstva'.
+// Returns 0, or -E_INVAL if the window is misaligned or reaches UTOP.
+static int
+ipc_set_window(struct Env *e, void *dstva, uint32_t npages)
+{
+	if (npages > 0 && ((uintptr_t) dstva % PGSIZE != 0
+			   || (uintptr_t) dstva >= UTOP
+			   || npages > (UTOP - (uintptr_t) dstva) / PGSIZE))
+		return -E_INVAL;
+	e->env_ipc_dstva = dstva;
+	e->env_ipc_dstnpages = npages;
+	return 0;
+}
+
+// Receive as sys_ipc_recv does, but accept up to 'npages' pages,
+// mapped one after another starting at 'dstva'.  The number of pages
+// received is reported in env_ipc_npages.  With npages 0, no pages
+// are accepted.
+//
+// Returns 0 on success, -E_INVAL if the window is misaligned or reaches
+// past UTOP.
+static int
+sys_ipc_recvv(void *dstva, uint32_t npages)
+{
+	int ret;
+
+	if ((ret = ipc_set_window(curenv, dstva, npages)) < 0)
+		return ret;
+	curenv->env_ipc_recvfrom = 0;
+	curenv->env_ipc_recvtag = curenv->env_ipc_recvmask = 0;
+	ipc_recv_start(curenv);
+	if (ipc_recv_queued(curenv))
+		return 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Receive as sys_ipc_recvv does, but only a message from 'from', if it
+// is not 0, whose value has 'tag' in the bits set in 'mask'.  Senders
+// that do not match stay queued in the kernel, in order, for a later
+// receive, so a server can finish a conversation with one client, or
+// on one endpoint, before it takes other requests.  With from 0 and
+// mask 0, this is sys_ipc_recvv.
+//
+// Returns 0 on success, < 0 on error.  Errors are as for sys_ipc_recvv,
+// plus:
+//	-E_INVAL if tag has bits outside mask, so nothing could match,
+//		or 'from' is the current environment.
+//	-E_BAD_ENV if 'from' does not exist, or exits while we wait.
+static int
+sys_ipc_recvsel(envid_t from, uint32_t tag, uint32_t mask, void *dstva, uint32_t npages)
+{
+	struct Env *e;
+	int ret;
+
+	if (tag & ~mask)
+		return -E_INVAL;
+	if (from && (ret = envid2env(from, &e, 0)) < 0)
+		return ret;
+	if (from && e == curenv)
+		return -E_INVAL;
+	if ((ret = ipc_set_window(curenv, dstva, npages)) < 0)
+		return ret;
+	curenv->env_ipc_recvfrom = from;
+	curenv->env_ipc_recvtag = tag;
+	curenv->env_ipc_recvmask = mask;
+	ipc_recv_start(curenv);
+	if (ipc_recv_queued(curenv))
+		return 0;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
 // Block until a value is ready.  Record that you want to receive
 // using the env_ipc_recving and env_ipc_dstva fields of struct Env,
 // mark yourself not runnable, and then give up the CPU.
@@ -398,6 +1125,9 @@ sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, unsigned perm)
 // If 'dstva' is < UTOP, then you are willing to receive a page of data.
 // 'dstva' is the virtual address at which the sent page should be mapped.
 //
+// If senders are already blocked in sys_ipc_send, the first one whose
+// message can be delivered completes the receive immediately.
+//
 // This function only returns on error, but the system call will eventually
 // return 0 on success.
 // Return < 0 on error.  Errors are:
@@ -409,19 +1139,384 @@ sys_ipc_recv(void *dstva)
 	if((uint32_t)dstva < UTOP && (uint32_t)dstva % PGSIZE != 0){
 		return -E_INVAL;
 	}	
-	curenv->env_ipc_recving = true;
-	if((uintptr_t)dstva < UTOP){
-		curenv->env_ipc_dstva = dstva;
-	}	
+	return sys_ipc_recvv(dstva, (uintptr_t) dstva < UTOP);
+	//panic("sys_ipc_recv not implemented");
+}
+
+// Send a request to 'envid' as sys_ipc_send does, then wait for the
+// reply from 'envid' alone, as one system call.  The reply is received
+// at 'dstva' and reported in the ipc fields just as for sys_ipc_recv.
+// Messages from other envs stay queued until a later receive.
+//
+// Returns 0 once the reply arrives, < 0 on error.  Errors are as for
+// sys_ipc_send, plus:
+//	-E_INVAL if dstva < UTOP but dstva is not page-aligned.
+//	-E_BAD_ENV if 'envid' exits before replying.
+static int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, unsigned perm, void *dstva)
+{
+	struct Env *e;
+	struct IpcVec v;
+	int flags, nvec = ipc_page_vec(&v, srcva, perm, &flags);
+	uint32_t npages;
+	int ret;
+
+	if ((uintptr_t) dstva < UTOP && (uintptr_t) dstva % PGSIZE != 0)
+		return -E_INVAL;
+	if ((ret = envid2env(envid, &e, 0)) < 0)
+		return ret;
+	if (e == curenv)
+		return -E_INVAL;
+	if ((ret = ipc_check_vec(curenv, &v, nvec, &npages)) < 0)
+		return ret;
+
+	curenv->env_ipc_recvfrom = e->env_id;
+	curenv->env_ipc_recvtag = curenv->env_ipc_recvmask = 0;
+	ipc_set_window(curenv, dstva, (uintptr_t) dstva < UTOP);
+	if ((ret = ipc_send_or_queue(e, value, &v, nvec, flags)) < 0)
+		return ret;
+	if (ret == 0) {
+		ipc_recv_start(curenv);
+		if (ipc_recv_queued(curenv))
+			return 0;
+	} else
+		curenv->env_ipc_call = true;
+
 	curenv->env_status = ENV_NOT_RUNNABLE;
 	sched_yield();
+}
+
+// sys_ipc_call with the request carried in registers instead of a page,
+// entered through the T_IPCCALL trap: eax, ecx, ebx, edi, esi and ebp
+// hold the IPC_NWORDS message words, and edx holds 'envid'.
+// The receiver finds the words in env_ipc_words.  No page is sent and
+// none is accepted in the reply.
+//
+// Returns as sys_ipc_call does, or -E_INVAL if not entered via T_IPCCALL.
+static int
+sys_ipc_callw(envid_t envid)
+{
+	int ret;
+
+	if (curenv->env_tf.tf_trapno != T_IPCCALL)
+		return -E_INVAL;
+	curenv->env_ipc_sendregs = 1;
+	ret = sys_ipc_call(envid, curenv->env_tf.tf_regs.reg_eax,
+			   (void *) UTOP, 0, (void *) UTOP);
+	curenv->env_ipc_sendregs = 0;
+	return ret;
+}
+
+// Send the page-in request 'words' from curenv to 'pager', as
+// sys_ipc_call would, on behalf of a fault on the page at 'va' (see
+// pager_fault).  The reply's page, if any, is mapped at va.  Messages
+// already queued for curenv, even from the pager, are left for a
+// later receive.
+//
+// Returns 0 once the request is sent or queued, and curenv must then
+// block; or < 0 on error.
+int
+ipc_pagein(envid_t pager, const uint32_t *words, void *va)
+{
+	struct Env *e;
+	int ret;
+
+	if ((ret = envid2env(pager, &e, 0)) < 0)
+		return ret;
+	if (e == curenv)
+		return -E_INVAL;
+
+	memmove(curenv->env_pager_words, words, sizeof(curenv->env_pager_words));
+	curenv->env_pager_wait = true;
+	curenv->env_ipc_recvfrom = e->env_id;
+	curenv->env_ipc_recvtag = curenv->env_ipc_recvmask = 0;
+	ipc_set_window(curenv, va, 1);
+	if ((ret = ipc_send_or_queue(e, words[0], NULL, 0, 0)) < 0) {
+		curenv->env_pager_wait = false;
+		return ret;
+	}
+	if (ret == 0)
+		ipc_recv_start(curenv);
+	else
+		curenv->env_ipc_call = true;
 	return 0;
-	//panic("sys_ipc_recv not implemented");
+}
+
+// Reply to 'envid' and wait for the next request from anyone, as one
+// system call.  This is the server half of sys_ipc_call.  If delivery
+// fails (for example the reply page is bad), 'envid' is woken with the
+// error instead.  Pass envid 0 to only wait; an envid that no longer
+// exists is ignored the same way.
+//
+// Returns as sys_ipc_recv does, or, without receiving anything:
+//	-E_IPC_NOT_RECV if 'envid' is not waiting for the reply, as when
+//		it sent with sys_ipc_send rather than sys_ipc_call.  The
+//		reply is not sent; the caller can send it with
+//		sys_ipc_send (see ipc_reply_wait).
+static int
+sys_ipc_reply_wait(envid_t envid, uint32_t value, void *srcva, unsigned perm, void *dstva)
+{
+	struct Env *e;
+	struct IpcVec v;
+	int flags, nvec = ipc_page_vec(&v, srcva, perm, &flags);
+	int ret;
+
+	if ((uintptr_t) dstva < UTOP && (uintptr_t) dstva % PGSIZE != 0)
+		return -E_INVAL;
+	if (envid && envid2env(envid, &e, 0) == 0 && e != curenv) {
+		if (!ipc_accepts(e, curenv, value))
+			return -E_IPC_NOT_RECV;
+		ret = ipc_deliver(curenv, e, value, &v, nvec, flags);
+		ipc_wake(e, ret);
+	}
+	return sys_ipc_recv(dstva);
+}
+
+// Post the notification bits 'bits' to 'envid' without blocking.
+// Bits accumulate in the target's env_notify_pending until it takes
+// them with sys_notify_wait; posting a bit that is already pending
+// has no further effect.  If the target is blocked waiting for any
+// of the bits, it wakes up with them.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist.
+//		(As for IPC, no permission is needed.)
+//	-E_INVAL if bits is 0 or has bits outside NOTIFY_ALL.
+static int
+sys_notify(envid_t envid, uint32_t bits)
+{
+	struct Env *e;
+	uint32_t got;
+	int ret;
+
+	if (bits == 0 || (bits & ~NOTIFY_ALL))
+		return -E_INVAL;
+	if ((ret = envid2env(envid, &e, 0)) < 0)
+		return ret;
+	e->env_notify_pending |= bits;
+	if ((got = e->env_notify_pending & e->env_notify_waitmask) != 0) {
+		e->env_notify_pending &= ~got;
+		e->env_notify_waitmask = 0;
+		ipc_cancel(e, 0);
+		e->env_tf.tf_regs.reg_eax = got;
+		if (e->env_status == ENV_NOT_RUNNABLE)
+			e->env_status = ENV_RUNNABLE;
+	}
+	return 0;
+}
+
+// Take the pending notification bits in 'mask', blocking until at
+// least one of them has been posted.  The bits taken are cleared from
+// env_notify_pending; others stay pending.  An env can see what is
+// pending, without taking it, in thisenv->env_notify_pending.
+//
+// Returns the bits taken, or -E_INVAL if mask is 0 or has bits
+// outside NOTIFY_ALL.
+static int
+sys_notify_wait(uint32_t mask)
+{
+	uint32_t got;
+
+	if (mask == 0 || (mask & ~NOTIFY_ALL))
+		return -E_INVAL;
+	if ((got = curenv->env_notify_pending & mask) != 0) {
+		curenv->env_notify_pending &= ~got;
+		return got;
+	}
+	curenv->env_notify_waitmask = mask;
+	curenv->env_status = ENV_NOT_RUNNABLE;
+	sched_yield();
+}
+
+// Called as 'e' is freed.  Envs blocked sending to 'e', or waiting
+// for its reply, wake up with -E_BAD_ENV, and if 'e' itself was
+// blocked sending or receiving, it is removed from the queue it was on.
+void
+ipc_env_free(struct Env *e)
+{
+	struct Env *s;
+
+	while ((s = e->env_ipc_sendq) != NULL) {
+		ipc_unqueue(e, s);
+		ipc_wake(s, -E_BAD_ENV);
+	}
+	while ((s = e->env_ipc_fromq) != NULL)
+		ipc_wake(s, -E_BAD_ENV);
+
+	if (e->env_ipc_sendto)
+		ipc_unqueue(&envs[ENVX(e->env_ipc_sendto)], e);
+	ipc_recv_stop(e);
+}
+
+// Set up a page shared with the kernel for batched system calls
+// (a struct SysRing, see inc/sysring.h) and map it at 'va' in the
+// current environment.  The kernel holds its own reference to the
+// page, so the ring stays valid even if the env unmaps 'va'.
+// Any previously registered ring is released.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if va >= UTOP, or va is not page-aligned.
+//	-E_NO_MEM if there's no memory to allocate the page,
+//		or to allocate any necessary page tables.
+static int
+sys_ring_setup(void *va)
+{
+	struct PageInfo *pg;
+	int ret;
+
+	static_assert(sizeof(struct SysRing) <= PGSIZE);
+	if ((uintptr_t)va >= UTOP || (uintptr_t)va % PGSIZE != 0)
+		return -E_INVAL;
+	if (!(pg = page_alloc(ALLOC_ZERO)))
+		return -E_NO_MEM;
+	if ((ret = page_insert(curenv->env_pgdir, pg, va, PTE_P | PTE_U | PTE_W)) < 0) {
+		page_free(pg);
+		return ret;
+	}
+	pg->pp_ref++;
+	if (curenv->env_ring)
+		page_decref(curenv->env_ring);
+	curenv->env_ring = pg;
+	return 0;
+}
+
+// Run up to 'n' system calls queued in the current environment's
+// submission ring, posting a completion for each.  Stops early when
+// the submission ring is empty or the completion ring is full.
+// Only calls that never block or deschedule the caller may be queued:
+// page_alloc, page_map, page_unmap and ipc_try_send.  Anything else
+// completes with -E_INVAL.
+//
+// Returns the number of calls run, or -E_INVAL if no ring is set up.
+static int
+sys_enter_ring(uint32_t n)
+{
+	struct SysRing *ring;
+	struct SysRingSqe sqe;
+	uint32_t done;
+	int32_t ret;
+
+	if (!curenv->env_ring)
+		return -E_INVAL;
+	ring = page2kva(curenv->env_ring);
+	n = MIN(n, SYSRING_NSQE);
+	for (done = 0; done < n; done++) {
+		if (ring->sr_sq_head == ring->sr_sq_tail
+		    || ring->sr_cq_tail - ring->sr_cq_head >= SYSRING_NCQE)
+			break;
+		// Copy the entry so the env cannot change it under us.
+		sqe = ring->sr_sq[ring->sr_sq_head % SYSRING_NSQE];
+		switch (sqe.sqe_num) {
+		case SYS_page_alloc:
+			ret = sys_page_alloc(sqe.sqe_args[0], (void*)sqe.sqe_args[1],
+					     sqe.sqe_args[2]);
+			break;
+		case SYS_page_map:
+			ret = sys_page_map(sqe.sqe_args[0], (void*)sqe.sqe_args[1],
+					   sqe.sqe_args[2], (void*)sqe.sqe_args[3],
+					   sqe.sqe_args[4]);
+			break;
+		case SYS_page_unmap:
+			ret = sys_page_unmap(sqe.sqe_args[0], (void*)sqe.sqe_args[1]);
+			break;
+		case SYS_ipc_try_send:
+			ret = sys_ipc_try_send(sqe.sqe_args[0], sqe.sqe_args[1],
+					       (void*)sqe.sqe_args[2], sqe.sqe_args[3]);
+			break;
+		default:
+			ret = -E_INVAL;
+		}
+		ring->sr_cq[ring->sr_cq_tail % SYSRING_NCQE].cqe_tag = sqe.sqe_tag;
+		ring->sr_cq[ring->sr_cq_tail % SYSRING_NCQE].cqe_ret = ret;
+		ring->sr_sq_head++;
+		ring->sr_cq_tail++;
+	}
+	return done;
+}
+
+// Turn system call tracing on or off for envid.  The records go to
+// the caller: only it can read them with sys_trace_read.  Children
+// created with sys_exofork inherit the setting.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if environment envid doesn't currently exist,
+//		or the caller doesn't have permission to change envid.
+static int
+sys_trace_ctl(envid_t envid, bool on)
+{
+	struct Env *e;
+	int ret;
+
+	if ((ret = envid2env(envid, &e, 1)) < 0)
+		return ret;
+	e->env_trace = on ? curenv->env_id : 0;
+	return 0;
+}
+
+// Copy up to n unread trace records of calls traced for the caller
+// (see sys_trace_ctl) into buf.
+// Returns the number of records copied.
+// Destroys the environment if buf is not writable.
+static int
+sys_trace_read(struct TraceRec *buf, uint32_t n)
+{
+	n = MIN(n, PTSIZE / sizeof(struct TraceRec));
+	user_mem_fault_in(curenv, buf, n * sizeof(struct TraceRec), PTE_U | PTE_W);
+	user_mem_assert(curenv, buf, n * sizeof(struct TraceRec), PTE_U | PTE_W);
+	return trace_read(buf, n, curenv->env_id);
+}
+
+// Can the caller take over the profiler?  It can if it already owns
+// it, or if the profiler is stopped, or if its owner has exited.
+// A profile started from the kernel monitor is left alone while it runs.
+static bool
+prof_may_take(void)
+{
+	struct Env *e;
+
+	if (prof_owner == curenv->env_id || !prof_running)
+		return 1;
+	return prof_owner && envid2env(prof_owner, &e, 0) < 0;
+}
+
+// Start (discarding any earlier samples) or stop the sampling profiler.
+// Starting it makes the caller its owner; only the owner can stop it.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_BAD_ENV if another environment owns the profiler.
+static int
+sys_prof_ctl(bool on)
+{
+	if (on) {
+		if (!prof_may_take())
+			return -E_BAD_ENV;
+		prof_start(curenv->env_id);
+	} else {
+		if (prof_owner != curenv->env_id)
+			return -E_BAD_ENV;
+		prof_stop();
+	}
+	return 0;
+}
+
+// Copy up to n unread profiler samples into buf.
+// Returns the number of samples copied, or -E_BAD_ENV if the caller
+// does not own the profiler (see sys_prof_ctl).
+// Destroys the environment if buf is not writable.
+static int
+sys_prof_read(struct ProfSample *buf, uint32_t n)
+{
+	if (prof_owner != curenv->env_id)
+		return -E_BAD_ENV;
+	n = MIN(n, PTSIZE / sizeof(struct ProfSample));
+	user_mem_fault_in(curenv, buf, n * sizeof(struct ProfSample), PTE_U | PTE_W);
+	user_mem_assert(curenv, buf, n * sizeof(struct ProfSample), PTE_U | PTE_W);
+	return prof_read(buf, n);
 }
 
 // Dispatches to the correct kernel function, passing the arguments.
-int32_t
-syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+static int32_t
+dispatch(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
 {
 	// Call the function corresponding to the 'syscallno' parameter.
 	// Return any appropriate return value.
@@ -460,8 +1555,72 @@ syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
 		return sys_ipc_recv((void*)a1);
 	case SYS_env_set_trapframe:
 		return sys_env_set_trapframe(a1, (struct Trapframe*)a2);
+	case SYS_ring_setup:
+		return sys_ring_setup((void*)a1);
+	case SYS_enter_ring:
+		return sys_enter_ring(a1);
+	case SYS_trace_ctl:
+		return sys_trace_ctl(a1, a2);
+	case SYS_trace_read:
+		return sys_trace_read((struct TraceRec*)a1, a2);
+	case SYS_prof_ctl:
+		return sys_prof_ctl(a1);
+	case SYS_prof_read:
+		return sys_prof_read((struct ProfSample*)a1, a2);
+	case SYS_ipc_send:
+		return sys_ipc_send(a1, a2, (void*)a3, a4);
+	case SYS_ipc_call:
+		return sys_ipc_call(a1, a2, (void*)a3, a4, (void*)a5);
+	case SYS_ipc_reply_wait:
+		return sys_ipc_reply_wait(a1, a2, (void*)a3, a4, (void*)a5);
+	case SYS_ipc_callw:
+		return sys_ipc_callw(a1);
+	case SYS_ipc_sendv:
+		return sys_ipc_sendv(a1, a2, (const struct IpcVec*)a3, a4, a5);
+	case SYS_ipc_recvv:
+		return sys_ipc_recvv((void*)a1, a2);
+	case SYS_futex_wait:
+		return futex_wait((uint32_t*)a1, a2, a3);
+	case SYS_futex_wake:
+		return futex_wake((uint32_t*)a1, a2);
+	case SYS_ipc_recvsel:
+		return sys_ipc_recvsel(a1, a2, a3, (void*)a4, a5);
+	case SYS_notify:
+		return sys_notify(a1, a2);
+	case SYS_notify_wait:
+		return sys_notify_wait(a1);
+	case SYS_env_set_pager:
+		return sys_env_set_pager(a1, (const struct PagerRegion *) a2);
+	case SYS_thread_create:
+		return sys_thread_create((void *) a1, (void *) a2, (void *) a3,
+					 (void *) a4, (uint32_t *) a5);
+	case SYS_env_share_pts:
+		return sys_env_share_pts(a1);
+	case SYS_vfork:
+		return sys_vfork();
+	case SYS_page_populate:
+		return sys_page_populate(a1, (void *) a2, a3, a4);
+	case SYS_madvise:
+		return sys_madvise(a1, (void *) a2, a3, a4);
 	default:
 		return -E_INVAL;
 	}
 }
 
+// System call entry point.  Untraced environments only pay for the
+// test of env_trace.
+int32_t
+syscall(uint32_t syscallno, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct TraceRec *rec;
+	int32_t ret;
+
+	if (!curenv->env_trace)
+		return dispatch(syscallno, a1, a2, a3, a4, a5);
+
+	rec = trace_begin(syscallno, a1, a2, a3, a4, a5);
+	ret = dispatch(syscallno, a1, a2, a3, a4, a5);
+	trace_end(rec, ret);
+	return ret;
+}
+
@@ -5,7 +5,11 @@
 #endif
 
 #include <inc/syscall.h>
+#include <inc/env.h>
 
 int32_t syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5);
+void ipc_env_free(struct Env *e);
+void ipc_cancel(struct Env *e, int ret);
+int ipc_pagein(envid_t pager, const uint32_t *words, void *va);
 
 #endif /* !JOS_KERN_SYSCALL_H */
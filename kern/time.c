@@ -0,0 +1,26 @@
+#include <kern/time.h>
+#include <inc/assert.h>
+
+static unsigned int ticks;
+
+void
+time_init(void)
+{
+	ticks = 0;
+}
+
+// This should be called once per timer interrupt.  A timer interrupt
+// fires every 10 ms.
+void
+time_tick(void)
+{
+	ticks++;
+	if (ticks * 10 < ticks)
+		panic("time_tick: time overflowed");
+}
+
+unsigned int
+time_msec(void)
+{
+	return (unsigned int) ticks * 10;
+}
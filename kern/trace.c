@@ -0,0 +1,97 @@
+// System call tracing.
+//
+// Calls made by environments with env_trace set are recorded in a
+// per-CPU ring, along with the env_trace value: the env that turned
+// tracing on, which is the only one that may read the record.  Each
+// CPU only ever writes its own ring, so recording needs no lock of its
+// own; trace_read collects the rings from inside a system call, under
+// the big kernel lock.
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/trace.h>
+#include <kern/env.h>
+#include <kern/cpu.h>
+
+// Records kept per CPU.  Must be a power of two.
+#define NTRACE		256
+
+static struct TraceRing {
+	struct TraceRec tr_recs[NTRACE];
+	envid_t tr_reader[NTRACE];	// Who may read the record; 0 once read
+	uint32_t tr_head;		// Next record this CPU writes
+	uint32_t tr_tail;		// Oldest record not yet read
+} trace_rings[NCPU];
+
+// Start a record for a system call made by curenv.
+// Calls that block or switch environments never reach trace_end,
+// so their records stay marked TRACE_PENDING.
+struct TraceRec *
+trace_begin(uint32_t num, uint32_t a1, uint32_t a2,
+	    uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct TraceRing *ring = &trace_rings[cpunum()];
+	struct TraceRec *rec = &ring->tr_recs[ring->tr_head % NTRACE];
+
+	ring->tr_reader[ring->tr_head % NTRACE] = curenv->env_trace;
+	rec->tr_envid = curenv->env_id;
+	rec->tr_num = num;
+	rec->tr_args[0] = a1;
+	rec->tr_args[1] = a2;
+	rec->tr_args[2] = a3;
+	rec->tr_args[3] = a4;
+	rec->tr_args[4] = a5;
+	rec->tr_ret = 0;
+	rec->tr_cpu = cpunum();
+	rec->tr_flags = TRACE_PENDING;
+	rec->tr_cycles = 0;
+	ring->tr_head++;
+	rec->tr_start = read_tsc();
+	return rec;
+}
+
+// Finish a record started by trace_begin.
+void
+trace_end(struct TraceRec *rec, int32_t ret)
+{
+	rec->tr_cycles = read_tsc() - rec->tr_start;
+	rec->tr_ret = ret;
+	rec->tr_flags &= ~TRACE_PENDING;
+}
+
+// Copy up to 'n' unread records that 'reader' may read into 'buf', one
+// CPU's ring at a time.  Records of other readers are left in place.
+// Records a CPU overwrote before they were read are dropped, and the
+// next record this reader gets from that CPU is marked TRACE_OVERRUN,
+// though the lost records may have been another reader's.
+// 'buf' must already have been checked.  Returns the number copied.
+int
+trace_read(struct TraceRec *buf, uint32_t n, envid_t reader)
+{
+	struct TraceRing *ring;
+	uint32_t done = 0, j;
+	bool overrun;
+	int i;
+
+	for (i = 0; i < ncpu && done < n; i++) {
+		ring = &trace_rings[i];
+		overrun = ring->tr_head - ring->tr_tail > NTRACE;
+		if (overrun)
+			ring->tr_tail = ring->tr_head - NTRACE;
+		for (j = ring->tr_tail; j != ring->tr_head && done < n; j++) {
+			if (ring->tr_reader[j % NTRACE] != reader)
+				continue;
+			buf[done] = ring->tr_recs[j % NTRACE];
+			ring->tr_reader[j % NTRACE] = 0;
+			if (overrun)
+				buf[done].tr_flags |= TRACE_OVERRUN;
+			overrun = 0;
+			done++;
+		}
+		while (ring->tr_tail != ring->tr_head
+		       && ring->tr_reader[ring->tr_tail % NTRACE] == 0)
+			ring->tr_tail++;
+	}
+	return done;
+}
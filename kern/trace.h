@@ -0,0 +1,15 @@
+#ifndef JOS_KERN_TRACE_H
+#define JOS_KERN_TRACE_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/env.h>
+#include <inc/trace.h>
+
+struct TraceRec *trace_begin(uint32_t num, uint32_t a1, uint32_t a2,
+			     uint32_t a3, uint32_t a4, uint32_t a5);
+void trace_end(struct TraceRec *rec, int32_t ret);
+int trace_read(struct TraceRec *buf, uint32_t n, envid_t reader);
+
+#endif /* !JOS_KERN_TRACE_H */
@@ -13,6 +13,10 @@
 #include <kern/picirq.h>
 #include <kern/cpu.h>
 #include <kern/spinlock.h>
+#include <kern/prof.h>
+#include <kern/time.h>
+#include <kern/futex.h>
+#include <kern/pager.h>
 
 static struct Taskstate ts;
 
@@ -67,6 +71,8 @@ extern void irq14_handler();
 extern void irq15_handler();
 
 extern void syscall_handler();
+extern void ipccall_handler();
+extern void tlbflush_handler();
 
 static const char *trapname(int trapno)
 {
@@ -97,6 +103,10 @@ static const char *trapname(int trapno)
 		return excnames[trapno];
 	if (trapno == T_SYSCALL)
 		return "System call";
+	if (trapno == T_IPCCALL)
+		return "IPC call";
+	if (trapno == T_TLBFLUSH)
+		return "TLB shootdown";
 	if (trapno >= IRQ_OFFSET && trapno < IRQ_OFFSET + 16)
 		return "Hardware Interrupt";
 	return "(unknown trap)";
@@ -148,6 +158,8 @@ trap_init(void)
 	SETGATE(idt[IRQ_OFFSET + 15], 0, GD_KT, irq15_handler, 0);
 
 	SETGATE(idt[T_SYSCALL], 0, GD_KT, syscall_handler, 3);
+	SETGATE(idt[T_IPCCALL], 0, GD_KT, ipccall_handler, 3);
+	SETGATE(idt[T_TLBFLUSH], 0, GD_KT, tlbflush_handler, 0);
 	// Per-CPU setup 
 	trap_init_percpu();
 }
@@ -204,6 +216,11 @@ trap_init_percpu(void)
 
 	// Load the IDT
 	lidt(&idt_pd);
+
+	// Enable FXSAVE/SSE and start with CR0.TS set, so the first FPU
+	// instruction on this CPU traps and loads the env's own state.
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+	lcr0((rcr0() | CR0_MP | CR0_NE | CR0_TS) & ~CR0_EM);
 }
 
 void
@@ -266,6 +283,10 @@ trap_dispatch(struct Trapframe *tf)
 		page_fault_handler(tf);
 		return;
 	}
+	if (tf->tf_trapno == T_DEVICE && (tf->tf_cs & 3) == 3) {
+		env_fpu_restore();
+		return;
+	}
 	if (tf->tf_trapno == T_SYSCALL) {
 		tf->tf_regs.reg_eax = syscall(
 			tf->tf_regs.reg_eax, 
@@ -277,6 +298,17 @@ trap_dispatch(struct Trapframe *tf)
 		);
 		return;
 	}
+	if (tf->tf_trapno == T_IPCCALL) {
+		// The message words are read from curenv->env_tf.
+		tf->tf_regs.reg_eax = syscall(SYS_ipc_callw, tf->tf_regs.reg_edx,
+					      0, 0, 0, 0);
+		return;
+	}
+	// The TLB was flushed on entry (see tlb_shootdown_ack).
+	if (tf->tf_trapno == T_TLBFLUSH) {
+		lapic_eoi();
+		return;
+	}
 	// Handle spurious interrupts
 	// The hardware sometimes raises these because of noise on the
 	// IRQ line or other reasons. We don't care.
@@ -291,6 +323,13 @@ trap_dispatch(struct Trapframe *tf)
 	// LAB 4: Your code here.
 
 	if (tf->tf_trapno == IRQ_OFFSET + IRQ_TIMER) {
+		if (prof_running)
+			prof_tick(tf);
+		// Keep time on one CPU only
+		if (cpunum() == 0) {
+			time_tick();
+			futex_tick();
+		}
 		lapic_eoi();
 		sched_yield();
 	}
@@ -343,6 +382,9 @@ trap(struct Trapframe *tf)
 		// LAB 4: Your code here.
 		assert(curenv);
 
+		// The CPU sending a TLB shootdown holds the lock and
+		// waits for us, so answer it first.
+		tlb_shootdown_ack();
 		lock_kernel();
 		// Garbage collect if current enviroment is a zombie
 		if (curenv->env_status == ENV_DYING) {
@@ -380,6 +422,7 @@ void
 page_fault_handler(struct Trapframe *tf)
 {
 	uint32_t fault_va;
+	int r;
 
 	// Read processor's CR2 register to find the faulting address
 	fault_va = rcr2();
@@ -393,9 +436,21 @@ page_fault_handler(struct Trapframe *tf)
 	// We've already handled kernel-mode exceptions, so if we get here,
 	// the page fault happened in user mode.
 
+	// Copy-on-write and demand-paged faults are resolved here,
+	// without an upcall.  A page-in blocks us until the pager
+	// replies; then the faulting instruction runs again.
+	r = pager_fault(curenv, fault_va, tf->tf_err & FEC_WR, true);
+	if (r == 0)
+		return;
+	if (r == 1) {
+		curenv->env_status = ENV_NOT_RUNNABLE;
+		sched_yield();
+	}
+
 	// Call the environment's page fault upcall, if one exists.  Set up a
 	// page fault stack frame on the user exception stack (below
-	// UXSTACKTOP), then branch to curenv->env_pgfault_upcall.
+	// UXSTACKTOP, or a thread's env_xstacktop), then branch to
+	// curenv->env_pgfault_upcall.
 	//
 	// The page fault upcall might cause another page fault, in which case
 	// we branch to the page fault upcall recursively, pushing another
@@ -425,15 +480,17 @@ page_fault_handler(struct Trapframe *tf)
 	// LAB 4: Your code here.
 	struct UTrapframe *utf;
 	size_t frame_size = sizeof(struct UTrapframe);
+	uintptr_t xstacktop = curenv->env_xstacktop;
 	if (curenv->env_pgfault_upcall != NULL) {
-		if (tf->tf_esp <= UXSTACKTOP - 1 && tf->tf_esp >= UXSTACKTOP - PGSIZE) {
+		if (tf->tf_esp <= xstacktop - 1 && tf->tf_esp >= xstacktop - PGSIZE) {
 			frame_size += 4;
 			utf = (struct UTrapframe *)(tf->tf_esp - frame_size);
 		}else{
-			utf = (struct UTrapframe *)(UXSTACKTOP - frame_size);
+			utf = (struct UTrapframe *)(xstacktop - frame_size);
 		}
+		user_mem_fault_in(curenv, utf, frame_size, PTE_W | PTE_U);
 		user_mem_assert(curenv, utf, frame_size, PTE_W | PTE_U);
-		if ((uintptr_t)utf > UXSTACKTOP - PGSIZE) {
+		if ((uintptr_t)utf > xstacktop - PGSIZE) {
 			utf->utf_eflags = tf->tf_eflags;
 			utf->utf_esp = tf->tf_esp;
 			utf->utf_eip = tf->tf_eip;
@@ -0,0 +1,112 @@
+// Arenas and fixed-size object pools.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+#include <inc/arena.h>
+
+// Set up 'a' to allocate from 'size' bytes of address space at 'va',
+// which must be page-aligned and unmapped.  Nothing is mapped yet.
+void
+arena_init(struct Arena *a, void *va, size_t size)
+{
+	a->a_base = va;
+	a->a_size = ROUNDDOWN(size, PGSIZE);
+	a->a_mapped = 0;
+	a->a_used = 0;
+}
+
+// Allocate 'n' bytes, aligned to 8, from 'a'.
+// Returns NULL if the range is used up or out of memory.
+void *
+arena_alloc(struct Arena *a, size_t n)
+{
+	size_t start = ROUNDUP(a->a_used, 8);
+	void *v;
+
+	if (n > a->a_size - start)
+		return NULL;
+	while (start + n > a->a_mapped) {
+		if (sys_page_alloc(0, a->a_base + a->a_mapped, PTE_P | PTE_U | PTE_W) < 0)
+			return NULL;
+		a->a_mapped += PGSIZE;
+	}
+	v = a->a_base + start;
+	a->a_used = start + n;
+	return v;
+}
+
+// Copy the string 's', or its first 'max' bytes, into 'a'.
+// Returns the copy, or NULL as arena_alloc does.
+char *
+arena_strndup(struct Arena *a, const char *s, size_t max)
+{
+	size_t n = strnlen(s, max);
+	char *d;
+
+	if (!(d = arena_alloc(a, n + 1)))
+		return NULL;
+	memmove(d, s, n);
+	d[n] = '\0';
+	return d;
+}
+
+// Free everything allocated from 'a', keeping its pages mapped.
+void
+arena_reset(struct Arena *a)
+{
+	a->a_used = 0;
+}
+
+// Free everything allocated from 'a' and unmap its pages.
+void
+arena_free_all(struct Arena *a)
+{
+	while (a->a_mapped > 0) {
+		a->a_mapped -= PGSIZE;
+		sys_page_unmap(0, a->a_base + a->a_mapped);
+	}
+	a->a_used = 0;
+}
+
+// Set up 'p' as an empty pool for objects of 'objsize' bytes in the
+// array 'objs'.  Objects join it with pool_put.
+void
+pool_init(struct Pool *p, void *objs, size_t objsize)
+{
+	assert(objsize >= sizeof(uint32_t));
+	p->p_head = 0;
+	p->p_objs = objs;
+	p->p_objsize = objsize;
+}
+
+// Take a free object from 'p'.  Returns NULL if there is none.
+void *
+pool_get(struct Pool *p)
+{
+	uint32_t head, idx;
+	char *obj;
+
+	do {
+		head = p->p_head;
+		if ((idx = head & 0xFFFF) == 0)
+			return NULL;
+		obj = p->p_objs + (idx - 1) * p->p_objsize;
+	} while (cmpxchg(&p->p_head, head,
+			 (head & 0xFFFF0000) + 0x10000
+			 + *(volatile uint32_t *) obj) != head);
+	return obj;
+}
+
+// Return 'obj', an object of p's array, to 'p'.
+void
+pool_put(struct Pool *p, void *obj)
+{
+	uint32_t head, idx = ((char *) obj - p->p_objs) / p->p_objsize + 1;
+
+	assert(idx <= 0xFFFF);
+	do {
+		head = p->p_head;
+		*(volatile uint32_t *) obj = head & 0xFFFF;
+	} while (cmpxchg(&p->p_head, head,
+			 (head & 0xFFFF0000) + 0x10000 + idx) != head);
+}
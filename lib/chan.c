@@ -0,0 +1,157 @@
+// Lock-free shared-memory channels between two environments.
+//
+// The producer only writes c_head and the ring, and the consumer only
+// writes c_tail, so neither side needs a lock and a message costs no
+// system call while the ring is neither empty nor full.  A side that
+// must wait raises its wait flag and sleeps on its sequence word; the
+// other side bumps that word and wakes it after its next update.
+// Flags and counters are updated with xchg, a full barrier, so either
+// the waker sees the flag or the sleeper sees the update.
+//
+// The ring itself is plain memory.  x86 keeps loads in order with
+// loads and stores in order with stores, so only the compiler can
+// reorder ring accesses around c_head and c_tail: chan_barrier stops
+// it, after each index is read and before each is written.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+#include <inc/chan.h>
+
+#define chan_barrier()	asm volatile("" : : : "memory")
+
+// Map a new channel at 'c' whose ring holds 'size' bytes.
+// 'c' must be page-aligned with size + PGSIZE bytes free there,
+// and 'size' a power of 2 that is at least PGSIZE.
+int
+chan_create(struct Chan *c, size_t size)
+{
+	size_t off;
+	int r;
+
+	if ((uintptr_t) c % PGSIZE || size < PGSIZE || (size & (size - 1)))
+		return -E_INVAL;
+	for (off = 0; off < size + PGSIZE; off += PGSIZE)
+		if ((r = sys_page_alloc(0, (char *) c + off,
+					PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0) {
+			while (off > 0) {
+				off -= PGSIZE;
+				sys_page_unmap(0, (char *) c + off);
+			}
+			return r;
+		}
+	c->c_size = size;
+	return 0;
+}
+
+// Sleep on '*seq' unless '*word' has moved from 'old' or 'c' is closed.
+static void
+chan_sleep(struct Chan *c, volatile uint32_t *flag, volatile uint32_t *seq,
+	   volatile uint32_t *word, uint32_t old)
+{
+	uint32_t s = *seq;
+
+	xchg(flag, 1);
+	if (*word == old && !c->c_closed)
+		sys_futex_wait(seq, s, 0);
+	*flag = 0;
+}
+
+static void
+chan_wake(volatile uint32_t *flag, volatile uint32_t *seq)
+{
+	if (*flag) {
+		atomic_add(seq, 1);
+		sys_futex_wake(seq, 1);
+	}
+}
+
+// Largest record that fits in 'c'.
+size_t
+chan_maxrec(struct Chan *c)
+{
+	return c->c_size / 2 - sizeof(uint32_t);
+}
+
+// Append a record of 'n' bytes to 'c', sleeping while the ring is full.
+// Returns 0, -E_INVAL if the record is larger than chan_maxrec,
+// or -E_EOF if the channel has been closed.
+int
+chan_send(struct Chan *c, const void *buf, size_t n)
+{
+	uint32_t head = c->c_head, tail, off, len, need;
+	char *ring = CHAN_RING(c);
+
+	if (n > chan_maxrec(c))
+		return -E_INVAL;
+	len = sizeof(uint32_t) + ROUNDUP(n, sizeof(uint32_t));
+	off = head & (c->c_size - 1);
+	// A record never wraps; pad out the end of the ring instead.
+	need = c->c_size - off < len ? c->c_size - off + len : len;
+
+	while (c->c_size - (head - (tail = c->c_tail)) < need) {
+		if (c->c_closed)
+			return -E_EOF;
+		chan_sleep(c, &c->c_wwait, &c->c_wseq, &c->c_tail, tail);
+	}
+	chan_barrier();		// Reader is done with the space we reuse
+
+	if (need != len) {
+		*(uint32_t *) (ring + off) = CHAN_PAD;
+		off = 0;
+	}
+	*(uint32_t *) (ring + off) = n;
+	memmove(ring + off + sizeof(uint32_t), buf, n);
+
+	chan_barrier();		// Record is in the ring before it is published
+	xchg(&c->c_head, head + need);
+	chan_wake(&c->c_rwait, &c->c_rseq);
+	return 0;
+}
+
+// Remove the next record from 'c' into 'buf', sleeping while the ring
+// is empty.  Returns the record's length, 0 once the channel is closed
+// and drained, or -E_INVAL if the record is larger than 'n' bytes,
+// in which case it is left in the ring.
+ssize_t
+chan_recv(struct Chan *c, void *buf, size_t n)
+{
+	uint32_t tail = c->c_tail, head, off, len;
+	char *ring = CHAN_RING(c);
+
+	while ((head = c->c_head) == tail) {
+		if (c->c_closed && c->c_head == tail)
+			return 0;
+		chan_sleep(c, &c->c_rwait, &c->c_rseq, &c->c_head, head);
+	}
+	chan_barrier();		// Record is read only after head says it is there
+
+	off = tail & (c->c_size - 1);
+	if ((len = *(uint32_t *) (ring + off)) == CHAN_PAD) {
+		tail += c->c_size - off;
+		off = 0;
+		len = *(uint32_t *) ring;
+	}
+	if (len > n)
+		return -E_INVAL;
+	memmove(buf, ring + off + sizeof(uint32_t), len);
+
+	chan_barrier();		// Record is copied out before its space is freed
+	xchg(&c->c_tail, tail + sizeof(uint32_t) + ROUNDUP(len, sizeof(uint32_t)));
+	chan_wake(&c->c_wwait, &c->c_wseq);
+	return len;
+}
+
+// Close 'c' for writing.  The consumer reads what is left in the ring,
+// then sees end of file; a producer blocked on a full ring gives up.
+// A record whose chan_send returned before chan_close was called is
+// always received: chan_send publishes c_head before it returns, and
+// chan_recv checks c_head again after it sees c_closed.
+void
+chan_close(struct Chan *c)
+{
+	xchg(&c->c_closed, 1);
+	atomic_add(&c->c_rseq, 1);
+	sys_futex_wake(&c->c_rseq, 1);
+	atomic_add(&c->c_wseq, 1);
+	sys_futex_wake(&c->c_wseq, 1);
+}
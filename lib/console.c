@@ -84,7 +84,8 @@ devcons_read(struct Fd *fd, void *vbuf, size_t n)
 		return 0;
 
 	while ((c = sys_cgetc()) == 0)
-		sys_yield();
+		if (!gthread_wait())
+			sys_yield();
 	if (c < 0)
 		return c;
 	if (c == 0x04)	// ctl-d is eof
@@ -2,14 +2,6 @@
 
 #define debug		0
 
-// Maximum number of file descriptors a program may hold open concurrently
-#define MAXFD		32
-// Bottom of file descriptor area
-#define FDTABLE		0xD0000000
-// Bottom of file data area.  We reserve one data page for each FD,
-// which devices can use if they choose.
-#define FILEDATA	(FDTABLE + MAXFD*PGSIZE)
-
 // Return the 'struct Fd*' for file descriptor index i
 #define INDEX2FD(i)	((struct Fd*) (FDTABLE + (i)*PGSIZE))
 // Return the file data page for file descriptor index i
@@ -200,6 +192,31 @@ err:
 	return r;
 }
 
+// Map file descriptor 'fdnum' into environment 'dstenv' as descriptor
+// 'dstfdnum', sharing the open file as dup does within one environment.
+// Used by spawnfa to build a child's descriptor table.
+int
+fd_map(int fdnum, envid_t dstenv, int dstfdnum)
+{
+	int r;
+	char *va;
+	struct Fd *fd;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (dstfdnum < 0 || dstfdnum >= MAXFD)
+		return -E_INVAL;
+
+	// Map the data page first, so a pipe never looks closed.
+	va = fd2data(fd);
+	if ((uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P))
+		if ((r = sys_page_map(0, va, dstenv, INDEX2DATA(dstfdnum),
+				      uvpt[PGNUM(va)] & PTE_SYSCALL)) < 0)
+			return r;
+	return sys_page_map(0, fd, dstenv, INDEX2FD(dstfdnum),
+			    uvpt[PGNUM(fd)] & PTE_SYSCALL);
+}
+
 ssize_t
 read(int fdnum, void *buf, size_t n)
 {
@@ -207,6 +224,7 @@ read(int fdnum, void *buf, size_t n)
 	struct Dev *dev;
 	struct Fd *fd;
 
+	gthread_preempt();
 	if ((r = fd_lookup(fdnum, &fd)) < 0
 	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
 		return r;
@@ -241,6 +259,7 @@ write(int fdnum, const void *buf, size_t n)
 	struct Dev *dev;
 	struct Fd *fd;
 
+	gthread_preempt();
 	if ((r = fd_lookup(fdnum, &fd)) < 0
 	    || (r = dev_lookup(fd->fd_dev_id, &dev)) < 0)
 		return r;
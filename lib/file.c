@@ -5,17 +5,28 @@
 #define debug 0
 
 union Fsipc fsipcbuf __attribute__((aligned(PGSIZE)));
+static envid_t fsenv;
+// Held from filling in fsipcbuf until the reply in it has been read,
+// since kernel threads share the one request page.
+static struct Mutex fsipc_lock;
 
 // Send an inter-environment request to the file server, and wait for
 // a reply.  The request body should be in fsipcbuf, and parts of the
-// response may be written back to fsipcbuf.
+// response may be written back to fsipcbuf.  The caller holds
+// fsipc_lock.
 // type: request code, passed as the simple integer IPC value.
 // dstva: virtual address at which to receive reply page, 0 if none.
 // Returns result from the file server.
+//
+// Unless a reply page is expected at dstva, the fsipcbuf page is moved
+// to the file server, not shared, and the server moves it back with
+// the reply.
 static int
 fsipc(unsigned type, void *dstva)
 {
-	static envid_t fsenv;
+	int perm = PTE_P | PTE_W | PTE_U;
+	int r;
+
 	if (fsenv == 0)
 		fsenv = ipc_find_env(ENV_TYPE_FS);
 
@@ -24,8 +35,33 @@ fsipc(unsigned type, void *dstva)
 	if (debug)
 		cprintf("[%08x] fsipc %d %08x\n", thisenv->env_id, type, *(uint32_t *)&fsipcbuf);
 
-	ipc_send(fsenv, type, &fsipcbuf, PTE_P | PTE_W | PTE_U);
-	return ipc_recv(NULL, dstva, NULL);
+	if (!dstva) {
+		perm |= IPC_PERM_MOVE;
+		dstva = &fsipcbuf;
+	}
+	r = ipc_call(fsenv, type, &fsipcbuf, perm, dstva, NULL);
+	// If the server died with our page, replace it.
+	if (!(uvpt[PGNUM(&fsipcbuf)] & PTE_P))
+		sys_page_alloc(0, &fsipcbuf, PTE_P | PTE_W | PTE_U);
+	return r;
+}
+
+// Send a short request whose arguments fit in the IPC message words,
+// so that no argument page has to be mapped into the file server.
+// The words after the request code are laid out as the request's
+// struct Fsreq_*.
+static int
+fsipc_short(unsigned type, uint32_t arg0, uint32_t arg1)
+{
+	uint32_t words[IPC_NWORDS] = { type, arg0, arg1 };
+
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+
+	if (debug)
+		cprintf("[%08x] fsipc_short %d %08x %08x\n", thisenv->env_id, type, arg0, arg1);
+
+	return ipc_callw(fsenv, words);
 }
 
 static int devfile_flush(struct Fd *fd);
@@ -77,10 +113,12 @@ open(const char *path, int mode)
 	if ((r = fd_alloc(&fd)) < 0)
 		return r;
 
+	mutex_lock(&fsipc_lock);
 	strcpy(fsipcbuf.open.req_path, path);
 	fsipcbuf.open.req_omode = mode;
-
-	if ((r = fsipc(FSREQ_OPEN, fd)) < 0) {
+	r = fsipc(FSREQ_OPEN, fd);
+	mutex_unlock(&fsipc_lock);
+	if (r < 0) {
 		fd_close(fd, 0);
 		return r;
 	}
@@ -99,8 +137,7 @@ open(const char *path, int mode)
 static int
 devfile_flush(struct Fd *fd)
 {
-	fsipcbuf.flush.req_fileid = fd->fd_file.id;
-	return fsipc(FSREQ_FLUSH, NULL);
+	return fsipc_short(FSREQ_FLUSH, fd->fd_file.id, 0);
 }
 
 // Read at most 'n' bytes from 'fd' at the current position into 'buf'.
@@ -117,13 +154,15 @@ devfile_read(struct Fd *fd, void *buf, size_t n)
 	// system server.
 	int r;
 
+	mutex_lock(&fsipc_lock);
 	fsipcbuf.read.req_fileid = fd->fd_file.id;
 	fsipcbuf.read.req_n = n;
-	if ((r = fsipc(FSREQ_READ, NULL)) < 0)
-		return r;
-	assert(r <= n);
-	assert(r <= PGSIZE);
-	memmove(buf, fsipcbuf.readRet.ret_buf, r);
+	if ((r = fsipc(FSREQ_READ, NULL)) > 0) {
+		assert(r <= n);
+		assert(r <= PGSIZE);
+		memmove(buf, fsipcbuf.readRet.ret_buf, r);
+	}
+	mutex_unlock(&fsipc_lock);
 	return r;
 }
 
@@ -146,10 +185,13 @@ devfile_write(struct Fd *fd, const void *buf, size_t n)
 	if(n > buf_size){
 		n = buf_size;
 	}
+	mutex_lock(&fsipc_lock);
 	memmove(fsipcbuf.write.req_buf, buf, n);
 	fsipcbuf.write.req_fileid = fd->fd_file.id;
 	fsipcbuf.write.req_n = n;
-	if ((r = fsipc(FSREQ_WRITE, NULL)) < 0)
+	r = fsipc(FSREQ_WRITE, NULL);
+	mutex_unlock(&fsipc_lock);
+	if (r < 0)
 		return r;
 	assert(r <= n);
 	assert(r <= PGSIZE);
@@ -162,24 +204,74 @@ devfile_stat(struct Fd *fd, struct Stat *st)
 {
 	int r;
 
+	mutex_lock(&fsipc_lock);
 	fsipcbuf.stat.req_fileid = fd->fd_file.id;
-	if ((r = fsipc(FSREQ_STAT, NULL)) < 0)
-		return r;
-	strcpy(st->st_name, fsipcbuf.statRet.ret_name);
-	st->st_size = fsipcbuf.statRet.ret_size;
-	st->st_isdir = fsipcbuf.statRet.ret_isdir;
-	return 0;
+	if ((r = fsipc(FSREQ_STAT, NULL)) >= 0) {
+		strcpy(st->st_name, fsipcbuf.statRet.ret_name);
+		st->st_size = fsipcbuf.statRet.ret_size;
+		st->st_isdir = fsipcbuf.statRet.ret_isdir;
+		r = 0;
+	}
+	mutex_unlock(&fsipc_lock);
+	return r;
 }
 
 // Truncate or extend an open file to 'size' bytes
 static int
 devfile_trunc(struct Fd *fd, off_t newsize)
 {
-	fsipcbuf.set_size.req_fileid = fd->fd_file.id;
-	fsipcbuf.set_size.req_size = newsize;
-	return fsipc(FSREQ_SET_SIZE, NULL);
+	return fsipc_short(FSREQ_SET_SIZE, fd->fd_file.id, newsize);
 }
 
+// Map the block of file descriptor 'fdnum' holding byte 'offset',
+// which must be a multiple of BLKSIZE inside the file, read-only at
+// 'dstva'.  The page is the file server's block cache page itself,
+// so no data is copied.
+int
+file_map(int fdnum, off_t offset, void *dstva)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	mutex_lock(&fsipc_lock);
+	fsipcbuf.map.req_fileid = fd->fd_file.id;
+	fsipcbuf.map.req_offset = offset;
+	r = fsipc(FSREQ_MAP, dstva);
+	mutex_unlock(&fsipc_lock);
+	return r;
+}
+
+// Where file_pager maps the Fd page in the env it sets up.
+#define PAGERFD		((void *) 0xCFFFF000)	// just below the fd table
+
+// Fill in the pager fields of 'pr' so that env 'envid' can demand-page
+// the region from file descriptor 'fdnum' (see sys_env_set_pager).
+// The file server supplies the pages.  The Fd page is mapped read-only
+// at PAGERFD in envid, outside its descriptor table, which keeps the
+// file open for as long as envid or any child it forks maps it.
+int
+file_pager(int fdnum, envid_t envid, struct PagerRegion *pr)
+{
+	struct Fd *fd;
+	int r;
+
+	if ((r = fd_lookup(fdnum, &fd)) < 0)
+		return r;
+	if (fd->fd_dev_id != devfile.dev_id)
+		return -E_INVAL;
+	if ((r = sys_page_map(0, fd, envid, PAGERFD, PTE_P | PTE_U)) < 0)
+		return r;
+	if (fsenv == 0)
+		fsenv = ipc_find_env(ENV_TYPE_FS);
+	pr->pr_pager = fsenv;
+	pr->pr_req = FSREQ_PAGEIN;
+	pr->pr_key = fd->fd_file.id;
+	return 0;
+}
 
 // Synchronize disk with buffer cache
 int
@@ -188,6 +280,6 @@ sync(void)
 	// Ask the file server to update the disk
 	// by writing any dirty blocks in the buffer cache.
 
-	return fsipc(FSREQ_SYNC, NULL);
+	return fsipc_short(FSREQ_SYNC, 0, 0);
 }
 
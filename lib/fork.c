@@ -3,10 +3,6 @@
 #include <inc/string.h>
 #include <inc/lib.h>
 
-// PTE_COW marks copy-on-write page table entries.
-// It is one of the bits explicitly allocated to user processes (PTE_AVAIL).
-#define PTE_COW		0x800
-
 //
 // Custom page fault handler - if faulting page is copy-on-write,
 // map in our own private writable copy.
@@ -69,28 +65,20 @@ pgfault(struct UTrapframe *utf)
 static int
 duppage(envid_t envid, unsigned pn)
 {
-	int r;
-
 	// LAB 4: Your code here.
-	void *addr = (void *)(pn * PGSIZE);
+	// The mappings are only queued on the syscall ring; the caller
+	// runs them with sysring_flush.  The child's mapping is queued
+	// before ours is downgraded, and the ring runs them in order.
+	uint32_t addr = pn * PGSIZE;
 	pte_t pte = uvpt[pn];
 	if(((pte & PTE_W) || (pte & PTE_COW)) && !(pte & PTE_SHARE)){
-		r = sys_page_map(0, addr, envid, addr, PTE_COW | PTE_P | PTE_U);
-		if (r < 0){
-			panic("COW sys_page_map(%d) error in duppage() : %e\n", envid, r);
-		}
-		r = sys_page_map(0, addr, 0, addr, PTE_COW | PTE_P | PTE_U);
-		if (r < 0){
-			panic("COW sys_page_map(0) error in duppage() : %e\n", r);
-		}
+		sysring_push(SYS_page_map, 0, addr, envid, addr, PTE_COW | PTE_P | PTE_U);
+		sysring_push(SYS_page_map, 0, addr, 0, addr, PTE_COW | PTE_P | PTE_U);
 	}else{
 		if((pte & PTE_W) && (pte & PTE_SHARE)){
-			r = sys_page_map(0, addr, envid, addr, PTE_P | PTE_U | PTE_W | PTE_SHARE);
+			sysring_push(SYS_page_map, 0, addr, envid, addr, PTE_P | PTE_U | PTE_W | PTE_SHARE);
 		}else{
-			r = sys_page_map(0, addr, envid, addr, PTE_P | PTE_U);
-		}
-		if (r < 0){
-			panic("sys_page_map(%d) error in duppage() : %e\n", envid, r);
+			sysring_push(SYS_page_map, 0, addr, envid, addr, PTE_P | PTE_U);
 		}
 	}
 
@@ -98,6 +86,26 @@ duppage(envid_t envid, unsigned pn)
 	return 0;
 }
 
+//
+// Give the child envid our demand-paged regions (see lib/spawn.c),
+// so that the pages we have not touched yet are paged in for it
+// just as they would be for us.
+//
+static void
+copy_pager_regions(envid_t envid)
+{
+	struct PagerRegion pr;
+	int i, r;
+
+	for (i = 0; i < NPAGER; i++) {
+		pr = thisenv->env_pager[i];
+		if (!pr.pr_end)
+			continue;
+		if ((r = sys_env_set_pager(envid, &pr)) < 0)
+			panic("sys_env_set_pager() error in fork(): %e\n", r);
+	}
+}
+
 //
 // User-level fork with copy-on-write.
 // Set up our page fault handler appropriately.
@@ -136,9 +144,15 @@ fork(void)
 			uint32_t p = pde * NPDENTRIES + pte;
 			if(p * PGSIZE >= UXSTACKTOP - PGSIZE) break;
 			if(!(uvpt[p] & PTE_P)) continue;
+			if(p >= PGNUM(USYSRINGBOT) && p <= PGNUM(USYSRING)) continue;
 			duppage(envid, p);
 		}
 	}
+	r = sysring_flush();
+	if(r < 0){
+		panic("sys_page_map() error in duppage(): %e\n", r);
+	}
+	copy_pager_regions(envid);
 	
 	r = sys_page_alloc(envid, (void*)(UXSTACKTOP - PGSIZE), PTE_W | PTE_U | PTE_P);
 	if(r < 0){
@@ -158,6 +172,45 @@ fork(void)
 	//panic("fork not implemented");
 }
 
+//
+// Fork whose cost grows with the number of page tables, not pages.
+// Instead of marking each page copy-on-write, the kernel shares our
+// page tables with the child (see sys_env_share_pts), and a page table
+// is copied on the first write to its 4MB region by either env.  This
+// suits a parent with a large heap, such as the shell, whose child
+// touches little of it before it spawns or exits.
+//
+// Returns: child's envid to the parent, 0 to the child, < 0 on error.
+//
+envid_t
+lazyfork(void)
+{
+	extern void _pgfault_upcall(void);
+	envid_t envid;
+	int r;
+
+	set_pgfault_handler(pgfault);
+	if ((envid = sys_exofork()) < 0)
+		return envid;
+	if (envid == 0) {
+		return 0;
+	}
+
+	if ((r = sys_env_share_pts(envid)) < 0
+	    || (r = sys_page_alloc(envid, (void *) (UXSTACKTOP - PGSIZE),
+				   PTE_P | PTE_U | PTE_W)) < 0
+	    || (r = sys_env_set_pgfault_upcall(envid, _pgfault_upcall)) < 0)
+		goto error;
+	copy_pager_regions(envid);
+	if ((r = sys_env_set_status(envid, ENV_RUNNABLE)) < 0)
+		goto error;
+	return envid;
+
+error:
+	sys_env_destroy(envid);
+	return r;
+}
+
 // Challenge!
 
 static int 
@@ -184,12 +237,34 @@ sduppage(envid_t envid, unsigned pn)
 	return 0;
 }
 
+// Touch every page of our writable demand-paged regions that we do
+// not yet have a private writable copy of.  sfork shares only the
+// pages mapped when it runs, and a page paged in later would be
+// private to whichever env touched it.
+static void
+pager_prefault(void)
+{
+	struct PagerRegion pr;
+	volatile uint8_t *va;
+	int i;
+
+	for (i = 0; i < NPAGER; i++) {
+		pr = thisenv->env_pager[i];
+		if (!(pr.pr_perm & PTE_W))
+			continue;
+		for (va = (uint8_t *) pr.pr_va; va < (uint8_t *) pr.pr_end; va += PGSIZE)
+			if (!(uvpd[PDX(va)] & PTE_P) || !(uvpt[PGNUM(va)] & PTE_W))
+				*va = *va;
+	}
+}
+
 int
 sfork(void)
 {
 	// LAB 4: Your code here.
 	int r;
 	set_pgfault_handler(pgfault);
+	pager_prefault();
 	envid_t envid = sys_exofork();
 	if(envid < 0){
 		panic("sys_exofork() error in fork(): %e\n", envid);
@@ -215,7 +290,8 @@ sfork(void)
 				if(flag == 1) is_stack = 0;
 				continue;
 			}
-			if(!(uvpt[p] & PTE_P)){
+			if(!(uvpt[p] & PTE_P)
+			   || (p >= PGNUM(USYSRINGBOT) && p <= PGNUM(USYSRING))){
 				if(flag == 1) is_stack = 0;
 				continue;
 			}
@@ -227,6 +303,11 @@ sfork(void)
 			}
 		}
 	}
+	r = sysring_flush();
+	if(r < 0){
+		panic("sys_page_map() error in duppage(): %e\n", r);
+	}
+	copy_pager_regions(envid);
 	
 	r = sys_page_alloc(envid, (void*)(UXSTACKTOP - PGSIZE), PTE_W | PTE_U | PTE_P);
 	if(r < 0){
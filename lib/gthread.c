@@ -0,0 +1,295 @@
+// Green threads: user-level threads scheduled cooperatively.
+//
+// Each env, and each kernel thread of lib/thread.c, has its own
+// scheduler with a FIFO ready queue; its green threads never move to
+// another kernel thread, so M green threads run on N kernel threads
+// without locks on the queues.  A switch is gthread_switch saving and
+// restoring the callee-saved registers and ESP, with no system call.
+//
+// Library calls that would wait in the kernel call gthread_wait
+// instead, so the other green threads run while they wait: pipe and
+// console reads and writes, and IPC receives, which poll
+// env_ipc_sendq for a queued sender.  Only when every green thread is
+// waiting does one of them block or yield the env, and an IPC receive
+// blocks only if it is the sole green thread, as the others may be
+// waiting for something no IPC will bring.  read and write
+// are also preemption points: a thread that has run longer than the
+// quantum set with gthread_set_quantum yields there, as it does when
+// it calls gthread_preempt itself.  JOS has no timer upcall to user
+// space, so preemption only happens at these points.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+#include <inc/gthread.h>
+
+struct GSched {
+	envid_t s_env;			// Owner; any other env reinitializes
+	struct GThread s_main;		// The env's or kernel thread's own context
+	struct GThread *s_cur;		// Running green thread, or &s_main
+	struct GThread *s_head;		// Ready queue
+	struct GThread *s_tail;
+	uint32_t s_nready;		// Threads on the ready queue
+	uint32_t s_waitround;		// gthread_wait calls since one made progress
+	uint64_t s_quantum;		// Preemption quantum in TSC ticks, or 0
+	uint64_t s_start;		// TSC when s_cur was switched to
+};
+
+// [0] is the env's own scheduler, [i + 1] kernel thread i's.
+static struct GSched scheds[NTHREAD + 1];
+
+// Stack slot pool, shared by all kernel threads.
+static struct Mutex gpool_lock;
+static struct GThread *gpool_free;
+static uint32_t gpool_nslot;
+
+void gthread_switch(uint32_t *save_esp, uint32_t esp);
+
+#define GSLOT(i)	(GSTACKBASE + (i) * GSLOTSIZE)
+
+// The caller's scheduler, or NULL if it has no green threads.
+static struct GSched *
+gsched_self(void)
+{
+	struct Thread *t = thread_self();
+	struct GSched *s = &scheds[t ? thread_index(t) + 1 : 0];
+
+	return s->s_env == thisenv->env_id ? s : NULL;
+}
+
+static void
+gsched_enqueue(struct GSched *s, struct GThread *g)
+{
+	g->g_next = NULL;
+	if (s->s_tail)
+		s->s_tail->g_next = g;
+	else
+		s->s_head = g;
+	s->s_tail = g;
+	s->s_nready++;
+}
+
+// Switch to the first ready thread.  The running thread must already
+// be on the ready queue, blocked or dead.
+static void
+gsched_run_next(struct GSched *s)
+{
+	struct GThread *cur = s->s_cur, *next = s->s_head;
+
+	if (!next)
+		panic("gthread: every green thread is blocked");
+	if (!(s->s_head = next->g_next))
+		s->s_tail = NULL;
+	s->s_nready--;
+	if (!next->g_waiting)
+		s->s_waitround = 0;
+	s->s_start = read_tsc();
+	if (next == cur)
+		return;
+	s->s_cur = next;
+	gthread_switch(&cur->g_esp, next->g_esp);
+}
+
+// Take a stack slot from the pool, or map a new one.
+// Returns NULL if the region is full or out of memory.
+static struct GThread *
+gpool_get(void)
+{
+	struct GThread *g;
+	uintptr_t top;
+	int i;
+
+	mutex_lock(&gpool_lock);
+	if ((g = gpool_free) != NULL) {
+		gpool_free = g->g_next;
+		mutex_unlock(&gpool_lock);
+		return g;
+	}
+	if (gpool_nslot == NGSLOT) {
+		mutex_unlock(&gpool_lock);
+		return NULL;
+	}
+	top = GSLOT(gpool_nslot++) + GSLOTSIZE;
+	mutex_unlock(&gpool_lock);
+
+	for (i = 1; i <= GSTKPAGES; i++)
+		if (sys_page_alloc(0, (void *) (top - i * PGSIZE),
+				   PTE_P | PTE_U | PTE_W) < 0) {
+			while (--i > 0)
+				sys_page_unmap(0, (void *) (top - i * PGSIZE));
+			return NULL;
+		}
+	return (struct GThread *) top - 1;
+}
+
+static void
+gpool_put(struct GThread *g)
+{
+	mutex_lock(&gpool_lock);
+	g->g_next = gpool_free;
+	gpool_free = g;
+	mutex_unlock(&gpool_lock);
+}
+
+static void
+gthread_start(struct GThread *g)
+{
+	gthread_exit(g->g_func(g->g_arg));
+}
+
+// Create a green thread running func(arg) on the caller's scheduler,
+// behind the threads already ready, and store it in *gp.  It first
+// runs when the caller yields or waits.  Every green thread must be
+// joined, by a thread of the same scheduler, to free its stack.
+// Returns 0 on success, -E_NO_MEM if no stack can be had.
+int
+gthread_create(struct GThread **gp, void *(*func)(void *), void *arg)
+{
+	struct GSched *s;
+	struct GThread *g;
+	uint32_t *sp;
+
+	if (!(g = gpool_get()))
+		return -E_NO_MEM;
+	if (!(s = gsched_self())) {
+		s = &scheds[thread_self() ? thread_index(thread_self()) + 1 : 0];
+		memset(s, 0, sizeof(*s));
+		s->s_env = thisenv->env_id;
+		s->s_cur = &s->s_main;
+	}
+
+	memset(g, 0, sizeof(*g));
+	g->g_func = func;
+	g->g_arg = arg;
+	sp = (uint32_t *) g;
+	*--sp = (uint32_t) g;			// gthread_start's argument
+	*--sp = 0;				// and return address
+	*--sp = (uint32_t) gthread_start;	// gthread_switch returns here
+	sp -= 4;				// ebp, ebx, esi, edi
+	memset(sp, 0, 4 * sizeof(*sp));
+	g->g_esp = (uint32_t) sp;
+	gsched_enqueue(s, g);
+	*gp = g;
+	return 0;
+}
+
+// Let the other ready green threads run, then return.
+// Returns 1 if another thread ran, 0 if there was none.
+int
+gthread_yield(void)
+{
+	struct GSched *s = gsched_self();
+
+	if (!s || !s->s_head)
+		return 0;
+	gsched_enqueue(s, s->s_cur);
+	gsched_run_next(s);
+	return 1;
+}
+
+// Called by a green thread that is waiting for something outside the
+// scheduler, and will check for it again when this returns: let the
+// other ready threads run.  Returns 1 if they did, or 0 if there are
+// none, or every one of them has also waited since the last thread
+// that was not waiting ran.  On 0 the caller should wait in the
+// kernel, blocking or with sys_yield, since no thread in this env
+// can make progress.
+int
+gthread_wait(void)
+{
+	struct GSched *s = gsched_self();
+	struct GThread *cur;
+
+	if (!s || s->s_waitround++ >= s->s_nready) {
+		if (s)
+			s->s_waitround = 0;
+		return 0;
+	}
+	cur = s->s_cur;
+	cur->g_waiting = 1;
+	gsched_enqueue(s, cur);
+	gsched_run_next(s);
+	cur->g_waiting = 0;
+	return 1;
+}
+
+// Returns 1 if the caller's scheduler has no green thread other than
+// the running one, so nothing else would run while it blocks.
+int
+gthread_alone(void)
+{
+	struct GSched *s = gsched_self();
+
+	return !s || s->s_nready == 0;
+}
+
+// Yield if the running green thread has used up its quantum.
+void
+gthread_preempt(void)
+{
+	struct GSched *s = gsched_self();
+
+	if (s && s->s_quantum && read_tsc() - s->s_start >= s->s_quantum)
+		gthread_yield();
+}
+
+// Set the caller's scheduler's preemption quantum to 'ticks' TSC
+// ticks; 0, the default, turns preemption off.  The scheduler must
+// already have a green thread.
+void
+gthread_set_quantum(uint64_t ticks)
+{
+	struct GSched *s = gsched_self();
+
+	if (s)
+		s->s_quantum = ticks;
+}
+
+// Exit the running green thread with result 'ret'.
+void
+gthread_exit(void *ret)
+{
+	struct GSched *s = gsched_self();
+	struct GThread *cur;
+
+	if (!s || s->s_cur == &s->s_main)
+		panic("gthread_exit: not in a green thread");
+	cur = s->s_cur;
+	cur->g_ret = ret;
+	cur->g_state = GT_DEAD;
+	if (cur->g_joiner) {
+		cur->g_joiner->g_state = GT_READY;
+		gsched_enqueue(s, cur->g_joiner);
+	}
+	gsched_run_next(s);
+	panic("gthread_exit: dead thread resumed");
+}
+
+// Wait for green thread 'g' to exit, store its result in *ret if ret
+// is not NULL, and return its stack to the pool.
+void
+gthread_join(struct GThread *g, void **ret)
+{
+	struct GSched *s = gsched_self();
+	struct GThread *cur;
+
+	if (!s)
+		panic("gthread_join: no green threads");
+	cur = s->s_cur;
+	while (g->g_state != GT_DEAD) {
+		g->g_joiner = cur;
+		cur->g_state = GT_BLOCKED;
+		gsched_run_next(s);
+	}
+	if (ret)
+		*ret = g->g_ret;
+	gpool_put(g);
+}
+
+// The running green thread, or NULL outside green threads.
+struct GThread *
+gthread_self(void)
+{
+	struct GSched *s = gsched_self();
+
+	return s && s->s_cur != &s->s_main ? s->s_cur : NULL;
+}
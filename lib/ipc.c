@@ -2,6 +2,22 @@
 
 #include <inc/lib.h>
 
+// Let other green threads run until a sender is blocked on us in the
+// kernel, or until we are the only green thread left, so the caller
+// can block in the kernel.  If the others are all waiting too, they
+// may be polling a pipe or the console, so yield the env instead of
+// blocking it.
+static void
+ipc_wait_green(void)
+{
+	while (!thisenv->env_ipc_sendq)
+		if (!gthread_wait()) {
+			if (gthread_alone())
+				return;
+			sys_yield();
+		}
+}
+
 // Receive a value via IPC and return it.
 // If 'pg' is nonnull, then any page sent by the sender will be mapped at
 //	that address.
@@ -26,6 +42,7 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 	if(pg == NULL){
 		pg = (void *)UTOP;
 	}
+	ipc_wait_green();
 	int ret = sys_ipc_recv(pg);
 	if(ret < 0){
 		if(from_env_store != NULL){
@@ -47,12 +64,11 @@ ipc_recv(envid_t *from_env_store, void *pg, int *perm_store)
 }
 
 // Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'toenv'.
-// This function keeps trying until it succeeds.
-// It should panic() on any error other than -E_IPC_NOT_RECV.
+// This function blocks in the kernel until 'toenv' receives the message.
+// It panics on any error.
 //
 // Hint:
-//   Use sys_yield() to be CPU-friendly.
-//   If 'pg' is null, pass sys_ipc_try_send a value that it will understand
+//   If 'pg' is null, pass sys_ipc_send a value that it will understand
 //   as meaning "no page".  (Zero is not the right value.)
 void
 ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
@@ -61,18 +77,144 @@ ipc_send(envid_t to_env, uint32_t val, void *pg, int perm)
 	if(pg == NULL){
 		pg = (void *)UTOP;
 	}
-	int ret = sys_ipc_try_send(to_env, val, pg, perm);
-	while(ret < 0){
-		if(ret != -E_IPC_NOT_RECV){
-			panic("sys_ipc_try_send() error in ipc_send(): %e", ret);
-		}
-		sys_yield();
-		ret = sys_ipc_try_send(to_env, val, pg, perm);
+	int ret = sys_ipc_send(to_env, val, pg, perm);
+	if(ret < 0){
+		panic("sys_ipc_send() error in ipc_send(): %e", ret);
 	}
 
 //	panic("ipc_send not implemented");
 }
 
+// Send 'val' (and 'pg' with 'perm', if 'pg' is nonnull) to 'to_env' and
+// wait for its reply, in a single system call.  Any page in the reply is
+// mapped at 'rcv_pg', and its permission stored in *perm_store, as for
+// ipc_recv.  Returns the reply value, or < 0 on error.
+int32_t
+ipc_call(envid_t to_env, uint32_t val, void *pg, int perm, void *rcv_pg, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL)
+		pg = (void *) UTOP;
+	if (rcv_pg == NULL)
+		rcv_pg = (void *) UTOP;
+	if ((r = sys_ipc_call(to_env, val, pg, perm, rcv_pg)) < 0) {
+		if (perm_store)
+			*perm_store = 0;
+		return r;
+	}
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
+// Send 'val' and the pages of the 'nvec' ranges in 'vec' to 'to_env' in
+// one message, blocking until it is received.  With IPC_MOVE in 'flags'
+// the pages are unmapped here once delivered.  Panics on any error.
+void
+ipc_sendv(envid_t to_env, uint32_t val, const struct IpcVec *vec, int nvec, int flags)
+{
+	int r;
+
+	if ((r = sys_ipc_sendv(to_env, val, vec, nvec, flags)) < 0)
+		panic("sys_ipc_sendv() error in ipc_sendv(): %e", r);
+}
+
+// Receive a message and up to 'npages' pages, mapped one after another
+// starting at 'pg'.  The number of pages received is stored in
+// *npages_store and the sender in *from_env_store, if they are nonnull.
+// Returns the value sent, or < 0 on error.
+int32_t
+ipc_recvv(envid_t *from_env_store, void *pg, uint32_t npages, uint32_t *npages_store)
+{
+	int r;
+
+	ipc_wait_green();
+	if ((r = sys_ipc_recvv(pg, npages)) < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (npages_store)
+			*npages_store = 0;
+		return r;
+	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (npages_store)
+		*npages_store = thisenv->env_ipc_npages;
+	return thisenv->env_ipc_value;
+}
+
+// Receive as ipc_recv does, but only a message from 'from' (any env if
+// it is 0) whose value has 'tag' in the bits set in 'mask'.  Other
+// senders stay blocked in the kernel until a later receive takes them.
+// Returns the value sent, or < 0 on error; -E_BAD_ENV if 'from' exits
+// before sending.
+int32_t
+ipc_recvsel(envid_t from, uint32_t tag, uint32_t mask,
+	    envid_t *from_env_store, void *pg, int *perm_store)
+{
+	int r;
+
+	r = sys_ipc_recvsel(from, tag, mask, pg ? pg : (void *) UTOP, pg != NULL);
+	if (r < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		return r;
+	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
+// Send the IPC_NWORDS message words at 'words' to 'to_env' in registers
+// and wait for its reply.  No page is sent or received.  The receiver
+// sees words[0] as the value and all words in env_ipc_words.
+// Returns the reply value, or < 0 on error.
+int32_t
+ipc_callw(envid_t to_env, const uint32_t *words)
+{
+	int r;
+
+	if ((r = sys_ipc_callw(to_env, words)) < 0)
+		return r;
+	return thisenv->env_ipc_value;
+}
+
+// Reply 'val' (and 'pg' with 'perm') to 'to_env', unless it is 0, then
+// wait for the next message as ipc_recv does.  If 'to_env' is not
+// waiting in ipc_call, the reply is sent as by ipc_send, blocking
+// until to_env receives it.
+int32_t
+ipc_reply_wait(envid_t to_env, uint32_t val, void *pg, int perm,
+	       envid_t *from_env_store, void *rcv_pg, int *perm_store)
+{
+	int r;
+
+	if (pg == NULL)
+		pg = (void *) UTOP;
+	if (rcv_pg == NULL)
+		rcv_pg = (void *) UTOP;
+	r = sys_ipc_reply_wait(to_env, val, pg, perm, rcv_pg);
+	if (r == -E_IPC_NOT_RECV && (r = sys_ipc_send(to_env, val, pg, perm)) == 0)
+		r = sys_ipc_recv(rcv_pg);
+	if (r < 0) {
+		if (from_env_store)
+			*from_env_store = 0;
+		if (perm_store)
+			*perm_store = 0;
+		return r;
+	}
+	if (from_env_store)
+		*from_env_store = thisenv->env_ipc_from;
+	if (perm_store)
+		*perm_store = thisenv->env_ipc_perm;
+	return thisenv->env_ipc_value;
+}
+
 // Find the first environment of the given type.  We'll use this to
 // find special environments.
 // Returns 0 if no such environment exists.
@@ -0,0 +1,380 @@
+// Dynamic memory allocation.
+//
+// The heap is a range of virtual pages at MHEAPBASE; page_info records
+// what each page holds.  Requests up to MSMALL bytes are rounded up to
+// one of NCLASS size classes, and each small-object page holds objects
+// of a single class, so free finds the size from the page alone and
+// objects need no header.
+//
+// Each kernel thread (see lib/thread.c), and the env itself, has a
+// struct MCache of free lists, one per class, and a page per class to
+// bump-allocate from, so most mallocs and frees take no lock.  A cache
+// whose free list grows past MCACHE_MAX hands MCACHE_BATCH objects to
+// the central list of the class, from which caches that run dry refill
+// before they take a new page.  Small-object pages are never
+// unmapped.
+//
+// Larger requests get whole pages, which free gives back to the kernel
+// with MADV_DONTNEED.  The heap is a demand-zero region, so a run of
+// new pages is mapped with one sys_page_populate.
+//
+// Being demand-zero also means that touching a heap page that is not
+// allocated, or was freed, maps a zero page rather than faulting.  So
+// a use after free or a wild pointer into the heap reads zeros and
+// writes into a page nobody owns, instead of stopping the program.
+// This is deliberate: it lets pages be handed out without a system
+// call per page, at the cost of hiding those bugs.
+
+#include <inc/lib.h>
+
+#define MHEAPBASE	0x08000000
+#define MHEAPPAGES	32768		// 128MB, up to 0x10000000
+#define MSMALL		2048		// Largest small request
+#define NCLASS		24
+#define MCACHE_MAX	256		// Most free objects a cache keeps per class
+#define MCACHE_BATCH	128		// Objects moved to or from a central list
+
+// page_info values
+#define PI_FREE		0		// Not allocated to the heap
+#define PI_SMALL	0x10000000	// | size class
+#define PI_LARGE	0x20000000	// | number of pages, on the first page
+#define PI_TAIL		0x30000000	// Later pages of a large object
+#define PI_TYPE		0xF0000000
+
+static uint32_t page_info[MHEAPPAGES];
+static uint32_t page_rover;		// Where the next search for pages starts
+static bool heap_ready;			// heap_init has run
+
+#define PAGE2VA(i)	((char *) MHEAPBASE + (i) * PGSIZE)
+#define VA2PAGE(va)	(((uintptr_t) (va) - MHEAPBASE) / PGSIZE)
+
+// 16-byte steps to 128, then four classes per power of two.
+static const uint16_t class_size[NCLASS] = {
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256, 320, 384, 448, 512,
+	640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+static uint8_t size_class[MSMALL / 16 + 1];	// By (size + 15) / 16
+static bool size_class_ready;
+
+struct MCache {
+	void *mc_free[NCLASS];		// Free objects, linked through their first word
+	uint32_t mc_nfree[NCLASS];
+	char *mc_bump[NCLASS];		// Next never-used object
+	char *mc_end[NCLASS];		// End of the page mc_bump is in
+};
+
+// [0] is the env's own cache, [i + 1] kernel thread i's.
+static struct MCache caches[NTHREAD + 1];
+
+// Central lists and page_info, shared by all kernel threads.
+static struct Mutex malloc_lock;
+static void *central_free[NCLASS];
+static uint32_t central_nfree[NCLASS];
+
+static struct MCache *
+mcache_self(void)
+{
+	struct Thread *t = thread_self();
+
+	return &caches[t ? thread_index(t) + 1 : 0];
+}
+
+static void
+size_class_init(void)
+{
+	int c = 0, i;
+
+	for (i = 0; i <= MSMALL / 16; i++) {
+		while (class_size[c] < i * 16)
+			c++;
+		size_class[i] = c;
+	}
+	size_class_ready = 1;
+}
+
+// Reserve 'npages' free heap pages starting at a multiple of 'align'
+// pages and mark them with 'info'.  Returns the first page number,
+// or -1 if there is no such run or 'npages' is 0.  The caller holds
+// malloc_lock.
+static int
+page_reserve(uint32_t npages, uint32_t align, uint32_t info)
+{
+	uint32_t start, i, n, tries;
+
+	if (npages == 0)
+		return -1;
+	start = ROUNDUP(page_rover, align);
+	for (tries = 0; tries < 2; tries++) {
+		for (; start + npages <= MHEAPPAGES; start += align) {
+			for (n = 0; n < npages && page_info[start + n] == PI_FREE; n++)
+				;
+			if (n < npages)
+				continue;
+			page_info[start] = info;
+			for (i = 1; i < npages; i++)
+				page_info[start + i] = PI_TAIL;
+			page_rover = start + npages;
+			return start;
+		}
+		start = 0;
+	}
+	return -1;
+}
+
+// Make the heap a demand-zero region (see sys_env_set_pager), so that
+// sys_page_populate can map a run of heap pages in one call.  Threads
+// made before this, and envs out of regions, map pages one at a time.
+// The caller holds malloc_lock.
+static void
+heap_init(void)
+{
+	struct PagerRegion pr;
+
+	memset(&pr, 0, sizeof(pr));
+	pr.pr_va = pr.pr_fileend = MHEAPBASE;
+	pr.pr_end = MHEAPBASE + MHEAPPAGES * PGSIZE;
+	pr.pr_perm = PTE_P | PTE_U | PTE_W;
+	sys_env_set_pager(0, &pr);
+	heap_ready = 1;
+}
+
+// Map 'npages' zeroed pages at heap address 'va'.
+// Returns 0, or -E_NO_MEM with none of them mapped.
+static int
+page_map(char *va, uint32_t npages)
+{
+	uint32_t i;
+
+	if (sys_page_populate(0, va, npages * PGSIZE, POPULATE_WRITE) == npages)
+		return 0;
+	for (i = 0; i < npages; i++)
+		if (sys_page_alloc(0, va + i * PGSIZE, PTE_P | PTE_U | PTE_W) < 0) {
+			sys_madvise(0, va, npages * PGSIZE, MADV_DONTNEED);
+			return -E_NO_MEM;
+		}
+	return 0;
+}
+
+// Map 'npages' new heap pages, starting at a multiple of 'align'
+// pages, marked with 'info'.  Returns NULL if out of memory.
+static void *
+page_get(uint32_t npages, uint32_t align, uint32_t info)
+{
+	int p;
+	uint32_t i;
+
+	mutex_lock(&malloc_lock);
+	if (!heap_ready)
+		heap_init();
+	p = page_reserve(npages, align, info);
+	mutex_unlock(&malloc_lock);
+	if (p < 0)
+		return NULL;
+	if (page_map(PAGE2VA(p), npages) < 0) {
+		mutex_lock(&malloc_lock);
+		for (i = 0; i < npages; i++)
+			page_info[p + i] = PI_FREE;
+		mutex_unlock(&malloc_lock);
+		return NULL;
+	}
+	return PAGE2VA(p);
+}
+
+// Take up to MCACHE_BATCH objects of class 'c' from the central list
+// into 'mc', or a new page to bump-allocate from.
+// Returns 0, or -E_NO_MEM.
+static int
+mcache_refill(struct MCache *mc, int c)
+{
+	void *head, **tail;
+	uint32_t n;
+	char *pg;
+
+	mutex_lock(&malloc_lock);
+	if ((head = central_free[c]) != NULL) {
+		tail = &central_free[c];
+		for (n = 0; n < MCACHE_BATCH && *tail; n++)
+			tail = (void **) *tail;
+		central_free[c] = *tail;
+		central_nfree[c] -= n;
+		*tail = mc->mc_free[c];
+		mc->mc_free[c] = head;
+		mc->mc_nfree[c] += n;
+		mutex_unlock(&malloc_lock);
+		return 0;
+	}
+	mutex_unlock(&malloc_lock);
+
+	if (!(pg = page_get(1, 1, PI_SMALL | c)))
+		return -E_NO_MEM;
+	mc->mc_bump[c] = pg;
+	mc->mc_end[c] = pg + PGSIZE / class_size[c] * class_size[c];
+	return 0;
+}
+
+// Hand MCACHE_BATCH objects of class 'c' from 'mc' to the central list.
+static void
+mcache_drain(struct MCache *mc, int c)
+{
+	void *head = mc->mc_free[c], **tail = &mc->mc_free[c];
+	uint32_t n;
+
+	for (n = 0; n < MCACHE_BATCH; n++)
+		tail = (void **) *tail;
+	mc->mc_free[c] = *tail;
+	mc->mc_nfree[c] -= n;
+	mutex_lock(&malloc_lock);
+	*tail = central_free[c];
+	central_free[c] = head;
+	central_nfree[c] += n;
+	mutex_unlock(&malloc_lock);
+}
+
+static void *
+malloc_small(int c)
+{
+	struct MCache *mc = mcache_self();
+	void *v;
+
+	while (1) {
+		if ((v = mc->mc_free[c]) != NULL) {
+			mc->mc_free[c] = *(void **) v;
+			mc->mc_nfree[c]--;
+			return v;
+		}
+		if (mc->mc_bump[c] < mc->mc_end[c]) {
+			v = mc->mc_bump[c];
+			mc->mc_bump[c] += class_size[c];
+			return v;
+		}
+		if (mcache_refill(mc, c) < 0)
+			return NULL;
+	}
+}
+
+// Allocate 'n' bytes, aligned to 'align' bytes, a power of 2.
+static void *
+malloc_aligned(size_t n, size_t align)
+{
+	size_t want = MAX(n, align);
+	uint32_t npages;
+
+	if (!size_class_ready)
+		size_class_init();
+	// Objects of the power-of-2 classes are aligned to their size.
+	if (align > 16 && want <= MSMALL && (want & (want - 1)))
+		want = 1 << (32 - __builtin_clz(want));
+	if (want <= MSMALL)
+		return malloc_small(size_class[(want + 15) / 16]);
+
+	if (n > MHEAPPAGES * PGSIZE)
+		return NULL;
+	// A large alignment of 0 bytes still takes a page.
+	npages = MAX(ROUNDUP(n, PGSIZE) / PGSIZE, 1);
+	return page_get(npages, MAX(align / PGSIZE, 1), PI_LARGE | npages);
+}
+
+// Allocate 'n' bytes, aligned to 16.  Returns NULL if out of memory.
+void *
+malloc(size_t n)
+{
+	return malloc_aligned(n, 16);
+}
+
+// Free 'v', which malloc, calloc, realloc or memalign returned.
+// A NULL 'v' is ignored.
+void
+free(void *v)
+{
+	struct MCache *mc;
+	uint32_t p, info, i, c;
+
+	if (v == NULL)
+		return;
+	p = VA2PAGE(v);
+	if ((uintptr_t) v < MHEAPBASE || p >= MHEAPPAGES)
+		panic("free: %08x is not in the heap", v);
+	info = page_info[p];
+
+	if ((info & PI_TYPE) == PI_SMALL) {
+		c = info & ~PI_TYPE;
+		mc = mcache_self();
+		*(void **) v = mc->mc_free[c];
+		mc->mc_free[c] = v;
+		if (++mc->mc_nfree[c] > MCACHE_MAX)
+			mcache_drain(mc, c);
+		return;
+	}
+	if ((info & PI_TYPE) != PI_LARGE || (uintptr_t) v % PGSIZE)
+		panic("free: %08x was not allocated", v);
+	sys_madvise(0, v, (info & ~PI_TYPE) * PGSIZE, MADV_DONTNEED);
+	mutex_lock(&malloc_lock);
+	for (i = 0; i < (info & ~PI_TYPE); i++)
+		page_info[p + i] = PI_FREE;
+	mutex_unlock(&malloc_lock);
+}
+
+// Allocate zeroed space for 'nmemb' objects of 'size' bytes each.
+// Returns NULL if out of memory or the total overflows.
+void *
+calloc(size_t nmemb, size_t size)
+{
+	size_t n = nmemb * size;
+	void *v;
+
+	if (size && n / size != nmemb)
+		return NULL;
+	if (!(v = malloc(n)))
+		return NULL;
+	// Large objects are freshly mapped, so already zero.
+	if (n <= MSMALL)
+		memset(v, 0, n);
+	return v;
+}
+
+// The usable size of allocated block 'v'.
+static size_t
+malloc_size(void *v)
+{
+	uint32_t info = page_info[VA2PAGE(v)];
+
+	if ((info & PI_TYPE) == PI_SMALL)
+		return class_size[info & ~PI_TYPE];
+	return (info & ~PI_TYPE) * PGSIZE;
+}
+
+// Resize 'v' to 'n' bytes, moving it if it does not fit, and return
+// the new block.  realloc(NULL, n) is malloc(n); realloc(v, 0) frees
+// v and returns NULL.  If out of memory, returns NULL and leaves v.
+void *
+realloc(void *v, size_t n)
+{
+	size_t old;
+	void *nv;
+
+	if (v == NULL)
+		return malloc(n);
+	if (n == 0) {
+		free(v);
+		return NULL;
+	}
+	old = malloc_size(v);
+	if (n <= old && (old <= MSMALL || n > old - PGSIZE))
+		return v;
+	if (!(nv = malloc(n)))
+		return NULL;
+	memmove(nv, v, MIN(n, old));
+	free(v);
+	return nv;
+}
+
+// Allocate 'n' bytes aligned to 'align', which must be a power of 2.
+// Returns NULL if out of memory or 'align' is not a power of 2.
+void *
+memalign(size_t align, size_t n)
+{
+	if (align == 0 || (align & (align - 1)))
+		return NULL;
+	return malloc_aligned(n, MAX(align, 16));
+}
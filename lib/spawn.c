@@ -9,7 +9,10 @@
 static int init_stack(envid_t child, const char **argv, uintptr_t *init_esp);
 static int map_segment(envid_t child, uintptr_t va, size_t memsz,
 		       int fd, size_t filesz, off_t fileoffset, int perm);
-static int copy_shared_pages(envid_t child);
+static int copy_shared_pages(envid_t child, const int *fdmap);
+static int spawn_fdmap(const char *prog, const char **argv, const int *fdmap);
+static int file_actions_fdmap(const struct SpawnFileActions *fa, int *fdmap,
+			      int *opened, int *nopened);
 
 // Spawn a child process from a program image loaded from the file system.
 // prog: the pathname of the program to run.
@@ -18,6 +21,32 @@ static int copy_shared_pages(envid_t child);
 // Returns child envid on success, < 0 on failure.
 int
 spawn(const char *prog, const char **argv)
+{
+	return spawnfa(prog, argv, NULL);
+}
+
+// Spawn a child as spawn does, but first make the changes 'fa' lists,
+// if it is not NULL, to the child's copy of our file descriptors.
+// Files the actions open are opened here and closed again once the
+// child has its copy.
+int
+spawnfa(const char *prog, const char **argv, const struct SpawnFileActions *fa)
+{
+	int fdmap[MAXFD], opened[SPAWN_MAXACTIONS];
+	int i, nopened, r;
+
+	nopened = 0;
+	if ((r = file_actions_fdmap(fa, fdmap, opened, &nopened)) >= 0)
+		r = spawn_fdmap(prog, argv, fdmap);
+	for (i = 0; i < nopened; i++)
+		close(opened[i]);
+	return r;
+}
+
+// Spawn 'prog', giving the child as its descriptor i our descriptor
+// fdmap[i], or none if fdmap[i] < 0.
+static int
+spawn_fdmap(const char *prog, const char **argv, const int *fdmap)
 {
 	unsigned char elf_buf[512];
 	struct Trapframe child_tf;
@@ -126,8 +155,8 @@ spawn(const char *prog, const char **argv)
 	fd = -1;
 
 	// Copy shared library state.
-	if ((r = copy_shared_pages(child)) < 0)
-		panic("copy_shared_pages: %e", r);
+	if ((r = copy_shared_pages(child, fdmap)) < 0)
+		goto error;
 
 	child_tf.tf_eflags |= FL_IOPL_3;   // devious: see user/faultio.c
 	if ((r = sys_env_set_trapframe(child, &child_tf)) < 0)
@@ -264,6 +293,8 @@ static int
 map_segment(envid_t child, uintptr_t va, size_t memsz,
 	int fd, size_t filesz, off_t fileoffset, int perm)
 {
+	struct PagerRegion pr;
+	bool lazy;
 	int i, r;
 	void *blk;
 
@@ -276,11 +307,47 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 		fileoffset -= i;
 	}
 
+	// Leave whole file pages and whole bss pages for the kernel to
+	// map on first touch, from the file server and the zero page.
+	// Only a page holding both the end of the file data and the start
+	// of the bss is loaded now.  If the child cannot demand-page the
+	// segment, it is all loaded now.
+	lazy = fileoffset % PGSIZE == 0 && file_pager(fd, child, &pr) == 0;
+	if (lazy) {
+		pr.pr_va = va;
+		pr.pr_fileend = va + (filesz == memsz ? ROUNDUP(filesz, PGSIZE)
+				      : ROUNDDOWN(filesz, PGSIZE));
+		pr.pr_end = va + ROUNDUP(memsz, PGSIZE);
+		pr.pr_off = fileoffset;
+		pr.pr_perm = perm;
+		lazy = sys_env_set_pager(child, &pr) == 0;
+		// The bss is mostly touched from start to end, so have each
+		// fault there map the zero pages after it as well.  Only the
+		// bss gains: read-ahead never maps pages the file server
+		// has to supply, so the advice would do nothing over the
+		// file data.
+		if (lazy && pr.pr_fileend < pr.pr_end)
+			sys_madvise(child, (void *) pr.pr_fileend,
+				    pr.pr_end - pr.pr_fileend, MADV_SEQUENTIAL);
+	}
+
 	for (i = 0; i < memsz; i += PGSIZE) {
-		if (i >= filesz) {
+		if (lazy && (va + i < pr.pr_fileend || i >= filesz)) {
+			continue;
+		} else if (i >= filesz) {
 			// allocate a blank page
 			if ((r = sys_page_alloc(child, (void*) (va + i), perm)) < 0)
 				return r;
+		} else if (fileoffset % PGSIZE == 0
+			   && (i + PGSIZE <= filesz || filesz == memsz)) {
+			// Share the file server's block cache page: read-only
+			// for text, copy-on-write for data.  A page that ends
+			// in bss must be copied instead, to zero the bss.
+			if ((r = file_map(fd, fileoffset + i, UTEMP)) < 0)
+				return r;
+			if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i),
+					      (perm & PTE_W) ? PTE_P|PTE_U|PTE_COW : perm)) < 0)
+				panic("spawn: sys_page_map file page: %e", r);
 		} else {
 			// from file
 			if ((r = sys_page_alloc(0, UTEMP, PTE_P|PTE_U|PTE_W)) < 0)
@@ -291,17 +358,20 @@ map_segment(envid_t child, uintptr_t va, size_t memsz,
 				return r;
 			if ((r = sys_page_map(0, UTEMP, child, (void*) (va + i), perm)) < 0)
 				panic("spawn: sys_page_map data: %e", r);
-			sys_page_unmap(0, UTEMP);
 		}
 	}
+	sys_page_unmap(0, UTEMP);
 	return 0;
 }
 
 // Copy the mappings for shared pages into the child address space.
+// The file descriptor table is copied as 'fdmap' says instead.
 static int
-copy_shared_pages(envid_t child)
+copy_shared_pages(envid_t child, const int *fdmap)
 {
 	// LAB 5: Your code here.
+	int i, r;
+
 	for(pde_t pde = 0; pde < NPDENTRIES; pde ++){
 		if((pde << PDXSHIFT) >= UTOP) break;
 		if(!(uvpd[pde] & PTE_P)) continue;
@@ -309,11 +379,96 @@ copy_shared_pages(envid_t child)
 			uint32_t p = pde * NPDENTRIES + pte;
 			void *addr = (void *)(p * PGSIZE);
 			if((uint32_t)addr >= UTOP) break;
+			if((uint32_t)addr >= FDTABLE && (uint32_t)addr < FILEDATA + MAXFD*PGSIZE) continue;
 			if((uvpt[p] & PTE_U) && (uvpt[p] & PTE_P) && (uvpt[p] & PTE_SHARE)){
 				sys_page_map(0, addr, child, addr, uvpt[p] & PTE_SYSCALL);
 			}
 		}
 	}
+	for (i = 0; i < MAXFD; i++)
+		if (fdmap[i] >= 0 && (r = fd_map(fdmap[i], child, i)) < 0)
+			return r;
 	return 0;
 }
 
+// Work out which of our descriptors each of the child's should be
+// after the actions in 'fa': fdmap[i] for the child's descriptor i,
+// or -1 for none.  Files opened for SPAWN_OPEN are stored in 'opened'
+// and counted in '*nopened' for the caller to close.
+//
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_INVAL if an action duplicates a descriptor that is not open.
+//	Any error from open.
+static int
+file_actions_fdmap(const struct SpawnFileActions *fa, int *fdmap,
+		   int *opened, int *nopened)
+{
+	const struct SpawnAction *a;
+	struct Fd *fd;
+	int i, r;
+
+	for (i = 0; i < MAXFD; i++)
+		fdmap[i] = fd_lookup(i, &fd) < 0 ? -1 : i;
+	for (i = 0; fa && i < fa->sfa_n; i++) {
+		a = &fa->sfa_act[i];
+		switch (a->sa_op) {
+		case SPAWN_OPEN:
+			if ((r = open(a->sa_path, a->sa_mode)) < 0)
+				return r;
+			opened[(*nopened)++] = r;
+			fdmap[a->sa_fd] = r;
+			break;
+		case SPAWN_DUP2:
+			if (fdmap[a->sa_fd] < 0)
+				return -E_INVAL;
+			fdmap[a->sa_newfd] = fdmap[a->sa_fd];
+			break;
+		case SPAWN_CLOSE:
+			fdmap[a->sa_fd] = -1;
+			break;
+		}
+	}
+	return 0;
+}
+
+void
+spawn_file_actions_init(struct SpawnFileActions *fa)
+{
+	fa->sfa_n = 0;
+}
+
+static int
+file_actions_add(struct SpawnFileActions *fa, int op, int fd, int newfd,
+		 const char *path, int mode)
+{
+	if (fa->sfa_n == SPAWN_MAXACTIONS)
+		return -E_NO_MEM;
+	if (fd < 0 || fd >= MAXFD || newfd < 0 || newfd >= MAXFD)
+		return -E_INVAL;
+	fa->sfa_act[fa->sfa_n++] = (struct SpawnAction) { op, fd, newfd, path, mode };
+	return 0;
+}
+
+// Have spawnfa open 'path' with 'mode' as the child's descriptor 'fd'.
+// 'path' must stay valid until spawnfa is called.
+int
+spawn_file_actions_addopen(struct SpawnFileActions *fa, int fd,
+			   const char *path, int mode)
+{
+	return file_actions_add(fa, SPAWN_OPEN, fd, 0, path, mode);
+}
+
+// Have spawnfa make the child's descriptor 'newfd' a copy of its 'fd'.
+int
+spawn_file_actions_adddup2(struct SpawnFileActions *fa, int fd, int newfd)
+{
+	return file_actions_add(fa, SPAWN_DUP2, fd, newfd, NULL, 0);
+}
+
+// Have spawnfa close the child's descriptor 'fd'.
+int
+spawn_file_actions_addclose(struct SpawnFileActions *fa, int fd)
+{
+	return file_actions_add(fa, SPAWN_CLOSE, fd, 0, NULL, 0);
+}
+
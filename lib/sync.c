@@ -0,0 +1,91 @@
+// Mutexes, condition variables and semaphores that sleep in the
+// kernel with sys_futex_wait instead of spinning on sys_yield.
+// The mutex follows Drepper's "Futexes Are Tricky".
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+void
+mutex_lock(struct Mutex *m)
+{
+	uint32_t c;
+
+	if ((c = cmpxchg(&m->m_state, 0, 1)) == 0)
+		return;
+	// Mark the mutex contended, then sleep until we take it.
+	if (c != 2)
+		c = xchg(&m->m_state, 2);
+	while (c != 0) {
+		sys_futex_wait(&m->m_state, 2, 0);
+		c = xchg(&m->m_state, 2);
+	}
+}
+
+// Returns 0 if the mutex was taken, -E_AGAIN if it is held.
+int
+mutex_trylock(struct Mutex *m)
+{
+	return cmpxchg(&m->m_state, 0, 1) == 0 ? 0 : -E_AGAIN;
+}
+
+void
+mutex_unlock(struct Mutex *m)
+{
+	if (xchg(&m->m_state, 0) == 2)
+		sys_futex_wake(&m->m_state, 1);
+}
+
+// Release 'm', sleep until 'c' is signalled, and take 'm' again.
+// As usual, the caller must recheck its condition in a loop.
+void
+cond_wait(struct Cond *c, struct Mutex *m)
+{
+	uint32_t seq = c->c_seq;
+
+	mutex_unlock(m);
+	sys_futex_wait(&c->c_seq, seq, 0);
+	mutex_lock(m);
+}
+
+void
+cond_signal(struct Cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	sys_futex_wake(&c->c_seq, 1);
+}
+
+void
+cond_broadcast(struct Cond *c)
+{
+	atomic_add(&c->c_seq, 1);
+	sys_futex_wake(&c->c_seq, NENV);
+}
+
+void
+sem_wait(struct Sem *s)
+{
+	uint32_t v;
+
+	while (1) {
+		v = s->s_count;
+		if (v > 0) {
+			if (cmpxchg(&s->s_count, v, v - 1) == v)
+				return;
+			continue;
+		}
+		// Announce ourselves before sleeping, so that a sem_post
+		// that sees no waiters has already changed s_count and
+		// our futex wait returns at once.
+		atomic_add(&s->s_nwaiters, 1);
+		sys_futex_wait(&s->s_count, 0, 0);
+		atomic_add(&s->s_nwaiters, -1);
+	}
+}
+
+void
+sem_post(struct Sem *s)
+{
+	atomic_add(&s->s_count, 1);
+	if (s->s_nwaiters)
+		sys_futex_wake(&s->s_count, 1);
+}
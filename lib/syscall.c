@@ -105,15 +105,167 @@ sys_env_set_pgfault_upcall(envid_t envid, void *upcall)
 	return syscall(SYS_env_set_pgfault_upcall, 1, envid, (uint32_t) upcall, 0, 0, 0);
 }
 
+int
+sys_env_set_pager(envid_t envid, const struct PagerRegion *pr)
+{
+	return syscall(SYS_env_set_pager, 0, envid, (uint32_t) pr, 0, 0, 0);
+}
+
+envid_t
+sys_thread_create(void *entry, void *stack, void *arg, void *xstack, uint32_t *exitword)
+{
+	return syscall(SYS_thread_create, 0, (uint32_t) entry, (uint32_t) stack,
+		       (uint32_t) arg, (uint32_t) xstack, (uint32_t) exitword);
+}
+
+int
+sys_env_share_pts(envid_t envid)
+{
+	return syscall(SYS_env_share_pts, 0, envid, 0, 0, 0, 0);
+}
+
+int
+sys_page_populate(envid_t envid, void *va, size_t len, int flags)
+{
+	return syscall(SYS_page_populate, 0, envid, (uint32_t) va, len, flags, 0);
+}
+
+int
+sys_madvise(envid_t envid, void *va, size_t len, int advice)
+{
+	return syscall(SYS_madvise, 0, envid, (uint32_t) va, len, advice, 0);
+}
+
 int
 sys_ipc_try_send(envid_t envid, uint32_t value, void *srcva, int perm)
 {
 	return syscall(SYS_ipc_try_send, 0, envid, value, (uint32_t) srcva, perm, 0);
 }
 
+int
+sys_ipc_send(envid_t envid, uint32_t value, void *srcva, int perm)
+{
+	return syscall(SYS_ipc_send, 0, envid, value, (uint32_t) srcva, perm, 0);
+}
+
 int
 sys_ipc_recv(void *dstva)
 {
 	return syscall(SYS_ipc_recv, 1, (uint32_t)dstva, 0, 0, 0, 0);
 }
 
+int
+sys_ipc_sendv(envid_t envid, uint32_t value, const struct IpcVec *vec, int nvec, int flags)
+{
+	return syscall(SYS_ipc_sendv, 0, envid, value, (uint32_t) vec, nvec, flags);
+}
+
+int
+sys_ipc_recvv(void *dstva, uint32_t npages)
+{
+	return syscall(SYS_ipc_recvv, 1, (uint32_t) dstva, npages, 0, 0, 0);
+}
+
+int
+sys_ipc_call(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_call, 0, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
+// Enter the kernel through T_IPCCALL with the IPC_NWORDS words at
+// 'words' loaded into eax, ecx, ebx, edi, esi and ebp.  ebp is the
+// frame pointer, so it is saved around the trap by hand.
+int
+sys_ipc_callw(envid_t envid, const uint32_t *words)
+{
+	int32_t ret;
+
+	asm volatile("pushl %%ebp\n\t"
+		     "movl 4(%%eax), %%ecx\n\t"
+		     "movl 8(%%eax), %%ebx\n\t"
+		     "movl 12(%%eax), %%edi\n\t"
+		     "movl 16(%%eax), %%esi\n\t"
+		     "movl 20(%%eax), %%ebp\n\t"
+		     "movl 0(%%eax), %%eax\n\t"
+		     "int %2\n\t"
+		     "popl %%ebp\n"
+		     : "=a" (ret)
+		     : "0" (words),
+		       "i" (T_IPCCALL),
+		       "d" (envid)
+		     : "ecx", "ebx", "edi", "esi", "cc", "memory");
+	return ret;
+}
+
+int
+sys_ipc_reply_wait(envid_t envid, uint32_t value, void *srcva, int perm, void *dstva)
+{
+	return syscall(SYS_ipc_reply_wait, 0, envid, value, (uint32_t) srcva, perm, (uint32_t) dstva);
+}
+
+
+int
+sys_ring_setup(void *va)
+{
+	return syscall(SYS_ring_setup, 1, (uint32_t) va, 0, 0, 0, 0);
+}
+
+int
+sys_enter_ring(uint32_t n)
+{
+	return syscall(SYS_enter_ring, 0, n, 0, 0, 0, 0);
+}
+
+int
+sys_trace_ctl(envid_t envid, bool on)
+{
+	return syscall(SYS_trace_ctl, 1, envid, on, 0, 0, 0);
+}
+
+int
+sys_trace_read(struct TraceRec *buf, uint32_t n)
+{
+	return syscall(SYS_trace_read, 0, (uint32_t) buf, n, 0, 0, 0);
+}
+
+int
+sys_prof_ctl(bool on)
+{
+	return syscall(SYS_prof_ctl, 1, on, 0, 0, 0, 0);
+}
+
+int
+sys_prof_read(struct ProfSample *buf, uint32_t n)
+{
+	return syscall(SYS_prof_read, 0, (uint32_t) buf, n, 0, 0, 0);
+}
+
+int
+sys_futex_wait(volatile uint32_t *addr, uint32_t expected, uint32_t timeout)
+{
+	return syscall(SYS_futex_wait, 0, (uint32_t) addr, expected, timeout, 0, 0);
+}
+
+int
+sys_futex_wake(volatile uint32_t *addr, int n)
+{
+	return syscall(SYS_futex_wake, 0, (uint32_t) addr, n, 0, 0, 0);
+}
+
+int
+sys_ipc_recvsel(envid_t from, uint32_t tag, uint32_t mask, void *dstva, uint32_t npages)
+{
+	return syscall(SYS_ipc_recvsel, 0, from, tag, mask, (uint32_t) dstva, npages);
+}
+
+int
+sys_notify(envid_t envid, uint32_t bits)
+{
+	return syscall(SYS_notify, 0, envid, bits, 0, 0, 0);
+}
+
+int
+sys_notify_wait(uint32_t mask)
+{
+	return syscall(SYS_notify_wait, 0, mask, 0, 0, 0, 0);
+}
@@ -0,0 +1,126 @@
+// Batched system calls through a submission/completion ring
+// shared with the kernel.  See inc/sysring.h.
+
+#include <inc/lib.h>
+#include <inc/sysring.h>
+#include <inc/x86.h>
+
+// Each kernel thread submits through a ring of its own, since the
+// kernel runs queued calls as the env that enters the ring.  Slot 0
+// is the env that made the threads, slot i + 1 is thread slot i, and
+// a slot's ring page is 'slot' pages below USYSRING.
+//
+// A slot's state lives in its ring page, not in our data, which sfork
+// shares with the child: a ring is registered if its page is mapped,
+// since no fork copies the ring pages into the child, and its first
+// unreported error follows the ring in the page.
+struct RingPage {
+	struct SysRing rp_ring;		// Shared with the kernel
+	int rp_error;			// First error since the last flush
+};
+
+#define RING(slot)	((struct RingPage *) (USYSRING - (slot) * PGSIZE))
+
+// The calling kernel thread's slot.  Its stack pointer tells, unless
+// it is running a green thread, whose stack could be any thread's.
+static int
+ring_slot(void)
+{
+	uintptr_t esp = read_esp();
+	struct Thread *t;
+
+	if (esp >= THREADBASE && esp < THREADBASE + NTHREAD * TSLOTSIZE)
+		return (esp - THREADBASE) / TSLOTSIZE + 1;
+	if (esp >= GSTACKBASE && esp < THREADBASE) {
+		t = thread_self();
+		return t ? thread_index(t) + 1 : 0;
+	}
+	return 0;
+}
+
+static struct RingPage *
+sysring(int slot)
+{
+	struct RingPage *rp = RING(slot);
+	int r;
+
+	static_assert(sizeof(struct RingPage) <= PGSIZE);
+	if (!(uvpd[PDX(rp)] & PTE_P) || !(uvpt[PGNUM(rp)] & PTE_P))
+		if ((r = sys_ring_setup(rp)) < 0)
+			panic("sys_ring_setup: %e", r);
+	return rp;
+}
+
+// Consume all posted completions, remembering the first error.
+static void
+reap(struct RingPage *rp)
+{
+	struct SysRing *ring = &rp->rp_ring;
+	int32_t ret;
+
+	while (ring->sr_cq_head != ring->sr_cq_tail) {
+		ret = ring->sr_cq[ring->sr_cq_head % SYSRING_NCQE].cqe_ret;
+		if (ret < 0 && rp->rp_error == 0)
+			rp->rp_error = ret;
+		ring->sr_cq_head++;
+	}
+}
+
+// Have the kernel run everything queued so far.
+static void
+drain(struct RingPage *rp)
+{
+	struct SysRing *ring = &rp->rp_ring;
+	int r;
+
+	while (ring->sr_sq_head != ring->sr_sq_tail) {
+		if ((r = sys_enter_ring(ring->sr_sq_tail - ring->sr_sq_head)) < 0)
+			panic("sys_enter_ring: %e", r);
+		reap(rp);
+	}
+}
+
+// Forget the ring of kernel thread slot 'slot', whose thread is gone,
+// so the next thread in the slot registers a ring of its own.
+void
+sysring_release(int slot)
+{
+	sys_page_unmap(0, RING(slot));
+}
+
+// Queue a system call to be run by the next sysring_flush.
+// 'num' must be one of the calls sys_enter_ring accepts.
+// Flushes first if the submission ring is full.
+void
+sysring_push(int num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4, uint32_t a5)
+{
+	struct RingPage *rp = sysring(ring_slot());
+	struct SysRing *ring = &rp->rp_ring;
+	struct SysRingSqe *sqe;
+
+	if (ring->sr_sq_tail - ring->sr_sq_head >= SYSRING_NSQE)
+		drain(rp);
+	sqe = &ring->sr_sq[ring->sr_sq_tail % SYSRING_NSQE];
+	sqe->sqe_num = num;
+	sqe->sqe_args[0] = a1;
+	sqe->sqe_args[1] = a2;
+	sqe->sqe_args[2] = a3;
+	sqe->sqe_args[3] = a4;
+	sqe->sqe_args[4] = a5;
+	sqe->sqe_tag = ring->sr_sq_tail;
+	ring->sr_sq_tail++;
+}
+
+// Run all queued system calls.
+// Returns 0 if they all succeeded, otherwise the first error.
+int
+sysring_flush(void)
+{
+	struct RingPage *rp = sysring(ring_slot());
+	int r;
+
+	drain(rp);
+	r = rp->rp_error;
+	rp->rp_error = 0;
+	return r;
+}
@@ -0,0 +1,124 @@
+// Threads: environments that share one address space.
+//
+// thread_create takes a free slot, maps its stack and exception stack,
+// and starts the thread in thread_start with the slot's struct Thread
+// on its stack.  The kernel zeroes t_alive once the thread's env is
+// gone, so thread_join can sleep on it with a futex and then safely
+// unmap the stack the thread was running on.
+
+#include <inc/lib.h>
+#include <inc/thread.h>
+
+static struct Thread threads[NTHREAD];
+static struct Mutex thread_lock;
+
+#define SLOT(t)		(THREADBASE + ((t) - threads) * TSLOTSIZE)
+#define STACKBOT(t)	(SLOT(t) + TSLOTSIZE - (TSTKPAGES + 1) * PGSIZE)
+
+static void
+thread_start(struct Thread *t)
+{
+	thread_exit(t->t_func(t->t_arg));
+}
+
+// Unmap the stacks of thread slot 't' and free it.
+static void
+thread_free(struct Thread *t)
+{
+	int i;
+
+	sys_page_unmap(0, (void *) SLOT(t));
+	for (i = 0; i < TSTKPAGES; i++)
+		sys_page_unmap(0, (void *) (STACKBOT(t) + i * PGSIZE));
+	sysring_release(thread_index(t) + 1);
+	mutex_lock(&thread_lock);
+	t->t_used = 0;
+	mutex_unlock(&thread_lock);
+}
+
+// Start a thread running func(arg), and store it in *tp.
+// Returns 0 on success, < 0 on error.  Errors are:
+//	-E_NO_FREE_ENV if all NTHREAD slots, or all envs, are in use.
+//	-E_NO_MEM if the stacks cannot be allocated.
+int
+thread_create(struct Thread **tp, void *(*func)(void *), void *arg)
+{
+	struct Thread *t;
+	uintptr_t *sp;
+	int i, r;
+
+	mutex_lock(&thread_lock);
+	for (t = threads; t < threads + NTHREAD && t->t_used; t++)
+		;
+	if (t < threads + NTHREAD)
+		t->t_used = 1;
+	mutex_unlock(&thread_lock);
+	if (t == threads + NTHREAD)
+		return -E_NO_FREE_ENV;
+
+	if ((r = sys_page_alloc(0, (void *) SLOT(t), PTE_P | PTE_U | PTE_W)) < 0)
+		goto error;
+	for (i = 0; i < TSTKPAGES; i++)
+		if ((r = sys_page_alloc(0, (void *) (STACKBOT(t) + i * PGSIZE),
+					PTE_P | PTE_U | PTE_W)) < 0)
+			goto error;
+
+	t->t_func = func;
+	t->t_arg = arg;
+	t->t_ret = NULL;
+	t->t_alive = 1;
+	sp = (uintptr_t *) (STACKBOT(t) + TSTKPAGES * PGSIZE);
+	*--sp = (uintptr_t) t;		// thread_start's argument
+	*--sp = 0;			// and return address
+	if ((r = sys_thread_create((void *) thread_start, sp, t, (void *) SLOT(t),
+				   (uint32_t *) &t->t_alive)) < 0)
+		goto error;
+	t->t_env = r;
+	*tp = t;
+	return 0;
+
+error:
+	thread_free(t);
+	return r;
+}
+
+// Wait for thread 't' to exit, store its result in *ret if ret is
+// not NULL, and free its slot.
+void
+thread_join(struct Thread *t, void **ret)
+{
+	uint32_t alive;
+
+	while ((alive = t->t_alive) != 0)
+		sys_futex_wait((uint32_t *) &t->t_alive, alive, 0);
+	if (ret)
+		*ret = t->t_ret;
+	thread_free(t);
+}
+
+// Exit the calling thread with result 'ret'.  Unlike exit, this
+// leaves the file descriptors, which all threads share, open.
+void
+thread_exit(void *ret)
+{
+	struct Thread *t = thread_self();
+
+	if (t)
+		t->t_ret = ret;
+	sys_env_destroy(0);
+	panic("thread_exit: still running");
+}
+
+// The slot number of thread 't', from 0 to NTHREAD - 1.
+int
+thread_index(struct Thread *t)
+{
+	return t - threads;
+}
+
+// The calling thread, or NULL in the env that created the threads.
+struct Thread *
+thread_self(void)
+{
+	return (struct Thread *) thisenv->env_tls;
+}
@@ -5,9 +5,11 @@ void
 wait(envid_t envid)
 {
 	const volatile struct Env *e;
+	unsigned status;
 
 	assert(envid != 0);
 	e = &envs[ENVX(envid)];
-	while (e->env_id == envid && e->env_status != ENV_FREE)
-		sys_yield();
+	// The kernel wakes futex waiters on env_status when it frees the env.
+	while (e->env_id == envid && (status = e->env_status) != ENV_FREE)
+		sys_futex_wait((volatile uint32_t *) &e->env_status, status, 0);
 }
@@ -0,0 +1,211 @@
+// Microbenchmarks for system calls, IPC, context switches, memory
+// mapping, fork, spawn and copy-on-write faults.  Each result is
+// printed as one line,
+//	BENCH <name> <value> <unit>
+// which ./benchmark (make bench) collects.  All times are in TSC
+// ticks per operation.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NITER	1000	// Iterations of the cheap benchmarks
+#define NPAGE	256	// Pages for page_alloc/map/unmap
+#define NCOW	64	// Pages written after fork
+#define NPROC	20	// forks and spawns
+
+#define BUF	((char *) 0x10000000)
+#define BUF2	((char *) 0x10400000)
+#define SRCPG	((char *) 0x20000000)
+#define DSTPG	((char *) 0x20001000)
+
+static void
+report(const char *name, uint64_t ticks, int n)
+{
+	cprintf("BENCH %s %llu ticks\n", name, ticks / n);
+}
+
+static envid_t
+fork_or_die(void)
+{
+	envid_t env;
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	return env;
+}
+
+static void
+bench_null(void)
+{
+	uint64_t start = read_tsc();
+	int i;
+
+	for (i = 0; i < NITER; i++)
+		sys_getenvid();
+	report("null_syscall", read_tsc() - start, NITER);
+}
+
+// NITER messages one way; the receiver acknowledges only the last.
+static void
+bench_oneway(const char *name, bool page)
+{
+	uint64_t start;
+	envid_t env;
+	int i;
+
+	if ((env = fork_or_die()) == 0) {
+		for (i = 0; i < NITER; i++)
+			ipc_recv(0, page ? DSTPG : 0, 0);
+		ipc_send(thisenv->env_parent_id, 0, 0, 0);
+		exit();
+	}
+	start = read_tsc();
+	for (i = 0; i < NITER; i++)
+		ipc_send(env, i, page ? SRCPG : 0, PTE_P | PTE_U);
+	ipc_recv(0, 0, 0);
+	report(name, read_tsc() - start, NITER);
+	wait(env);
+}
+
+// NITER calls to an echo server.
+static void
+bench_roundtrip(const char *name, bool page)
+{
+	uint64_t start;
+	envid_t env, who = 0;
+	uint32_t v = 0;
+	int i;
+
+	if ((env = fork_or_die()) == 0)
+		while (1)
+			v = ipc_reply_wait(who, v, 0, 0, &who, page ? DSTPG : 0, 0);
+	start = read_tsc();
+	for (i = 0; i < NITER; i++)
+		if (ipc_call(env, i, page ? SRCPG : 0, PTE_P | PTE_U, 0, 0) != i)
+			panic("%s: bad reply", name);
+	report(name, read_tsc() - start, NITER);
+	sys_env_destroy(env);
+}
+
+// Switch to a child that only yields, and back, NITER times.
+static void
+bench_yield(void)
+{
+	uint64_t start;
+	envid_t env;
+	int i;
+
+	if ((env = fork_or_die()) == 0)
+		while (1)
+			sys_yield();
+	sys_yield();
+	start = read_tsc();
+	for (i = 0; i < NITER; i++)
+		sys_yield();
+	report("yield_pingpong", read_tsc() - start, NITER);
+	sys_env_destroy(env);
+}
+
+static void
+bench_pages(void)
+{
+	uint64_t start;
+	int i, r;
+
+	start = read_tsc();
+	for (i = 0; i < NPAGE; i++)
+		if ((r = sys_page_alloc(0, BUF + i * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+	report("page_alloc", read_tsc() - start, NPAGE);
+
+	start = read_tsc();
+	for (i = 0; i < NPAGE; i++)
+		if ((r = sys_page_map(0, BUF + i * PGSIZE, 0, BUF2 + i * PGSIZE,
+				      PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_map: %e", r);
+	report("page_map", read_tsc() - start, NPAGE);
+
+	start = read_tsc();
+	for (i = 0; i < NPAGE; i++)
+		sys_page_unmap(0, BUF2 + i * PGSIZE);
+	report("page_unmap", read_tsc() - start, NPAGE);
+
+	for (i = 0; i < NPAGE; i++)
+		sys_page_unmap(0, BUF + i * PGSIZE);
+}
+
+// Write NCOW pages that fork has made copy-on-write.
+static void
+bench_cow(void)
+{
+	uint64_t start;
+	envid_t env;
+	int i, r;
+
+	for (i = 0; i < NCOW; i++) {
+		if ((r = sys_page_alloc(0, BUF + i * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		BUF[i * PGSIZE] = 0;
+	}
+	if ((env = fork_or_die()) == 0) {
+		ipc_recv(0, 0, 0);
+		exit();
+	}
+	start = read_tsc();
+	for (i = 0; i < NCOW; i++)
+		BUF[i * PGSIZE] = 1;
+	report("cow_fault", read_tsc() - start, NCOW);
+	ipc_send(env, 0, 0, 0);
+	wait(env);
+	for (i = 0; i < NCOW; i++)
+		sys_page_unmap(0, BUF + i * PGSIZE);
+}
+
+// From creating a child to reaping it, for a child that exits at once.
+static void
+bench_procs(void)
+{
+	uint64_t start;
+	envid_t env;
+	int i;
+
+	start = read_tsc();
+	for (i = 0; i < NPROC; i++) {
+		if ((env = fork_or_die()) == 0)
+			exit();
+		wait(env);
+	}
+	report("fork", read_tsc() - start, NPROC);
+
+	start = read_tsc();
+	for (i = 0; i < NPROC; i++) {
+		if ((env = spawnl("/bench", "bench", "-exit", (char *) 0)) < 0)
+			panic("spawn /bench: %e", env);
+		wait(env);
+	}
+	report("spawn", read_tsc() - start, NPROC);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r;
+
+	// The child spawned by bench_procs.
+	if (argc > 1 && strcmp(argv[1], "-exit") == 0)
+		return;
+
+	if ((r = sys_page_alloc(0, SRCPG, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	bench_null();
+	bench_oneway("ipc_oneway", 0);
+	bench_oneway("ipc_oneway_page", 1);
+	bench_roundtrip("ipc_roundtrip", 0);
+	bench_roundtrip("ipc_roundtrip_page", 1);
+	bench_yield();
+	bench_pages();
+	bench_cow();
+	bench_procs();
+	cprintf("BENCH done\n");
+}
@@ -0,0 +1,90 @@
+// Stream NMSG records from a parent to a forked child, first over a
+// shared-memory channel and then one ipc_send per record, and compare.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NMSG	20000
+#define RECSZ	32
+
+static struct Chan *chan = (struct Chan *) 0x10000000;
+
+static void
+chan_consumer(void)
+{
+	uint32_t buf[RECSZ / 4], sum = 0;
+	int n, r;
+
+	for (n = 0; (r = chan_recv(chan, buf, sizeof(buf))) > 0; n++) {
+		if (r != 4 + n % (RECSZ - 4) || buf[0] != n)
+			panic("record %d: length %d, value %d", n, r, buf[0]);
+		sum += buf[0];
+	}
+	if (r < 0)
+		panic("chan_recv: %e", r);
+	if (n != NMSG)
+		panic("got %d records, want %d", n, NMSG);
+	ipc_send(thisenv->env_parent_id, sum, 0, 0);
+}
+
+static void
+ipc_consumer(void)
+{
+	uint32_t sum = 0;
+	int n;
+
+	for (n = 0; n < NMSG; n++)
+		sum += ipc_recv(0, 0, 0);
+	ipc_send(thisenv->env_parent_id, sum, 0, 0);
+}
+
+static void
+run(const char *name, bool usechan)
+{
+	uint32_t buf[RECSZ / 4] = { 0 }, sum;
+	uint64_t start, ticks;
+	envid_t env;
+	int n, r;
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		if (usechan)
+			chan_consumer();
+		else
+			ipc_consumer();
+		exit();
+	}
+
+	start = read_tsc();
+	for (n = 0; n < NMSG; n++) {
+		if (usechan) {
+			buf[0] = n;
+			if ((r = chan_send(chan, buf, 4 + n % (RECSZ - 4))) < 0)
+				panic("chan_send: %e", r);
+		} else
+			ipc_send(env, n, 0, 0);
+	}
+	if (usechan)
+		chan_close(chan);
+	sum = ipc_recv(0, 0, 0);
+	ticks = read_tsc() - start;
+
+	if (sum != (uint32_t) NMSG * (NMSG - 1) / 2)
+		panic("%s: got sum %u", name, sum);
+	cprintf("chanbench: %s: %d msgs: %llu ticks, %llu per msg\n",
+		name, NMSG, ticks, ticks / NMSG);
+	wait(env);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int r;
+
+	if ((r = chan_create(chan, 4 * PGSIZE)) < 0)
+		panic("chan_create: %e", r);
+	run("chan", 1);
+	run("ipc_send", 0);
+	cprintf("chanbench: done\n");
+}
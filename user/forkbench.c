@@ -0,0 +1,91 @@
+// Time fork and lazyfork from an env with a large heap, then check
+// that lazyfork keeps parent and child memory apart, except for
+// PTE_SHARE pages, across several 4MB regions and a second fork.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define HEAP		((volatile char *) 0x10000000)
+#define NPAGES		2048		// 8MB, two page tables
+#define SHARED		((volatile char *) 0x0F000000)
+
+static void
+fill(void)
+{
+	int i, r;
+
+	for (i = 0; i < NPAGES; i++) {
+		if ((r = sys_page_alloc(0, (void *) (HEAP + i * PGSIZE),
+					PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		HEAP[i * PGSIZE] = 'p';
+	}
+}
+
+static void
+bench(const char *name, envid_t (*forkfn)(void))
+{
+	uint64_t start, ticks;
+	envid_t env;
+
+	start = read_tsc();
+	if ((env = forkfn()) < 0)
+		panic("%s: %e", name, env);
+	if (env == 0)
+		exit();
+	ticks = read_tsc() - start;
+	wait(env);
+	cprintf("forkbench: %s: %llu ticks\n", name, ticks);
+}
+
+static void
+child(void)
+{
+	envid_t env;
+
+	if (HEAP[0] != 'p' || HEAP[(NPAGES - 1) * PGSIZE] != 'p')
+		panic("child does not see the parent's heap");
+	HEAP[0] = 'c';
+	HEAP[(NPAGES - 1) * PGSIZE] = 'c';
+	*SHARED = 'c';
+
+	// A grandchild shares the child's tables in turn.
+	if ((env = lazyfork()) < 0)
+		panic("lazyfork: %e", env);
+	if (env == 0) {
+		if (HEAP[0] != 'c')
+			panic("grandchild does not see the child's heap");
+		HEAP[0] = 'g';
+		exit();
+	}
+	wait(env);
+	if (HEAP[0] != 'c')
+		panic("grandchild's write reached the child");
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t env;
+	int r;
+
+	fill();
+	bench("fork", fork);
+	bench("lazyfork", lazyfork);
+
+	if ((r = sys_page_alloc(0, (void *) SHARED, PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+	*SHARED = 'p';
+	if ((env = lazyfork()) < 0)
+		panic("lazyfork: %e", env);
+	if (env == 0) {
+		child();
+		exit();
+	}
+	wait(env);
+	if (HEAP[0] != 'p' || HEAP[(NPAGES - 1) * PGSIZE] != 'p')
+		panic("child's write reached the parent");
+	if (*SHARED != 'c')
+		panic("child's write to a PTE_SHARE page did not reach the parent");
+	cprintf("forkbench: lazyfork is good\n");
+}
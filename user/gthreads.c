@@ -0,0 +1,218 @@
+// Green threads: time a switch between two green threads against an
+// IPC round trip between two envs, then check that green threads in
+// one env can talk over a pipe and wait for IPC without blocking each
+// other, or a thread reading a pipe from another env, that the quantum
+// preempts a spinning thread, and that a kernel thread can run green
+// threads of its own.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NSWITCH	1000000
+#define NROUND	10000
+#define NBYTES	1000
+
+static volatile uint32_t flag;
+
+static void *
+yielder(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NSWITCH / 2; i++)
+		gthread_yield();
+	return arg;
+}
+
+static void *
+pipe_writer(void *arg)
+{
+	int *p = arg, i, r;
+	char c;
+
+	for (i = 0; i < NBYTES; i++) {
+		c = i;
+		if ((r = write(p[1], &c, 1)) != 1)
+			panic("pipe write: %e", r);
+	}
+	close(p[1]);
+	return NULL;
+}
+
+static void *
+pipe_reader(void *arg)
+{
+	int *p = arg, n = 0, r;
+	char c;
+
+	while ((r = read(p[0], &c, 1)) == 1) {
+		if (c != (char) n)
+			panic("pipe read %d at %d", c, n);
+		n++;
+	}
+	return (void *) n;
+}
+
+static void *
+receiver(void *arg)
+{
+	return (void *) ipc_recv(NULL, NULL, NULL);
+}
+
+static void *
+counter(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 100; i++)
+		gthread_yield();
+	return (void *) i;
+}
+
+static void *
+spinner(void *arg)
+{
+	while (!flag)
+		gthread_preempt();
+	return NULL;
+}
+
+static void *
+setter(void *arg)
+{
+	flag = 1;
+	return NULL;
+}
+
+static void *
+kthread(void *arg)
+{
+	struct GThread *g[2];
+	void *ret;
+	int i, sum = 0;
+
+	for (i = 0; i < 2; i++)
+		if (gthread_create(&g[i], counter, NULL) < 0)
+			panic("gthread_create in a kernel thread");
+	for (i = 0; i < 2; i++) {
+		gthread_join(g[i], &ret);
+		sum += (int) ret;
+	}
+	return (void *) sum;
+}
+
+static void
+bench(void)
+{
+	struct GThread *g[2];
+	uint64_t start, ticks;
+	envid_t echo;
+	int i, r;
+
+	for (i = 0; i < 2; i++)
+		if ((r = gthread_create(&g[i], yielder, NULL)) < 0)
+			panic("gthread_create: %e", r);
+	start = read_tsc();
+	for (i = 0; i < 2; i++)
+		gthread_join(g[i], NULL);
+	ticks = read_tsc() - start;
+	cprintf("gthreads: green switch: %llu ticks\n", ticks / NSWITCH);
+
+	if ((echo = fork()) < 0)
+		panic("fork: %e", echo);
+	if (echo == 0)
+		while (1)
+			ipc_send(thisenv->env_parent_id, ipc_recv(NULL, NULL, NULL), 0, 0);
+	start = read_tsc();
+	for (i = 0; i < NROUND; i++) {
+		ipc_send(echo, i, 0, 0);
+		ipc_recv(NULL, NULL, NULL);
+	}
+	ticks = read_tsc() - start;
+	cprintf("gthreads: env switch by ipc: %llu ticks\n", ticks / (2 * NROUND));
+	sys_env_destroy(echo);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct GThread *g[2];
+	struct Thread *t;
+	envid_t env;
+	void *ret;
+	int p[2], r;
+
+	bench();
+
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((r = gthread_create(&g[0], pipe_reader, p)) < 0
+	    || (r = gthread_create(&g[1], pipe_writer, p)) < 0)
+		panic("gthread_create: %e", r);
+	gthread_join(g[1], NULL);
+	gthread_join(g[0], &ret);
+	close(p[0]);
+	if ((int) ret != NBYTES)
+		panic("pipe reader got %d bytes, want %d", ret, NBYTES);
+	cprintf("gthreads: pipe between green threads is good\n");
+
+	if ((r = gthread_create(&g[0], receiver, NULL)) < 0
+	    || (r = gthread_create(&g[1], counter, NULL)) < 0)
+		panic("gthread_create: %e", r);
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		ipc_send(thisenv->env_parent_id, 42, 0, 0);
+		return;
+	}
+	gthread_join(g[1], &ret);
+	if ((int) ret != 100)
+		panic("counter stopped at %d", ret);
+	gthread_join(g[0], &ret);
+	if ((int) ret != 42)
+		panic("receiver got %d", ret);
+	wait(env);
+	cprintf("gthreads: ipc wait is good\n");
+
+	// The child fills the pipe before it sends, so the receiver must
+	// not block the env while the reader waits for the pipe.
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		close(p[0]);
+		pipe_writer(p);
+		ipc_send(thisenv->env_parent_id, 42, 0, 0);
+		return;
+	}
+	close(p[1]);
+	if ((r = gthread_create(&g[0], receiver, NULL)) < 0
+	    || (r = gthread_create(&g[1], pipe_reader, p)) < 0)
+		panic("gthread_create: %e", r);
+	gthread_join(g[1], &ret);
+	close(p[0]);
+	if ((int) ret != NBYTES)
+		panic("pipe reader got %d bytes, want %d", ret, NBYTES);
+	gthread_join(g[0], &ret);
+	if ((int) ret != 42)
+		panic("receiver got %d", ret);
+	wait(env);
+	cprintf("gthreads: ipc wait beside a pipe is good\n");
+
+	if ((r = gthread_create(&g[0], spinner, NULL)) < 0
+	    || (r = gthread_create(&g[1], setter, NULL)) < 0)
+		panic("gthread_create: %e", r);
+	gthread_set_quantum(100000);
+	gthread_join(g[0], NULL);
+	gthread_join(g[1], NULL);
+	gthread_set_quantum(0);
+	cprintf("gthreads: preemption is good\n");
+
+	if ((r = thread_create(&t, kthread, NULL)) < 0)
+		panic("thread_create: %e", r);
+	thread_join(t, &ret);
+	if ((int) ret != 200)
+		panic("kernel thread's green threads counted %d", ret);
+	cprintf("gthreads: done\n");
+}
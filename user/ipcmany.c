@@ -0,0 +1,68 @@
+// Many clients, one server: NCLIENT children each send NMSG values to
+// the parent, first by spinning on sys_ipc_try_send and sys_yield, then
+// with the blocking sys_ipc_send.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NCLIENT	8
+#define NMSG	200
+
+static void
+spin_send(envid_t to_env, uint32_t val)
+{
+	int r;
+
+	while ((r = sys_ipc_try_send(to_env, val, (void *) UTOP, 0)) == -E_IPC_NOT_RECV)
+		sys_yield();
+	if (r < 0)
+		panic("sys_ipc_try_send: %e", r);
+}
+
+static void
+run(const char *name, bool blocking)
+{
+	envid_t server = sys_getenvid(), clients[NCLIENT], who;
+	uint64_t start, ticks;
+	uint32_t sum = 0;
+	int i, n;
+
+	for (i = 0; i < NCLIENT; i++) {
+		if ((who = fork()) < 0)
+			panic("fork: %e", who);
+		if (who == 0) {
+			// wait for the start signal
+			ipc_recv(0, 0, 0);
+			for (n = 0; n < NMSG; n++)
+				if (blocking)
+					ipc_send(server, n, 0, 0);
+				else
+					spin_send(server, n);
+			exit();
+		}
+		clients[i] = who;
+	}
+
+	start = read_tsc();
+	for (i = 0; i < NCLIENT; i++)
+		ipc_send(clients[i], 0, 0, 0);
+	for (n = 0; n < NCLIENT * NMSG; n++)
+		sum += ipc_recv(&who, 0, 0);
+	ticks = read_tsc() - start;
+
+	if (sum != NCLIENT * (NMSG * (NMSG - 1) / 2))
+		panic("%s: got sum %u", name, sum);
+	cprintf("ipcmany: %s: %d clients x %d msgs: %llu ticks, %llu per msg\n",
+		name, NCLIENT, NMSG, ticks, ticks / (NCLIENT * NMSG));
+
+	for (i = 0; i < NCLIENT; i++)
+		wait(clients[i]);
+}
+
+void
+umain(int argc, char **argv)
+{
+	run("spin", 0);
+	run("blocking", 1);
+	cprintf("ipcmany: done\n");
+}
@@ -0,0 +1,153 @@
+// Check malloc, calloc, realloc and memalign, then measure malloc and
+// free throughput in one env and in four kernel threads at once, and
+// how much heap memory is mapped for the bytes live after a mix of
+// allocations and frees.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define HEAPBASE	0x08000000	// lib/malloc.c's MHEAPBASE
+#define HEAPEND		0x10000000
+#define NSLOT		256
+#define NOPS		100000
+#define NFRAG		20000
+#define NTHR		4
+
+static uint32_t
+rand(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 8;
+}
+
+static bool
+mapped(void *va)
+{
+	return (uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P);
+}
+
+static void
+check(void)
+{
+	char *a, *b;
+	int i;
+
+	a = malloc(100);
+	memset(a, 0xAA, 100);
+	free(a);
+	a = calloc(25, 4);
+	for (i = 0; i < 100; i++)
+		if (a[i])
+			panic("calloc byte %d is %02x", i, a[i]);
+	for (i = 0; i < 100; i++)
+		a[i] = i;
+	a = realloc(a, 5000);
+	for (i = 0; i < 100; i++)
+		if (a[i] != i)
+			panic("realloc lost byte %d", i);
+	free(a);
+
+	if ((uintptr_t) (a = memalign(64, 100)) % 64)
+		panic("memalign(64) gave %08x", a);
+	if ((uintptr_t) (b = memalign(2 * PGSIZE, 5000)) % (2 * PGSIZE))
+		panic("memalign(2 pages) gave %08x", b);
+	free(a);
+	free(b);
+	if ((a = memalign(PGSIZE, 0)) == NULL || (uintptr_t) a % PGSIZE
+	    || (b = memalign(PGSIZE, 0)) == a)
+		panic("memalign(page, 0) gave %08x and %08x", a, b);
+	free(a);
+	free(b);
+
+	a = malloc(16 * PGSIZE);
+	if (!mapped(a) || !mapped(a + 15 * PGSIZE))
+		panic("large object not mapped");
+	free(a);
+	if (mapped(a) || mapped(a + 15 * PGSIZE))
+		panic("large object still mapped after free");
+	cprintf("mallocbench: malloc is good\n");
+}
+
+// NOPS frees and mallocs of 16 to 512 bytes over NSLOT live objects.
+static void *
+churn(void *arg)
+{
+	void *slot[NSLOT];
+	uint32_t seed = (uint32_t) arg;
+	int i, s;
+
+	memset(slot, 0, sizeof(slot));
+	for (i = 0; i < NOPS; i++) {
+		s = rand(&seed) % NSLOT;
+		free(slot[s]);
+		if (!(slot[s] = malloc(16 + rand(&seed) % 497)))
+			panic("malloc failed");
+		*(char *) slot[s] = i;
+	}
+	for (s = 0; s < NSLOT; s++)
+		free(slot[s]);
+	return NULL;
+}
+
+static void
+throughput(void)
+{
+	struct Thread *t[NTHR];
+	uint64_t start;
+	int i, r;
+
+	start = read_tsc();
+	churn((void *) 1);
+	cprintf("mallocbench: 1 thread: %llu ticks per malloc+free\n",
+		(read_tsc() - start) / NOPS);
+
+	start = read_tsc();
+	for (i = 0; i < NTHR; i++)
+		if ((r = thread_create(&t[i], churn, (void *) (i + 1))) < 0)
+			panic("thread_create: %e", r);
+	for (i = 0; i < NTHR; i++)
+		thread_join(t[i], NULL);
+	cprintf("mallocbench: %d threads: %llu ticks per malloc+free\n",
+		NTHR, (read_tsc() - start) / (NTHR * NOPS));
+}
+
+static void
+fragmentation(void)
+{
+	static void *obj[NFRAG];
+	static uint16_t size[NFRAG];
+	uint32_t seed = 7, live = 0, pages = 0;
+	uintptr_t va;
+	int i;
+
+	for (i = 0; i < NFRAG; i++) {
+		size[i] = 16 + rand(&seed) % 1009;
+		obj[i] = malloc(size[i]);
+		live += size[i];
+	}
+	for (i = 0; i < NFRAG; i += 2) {
+		free(obj[i]);
+		live -= size[i];
+	}
+	for (i = 0; i < NFRAG; i += 2) {
+		size[i] = 16 + rand(&seed) % 2033;
+		obj[i] = malloc(size[i]);
+		live += size[i];
+	}
+	for (va = HEAPBASE; va < HEAPEND; va += PGSIZE)
+		if (mapped((void *) va))
+			pages++;
+	cprintf("mallocbench: fragmentation: %u KB live in %u KB of pages\n",
+		live / 1024, pages * PGSIZE / 1024);
+	for (i = 0; i < NFRAG; i++)
+		free(obj[i]);
+}
+
+void
+umain(int argc, char **argv)
+{
+	check();
+	throughput();
+	fragmentation();
+	cprintf("mallocbench: done\n");
+}
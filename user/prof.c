@@ -0,0 +1,240 @@
+// Run a program with the sampling profiler on, then print a flat
+// profile of where it spent its time, by function.  Functions are named
+// from the binary's stabs if it was built with 'make USER_STABS=1', and
+// from its ELF symbol table otherwise.
+
+#include <inc/lib.h>
+#include <inc/elf.h>
+#include <inc/stab.h>
+
+// Where the binary's symbol tables are read in
+#define SCRATCH		((char *) 0x10000000)
+
+#define MAXFN		1024
+#define MAXENV		64
+
+struct Elfsym {
+	uint32_t st_name;
+	uint32_t st_value;
+	uint32_t st_size;
+	uint8_t st_info;
+	uint8_t st_other;
+	uint16_t st_shndx;
+};
+#define ELF_STT_FUNC	2
+
+static struct Fn {
+	uintptr_t addr;
+	const char *name;
+	int namelen;
+	uint32_t self;			// Samples in the function itself
+	uint32_t caller;		// Samples whose return address is in it
+} fns[MAXFN];
+static int nfns;
+
+static envid_t ours[MAXENV];	// The program and its descendants
+static int nours;
+
+static uint32_t nsamples, nidle, nother, nunknown;
+static struct ProfSample samples[256];
+static char *scratch_end = SCRATCH;
+
+// Read 'len' bytes at offset 'off' in 'fd' into fresh scratch pages.
+static void *
+load(int fd, uint32_t off, uint32_t len)
+{
+	char *p = scratch_end, *va;
+	int r;
+
+	for (va = p; va < p + len; va += PGSIZE)
+		if ((r = sys_page_alloc(0, va, PTE_P|PTE_U|PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+	scratch_end = ROUNDUP(p + len, PGSIZE);
+	if ((r = seek(fd, off)) < 0 || (r = readn(fd, p, len)) != len)
+		panic("reading symbols: %e", r < 0 ? r : -E_INVAL);
+	return p;
+}
+
+static void
+addfn(uintptr_t addr, const char *name, int namelen)
+{
+	if (nfns == MAXFN || namelen == 0)
+		return;
+	fns[nfns].addr = addr;
+	fns[nfns].name = name;
+	fns[nfns].namelen = namelen;
+	nfns++;
+}
+
+static void
+load_symbols(const char *path)
+{
+	struct Elf elf;
+	struct Secthdr *sh;
+	struct Stab *stabs;
+	struct Elfsym *syms;
+	const char *shstr, *str, *name;
+	int fd, i, j, stab = -1, stabstr = -1, symtab = -1;
+	struct Fn tmp;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		panic("open %s: %e", path, fd);
+	if (readn(fd, &elf, sizeof(elf)) != sizeof(elf) || elf.e_magic != ELF_MAGIC)
+		panic("%s is not an ELF binary", path);
+	sh = load(fd, elf.e_shoff, elf.e_shnum * sizeof(struct Secthdr));
+	shstr = load(fd, sh[elf.e_shstrndx].sh_offset, sh[elf.e_shstrndx].sh_size);
+	for (i = 0; i < elf.e_shnum; i++) {
+		if (strcmp(shstr + sh[i].sh_name, ".stab") == 0)
+			stab = i;
+		else if (strcmp(shstr + sh[i].sh_name, ".stabstr") == 0)
+			stabstr = i;
+		else if (sh[i].sh_type == ELF_SHT_SYMTAB)
+			symtab = i;
+	}
+
+	if (stab >= 0 && stabstr >= 0) {
+		stabs = load(fd, sh[stab].sh_offset, sh[stab].sh_size);
+		str = load(fd, sh[stabstr].sh_offset, sh[stabstr].sh_size);
+		for (i = 0; i < sh[stab].sh_size / sizeof(struct Stab); i++) {
+			if (stabs[i].n_type != N_FUN
+			    || stabs[i].n_strx >= sh[stabstr].sh_size)
+				continue;
+			name = str + stabs[i].n_strx;
+			addfn(stabs[i].n_value, name, strfind(name, ':') - name);
+		}
+	} else if (symtab >= 0) {
+		syms = load(fd, sh[symtab].sh_offset, sh[symtab].sh_size);
+		str = load(fd, sh[sh[symtab].sh_link].sh_offset,
+			   sh[sh[symtab].sh_link].sh_size);
+		for (i = 0; i < sh[symtab].sh_size / sizeof(struct Elfsym); i++)
+			if ((syms[i].st_info & 0xf) == ELF_STT_FUNC)
+				addfn(syms[i].st_value, str + syms[i].st_name,
+				      strlen(str + syms[i].st_name));
+	}
+	close(fd);
+
+	for (i = 1; i < nfns; i++)
+		for (j = i; j > 0 && fns[j].addr < fns[j - 1].addr; j--) {
+			tmp = fns[j];
+			fns[j] = fns[j - 1];
+			fns[j - 1] = tmp;
+		}
+}
+
+// Return the function containing 'eip', or NULL.
+static struct Fn *
+lookup(uintptr_t eip)
+{
+	int l = 0, r = nfns - 1, m;
+
+	if (nfns == 0 || eip < fns[0].addr)
+		return NULL;
+	while (l < r) {
+		m = (l + r + 1) / 2;
+		if (fns[m].addr <= eip)
+			l = m;
+		else
+			r = m - 1;
+	}
+	return &fns[l];
+}
+
+// Is 'envid' the profiled program or one of its descendants?
+static bool
+is_ours(envid_t envid)
+{
+	const volatile struct Env *e = &envs[ENVX(envid)];
+	int i;
+
+	for (i = 0; i < nours; i++)
+		if (ours[i] == envid)
+			return 1;
+	if (e->env_id != envid || nours == MAXENV)
+		return 0;
+	for (i = 0; i < nours; i++)
+		if (ours[i] == e->env_parent_id) {
+			ours[nours++] = envid;
+			return 1;
+		}
+	return 0;
+}
+
+static void
+drain(void)
+{
+	struct ProfSample *ps;
+	struct Fn *fn;
+	int i, n;
+
+	while ((n = sys_prof_read(samples, ARRAY_SIZE(samples))) > 0)
+		for (i = 0; i < n; i++) {
+			ps = &samples[i];
+			nsamples++;
+			if (ps->ps_envid == 0) {
+				nidle++;
+				continue;
+			}
+			if (!is_ours(ps->ps_envid)) {
+				nother++;
+				continue;
+			}
+			if ((fn = lookup(ps->ps_eip)) == NULL) {
+				nunknown++;
+				continue;
+			}
+			fn->self++;
+			if (ps->ps_caller && (fn = lookup(ps->ps_caller)))
+				fn->caller++;
+		}
+}
+
+static void
+report(void)
+{
+	struct Fn *order[MAXFN], *tmp;
+	int i, j, n = 0;
+
+	for (i = 0; i < nfns; i++)
+		if (fns[i].self || fns[i].caller)
+			order[n++] = &fns[i];
+	for (i = 1; i < n; i++)
+		for (j = i; j > 0 && order[j]->self > order[j - 1]->self; j--) {
+			tmp = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = tmp;
+		}
+
+	cprintf("%d samples: %d idle, %d in other envs, %d unknown\n",
+		nsamples, nidle, nother, nunknown);
+	cprintf("   self  caller  function\n");
+	for (i = 0; i < n; i++)
+		cprintf("%7d %7d  %.*s\n", order[i]->self, order[i]->caller,
+			order[i]->namelen, order[i]->name);
+}
+
+void
+umain(int argc, char **argv)
+{
+	static const char *defargv[] = { "forktree", 0 };
+	const char **args = (const char **) argv + 1;
+	envid_t child;
+	int r;
+
+	if (argc < 2)
+		args = defargv;
+
+	load_symbols(args[0]);
+	if ((r = sys_prof_ctl(1)) < 0)
+		panic("sys_prof_ctl: %e", r);
+	if ((child = spawn(args[0], args)) < 0)
+		panic("spawn %s: %e", args[0], child);
+	ours[nours++] = child;
+	while (envs[ENVX(child)].env_id == child
+	       && envs[ENVX(child)].env_status != ENV_FREE) {
+		drain();
+		sys_yield();
+	}
+	sys_prof_ctl(0);
+	drain();
+	report();
+}
@@ -0,0 +1,207 @@
+// Sum an array with 1, 2 and 4 threads, which the kernel can run on
+// different CPUs, and time each.  Also check that the threads really
+// share memory: a page mapped after they start, and a mutex-protected
+// counter, that threads can fork and do file I/O at once, and that a
+// thread can be joined while a fork of its env still shares its pages.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NDATA	(256 * 1024)
+#define NITER	1000
+#define SHARED	((volatile uint32_t *) 0x10000000)
+
+static uint32_t data[NDATA];
+
+static struct Mutex mu;
+static struct Sem ready;
+static uint32_t counter;
+
+struct Part {
+	uint32_t lo, hi;
+	uint64_t sum;
+};
+
+static void *
+sum_part(void *arg)
+{
+	struct Part *p = arg;
+	uint64_t sum = 0;
+	uint32_t i;
+
+	for (i = p->lo; i < p->hi; i++)
+		sum += data[i];
+	p->sum = sum;
+	return NULL;
+}
+
+static void *
+read_shared(void *arg)
+{
+	sem_wait(&ready);
+	return (void *) SHARED[0];
+}
+
+static void *
+count(void *arg)
+{
+	int i;
+
+	for (i = 0; i < NITER; i++) {
+		mutex_lock(&mu);
+		counter++;
+		mutex_unlock(&mu);
+	}
+	return NULL;
+}
+
+// Fork from a thread, which must submit through its own syscall ring.
+static void *
+fork_wait(void *arg)
+{
+	envid_t env;
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0)
+		exit();
+	wait(env);
+	return NULL;
+}
+
+static volatile int go;
+
+static void *
+wait_go(void *arg)
+{
+	while (!go)
+		sys_yield();
+	return arg;
+}
+
+static char motd[512];
+
+// Read /motd over and over while other threads do the same, which
+// would mix up their file server requests if they were not serialized.
+static void *
+read_motd(void *arg)
+{
+	char buf[512];
+	struct Stat st;
+	int i, fd, n;
+
+	for (i = 0; i < 20; i++) {
+		if ((fd = open("/motd", O_RDONLY)) < 0)
+			panic("open /motd: %e", fd);
+		if ((n = fstat(fd, &st)) < 0)
+			panic("fstat /motd: %e", n);
+		n = readn(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (n != st.st_size || n != strlen(motd))
+			return (void *) -1;
+		buf[n] = 0;
+		if (strcmp(buf, motd) != 0)
+			return (void *) -1;
+	}
+	return NULL;
+}
+
+static void
+run(int nthread)
+{
+	struct Thread *t[4];
+	struct Part part[4];
+	uint64_t start, sum = 0;
+	int i, r;
+
+	start = read_tsc();
+	for (i = 0; i < nthread; i++) {
+		part[i].lo = NDATA / nthread * i;
+		part[i].hi = NDATA / nthread * (i + 1);
+		if ((r = thread_create(&t[i], sum_part, &part[i])) < 0)
+			panic("thread_create: %e", r);
+	}
+	for (i = 0; i < nthread; i++) {
+		thread_join(t[i], NULL);
+		sum += part[i].sum;
+	}
+	if (sum != (uint64_t) NDATA * (NDATA - 1) / 2)
+		panic("%d threads: sum %llu", nthread, sum);
+	cprintf("psum: %d threads: %llu ticks\n", nthread, read_tsc() - start);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Thread *t[4];
+	envid_t env;
+	void *ret;
+	int i, r;
+
+	for (i = 0; i < NDATA; i++)
+		data[i] = i;
+	run(1);
+	run(2);
+	run(4);
+
+	if ((r = thread_create(&t[0], read_shared, NULL)) < 0)
+		panic("thread_create: %e", r);
+	if ((r = sys_page_alloc(0, (void *) SHARED, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	SHARED[0] = 42;
+	sem_post(&ready);
+	thread_join(t[0], &ret);
+	if ((uint32_t) ret != 42)
+		panic("thread read %d from a page mapped after it started", ret);
+	cprintf("psum: new pages are shared\n");
+
+	for (i = 0; i < 4; i++)
+		if ((r = thread_create(&t[i], count, NULL)) < 0)
+			panic("thread_create: %e", r);
+	for (i = 0; i < 4; i++)
+		thread_join(t[i], NULL);
+	if (counter != 4 * NITER)
+		panic("counter is %d, want %d", counter, 4 * NITER);
+	cprintf("psum: mutex counter is good\n");
+
+	fork_wait(NULL);
+	for (i = 0; i < 2; i++) {
+		if ((r = thread_create(&t[0], fork_wait, NULL)) < 0)
+			panic("thread_create: %e", r);
+		thread_join(t[0], NULL);
+	}
+	cprintf("psum: fork in a thread is good\n");
+
+	// The fork leaves the thread's exit word copy-on-write, so the
+	// join sleeps on a page the thread's exit must not move it off.
+	if ((r = thread_create(&t[0], wait_go, (void *) 7)) < 0)
+		panic("thread_create: %e", r);
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		ipc_recv(NULL, NULL, NULL);
+		exit();
+	}
+	go = 1;
+	thread_join(t[0], &ret);
+	if ((uint32_t) ret != 7)
+		panic("thread joined after fork returned %d", ret);
+	ipc_send(env, 0, NULL, 0);
+	wait(env);
+	cprintf("psum: join after fork is good\n");
+
+	if ((r = open("/motd", O_RDONLY)) < 0)
+		panic("open /motd: %e", r);
+	i = readn(r, motd, sizeof(motd) - 1);
+	motd[i] = 0;
+	close(r);
+	for (i = 0; i < 4; i++)
+		if ((r = thread_create(&t[i], read_motd, NULL)) < 0)
+			panic("thread_create: %e", r);
+	for (i = 0; i < 4; i++) {
+		thread_join(t[i], &ret);
+		if (ret != NULL)
+			panic("thread %d read /motd wrong", i);
+	}
+	cprintf("psum: file I/O in threads is good\n");
+}
@@ -0,0 +1,115 @@
+// Measure IPC request round-trip latency: an echo server driven by
+// separate send and receive calls, the same server driven by
+// ipc_call and ipc_reply_wait, stat requests to the file server, and
+// set_size requests, which travel in registers with no request page.
+// Also check that ipc_reply_wait's reply reaches a client that sent
+// with ipc_send and was slow to receive.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define NROUND	1000
+
+static void
+echo_split(void)
+{
+	envid_t who;
+	uint32_t v;
+
+	while (1) {
+		v = ipc_recv(&who, 0, 0);
+		ipc_send(who, v + 1, 0, 0);
+	}
+}
+
+static void
+echo_combined(void)
+{
+	envid_t who = 0;
+	uint32_t v = 0;
+
+	while (1)
+		v = ipc_reply_wait(who, v + 1, 0, 0, &who, 0, 0);
+}
+
+static void
+run(const char *name, bool combined)
+{
+	envid_t server;
+	uint64_t start, ticks;
+	uint32_t v;
+	int i;
+
+	if ((server = fork()) < 0)
+		panic("fork: %e", server);
+	if (server == 0) {
+		if (combined)
+			echo_combined();
+		else
+			echo_split();
+	}
+
+	start = read_tsc();
+	for (i = 0; i < NROUND; i++) {
+		if (combined)
+			v = ipc_call(server, i, 0, 0, 0, 0);
+		else {
+			ipc_send(server, i, 0, 0);
+			v = ipc_recv(0, 0, 0);
+		}
+		if (v != i + 1)
+			panic("%s: sent %d, got %d", name, i, v);
+	}
+	ticks = read_tsc() - start;
+	cprintf("rpclat: %s: %llu ticks per round trip\n", name, ticks / NROUND);
+
+	sys_env_destroy(server);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Stat st;
+	uint64_t start;
+	envid_t server;
+	uint32_t v;
+	int fd, i, r;
+
+	run("send+recv", 0);
+	run("call+reply_wait", 1);
+
+	if ((server = fork()) < 0)
+		panic("fork: %e", server);
+	if (server == 0)
+		echo_combined();
+	for (i = 0; i < 10; i++) {
+		ipc_send(server, i, 0, 0);
+		sys_yield();
+		if ((v = ipc_recv(0, 0, 0)) != i + 1)
+			panic("reply to send+recv: sent %d, got %d", i, v);
+	}
+	sys_env_destroy(server);
+	cprintf("rpclat: reply to send+recv is good\n");
+
+	if ((fd = open("/newmotd", O_RDONLY)) < 0)
+		panic("open /newmotd: %e", fd);
+	start = read_tsc();
+	for (i = 0; i < NROUND; i++)
+		if ((r = fstat(fd, &st)) < 0)
+			panic("fstat: %e", r);
+	cprintf("rpclat: fs stat: %llu ticks per round trip\n",
+		(read_tsc() - start) / NROUND);
+	close(fd);
+
+	if ((fd = open("/rpclat", O_RDWR | O_CREAT)) < 0)
+		panic("open /rpclat: %e", fd);
+	start = read_tsc();
+	for (i = 0; i < NROUND; i++)
+		if ((r = ftruncate(fd, i % 2 ? PGSIZE : 0)) < 0)
+			panic("ftruncate: %e", r);
+	cprintf("rpclat: fs set_size: %llu ticks per round trip\n",
+		(read_tsc() - start) / NROUND);
+	if ((r = fstat(fd, &st)) < 0 || st.st_size != PGSIZE)
+		panic("set_size: size %d, want %d", st.st_size, PGSIZE);
+	close(fd);
+}
@@ -15,27 +15,42 @@ int gettoken(char *s, char **token);
 
 // Parse a shell command from string 's' and execute it.
 // Do not return until the shell command is finished.
-// runcmd() is called in a forked child,
-// so it's OK to manipulate file descriptor state.
+// Each command of a pipeline is spawned with file actions that give it
+// its redirections and pipe ends (see spawnfa), so the shell need not
+// fork a child to manipulate file descriptor state for it.
 #define MAXARGS 16
+#define MAXCMDS 16
 void
 runcmd(char* s)
 {
 	char *argv[MAXARGS], *t, argv0buf[BUFSIZ];
-	int argc, c, i, r, p[2], fd, pipe_child;
+	int argc, c, i, r, p[2], pipein, nkids, kids[MAXCMDS];
+	struct SpawnFileActions fa;
 
-	pipe_child = 0;
+	pipein = -1;
+	nkids = 0;
 	gettoken(s, 0);
 
 again:
+	if (nkids == MAXCMDS) {
+		cprintf("too many commands\n");
+		goto done;
+	}
 	argc = 0;
+	spawn_file_actions_init(&fa);
+	// Read standard input from the previous command's pipe.
+	if (pipein >= 0) {
+		spawn_file_actions_adddup2(&fa, pipein, 0);
+		if (pipein != 0)
+			spawn_file_actions_addclose(&fa, pipein);
+	}
 	while (1) {
 		switch ((c = gettoken(0, &t))) {
 
 		case 'w':	// Add an argument
 			if (argc == MAXARGS) {
 				cprintf("too many arguments\n");
-				exit();
+				goto done;
 			}
 			argv[argc++] = t;
 			break;
@@ -44,73 +59,42 @@ again:
 			// Grab the filename from the argument list
 			if (gettoken(0, &t) != 'w') {
 				cprintf("syntax error: < not followed by word\n");
-				exit();
-			}
-			// Open 't' for reading as file descriptor 0
-			// (which environments use as standard input).
-			// We can't open a file onto a particular descriptor,
-			// so open the file as 'fd',
-			// then check whether 'fd' is 0.
-			// If not, dup 'fd' onto file descriptor 0,
-			// then close the original 'fd'.
-
-			// LAB 5: Your code here.
-			if((fd = open(t, O_RDONLY)) < 0){
-				cprintf("open %s for read: %e", t, fd);
-				exit();
+				goto done;
 			}
-			if(fd != 0){
-				dup(fd, 0);
-				close(fd);
+			// Have the command open 't' for reading as file
+			// descriptor 0 (which environments use as standard input).
+			if ((r = spawn_file_actions_addopen(&fa, 0, t, O_RDONLY)) < 0) {
+				cprintf("open %s for read: %e", t, r);
+				goto done;
 			}
-			//panic("< redirection not implemented");
 			break;
 
 		case '>':	// Output redirection
 			// Grab the filename from the argument list
 			if (gettoken(0, &t) != 'w') {
 				cprintf("syntax error: > not followed by word\n");
-				exit();
+				goto done;
 			}
-			if ((fd = open(t, O_WRONLY|O_CREAT|O_TRUNC)) < 0) {
-				cprintf("open %s for write: %e", t, fd);
-				exit();
-			}
-			if (fd != 1) {
-				dup(fd, 1);
-				close(fd);
+			if ((r = spawn_file_actions_addopen(&fa, 1, t, O_WRONLY|O_CREAT|O_TRUNC)) < 0) {
+				cprintf("open %s for write: %e", t, r);
+				goto done;
 			}
 			break;
 
 		case '|':	// Pipe
 			if ((r = pipe(p)) < 0) {
 				cprintf("pipe: %e", r);
-				exit();
+				goto done;
 			}
 			if (debug)
 				cprintf("PIPE: %d %d\n", p[0], p[1]);
-			if ((r = fork()) < 0) {
-				cprintf("fork: %e", r);
-				exit();
-			}
-			if (r == 0) {
-				if (p[0] != 0) {
-					dup(p[0], 0);
-					close(p[0]);
-				}
-				close(p[1]);
-				goto again;
-			} else {
-				pipe_child = r;
-				if (p[1] != 1) {
-					dup(p[1], 1);
-					close(p[1]);
-				}
-				close(p[0]);
-				goto runit;
-			}
-			panic("| not implemented");
-			break;
+			// This command writes the pipe as standard output;
+			// the next one reads it.
+			spawn_file_actions_addclose(&fa, p[0]);
+			spawn_file_actions_adddup2(&fa, p[1], 1);
+			if (p[1] != 1)
+				spawn_file_actions_addclose(&fa, p[1]);
+			goto runit;
 
 		case 0:		// String is complete
 			// Run the current command!
@@ -124,11 +108,11 @@ again:
 	}
 
 runit:
-	// Return immediately if command line was empty.
-	if(argc == 0) {
+	// Skip the command if it is empty.
+	if (argc == 0) {
 		if (debug)
 			cprintf("EMPTY COMMAND\n");
-		return;
+		goto spawned;
 	}
 
 	// Clean up command line.
@@ -151,32 +135,34 @@ runit:
 	}
 
 	// Spawn the command!
-	if ((r = spawn(argv[0], (const char**) argv)) < 0)
+	if ((r = spawnfa(argv[0], (const char**) argv, &fa)) < 0)
 		cprintf("spawn %s: %e\n", argv[0], r);
-
-	// In the parent, close all file descriptors and wait for the
-	// spawned command to exit.
-	close_all();
-	if (r >= 0) {
-		if (debug)
-			cprintf("[%08x] WAIT %s %08x\n", thisenv->env_id, argv[0], r);
-		wait(r);
-		if (debug)
-			cprintf("[%08x] wait finished\n", thisenv->env_id);
+	else
+		kids[nkids++] = r;
+
+spawned:
+	// The command has its own copies of the pipe ends now.
+	if (pipein >= 0)
+		close(pipein);
+	pipein = -1;
+	if (c == '|') {
+		close(p[1]);
+		pipein = p[0];
+		goto again;
 	}
 
-	// If we were the left-hand part of a pipe,
-	// wait for the right-hand part to finish.
-	if (pipe_child) {
+done:
+	if (pipein >= 0)
+		close(pipein);
+
+	// Wait for every command of the pipeline to exit.
+	for (i = 0; i < nkids; i++) {
 		if (debug)
-			cprintf("[%08x] WAIT pipe_child %08x\n", thisenv->env_id, pipe_child);
-		wait(pipe_child);
+			cprintf("[%08x] WAIT %08x\n", thisenv->env_id, kids[i]);
+		wait(kids[i]);
 		if (debug)
 			cprintf("[%08x] wait finished\n", thisenv->env_id);
 	}
-
-	// Done!
-	exit();
 }
 
 
@@ -314,17 +300,7 @@ umain(int argc, char **argv)
 			continue;
 		if (echocmds)
 			printf("# %s\n", buf);
-		if (debug)
-			cprintf("BEFORE FORK\n");
-		if ((r = fork()) < 0)
-			panic("fork: %e", r);
-		if (debug)
-			cprintf("FORK: %d\n", r);
-		if (r == 0) {
-			runcmd(buf);
-			exit();
-		} else
-			wait(r);
+		runcmd(buf);
 	}
 }
 
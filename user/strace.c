@@ -0,0 +1,148 @@
+// Run a program with system call tracing on.  Print every call it and
+// its children make, then a histogram of the time each kind of call
+// took, in TSC ticks.
+
+#include <inc/lib.h>
+
+#define NBUCKET		32
+
+static const char * const sysnames[NSYSCALLS] = {
+	[SYS_cputs] = "cputs",
+	[SYS_cgetc] = "cgetc",
+	[SYS_getenvid] = "getenvid",
+	[SYS_env_destroy] = "env_destroy",
+	[SYS_page_alloc] = "page_alloc",
+	[SYS_page_map] = "page_map",
+	[SYS_page_unmap] = "page_unmap",
+	[SYS_exofork] = "exofork",
+	[SYS_env_set_status] = "env_set_status",
+	[SYS_env_set_trapframe] = "env_set_trapframe",
+	[SYS_env_set_pgfault_upcall] = "env_set_pgfault_upcall",
+	[SYS_yield] = "yield",
+	[SYS_ipc_try_send] = "ipc_try_send",
+	[SYS_ipc_recv] = "ipc_recv",
+	[SYS_ring_setup] = "ring_setup",
+	[SYS_enter_ring] = "enter_ring",
+	[SYS_trace_ctl] = "trace_ctl",
+	[SYS_trace_read] = "trace_read",
+	[SYS_prof_ctl] = "prof_ctl",
+	[SYS_prof_read] = "prof_read",
+	[SYS_ipc_send] = "ipc_send",
+	[SYS_ipc_call] = "ipc_call",
+	[SYS_ipc_reply_wait] = "ipc_reply_wait",
+	[SYS_ipc_callw] = "ipc_callw",
+	[SYS_ipc_sendv] = "ipc_sendv",
+	[SYS_ipc_recvv] = "ipc_recvv",
+	[SYS_futex_wait] = "futex_wait",
+	[SYS_futex_wake] = "futex_wake",
+	[SYS_ipc_recvsel] = "ipc_recvsel",
+	[SYS_notify] = "notify",
+	[SYS_notify_wait] = "notify_wait",
+	[SYS_env_set_pager] = "env_set_pager",
+	[SYS_thread_create] = "thread_create",
+	[SYS_env_share_pts] = "env_share_pts",
+	[SYS_vfork] = "vfork",
+	[SYS_page_populate] = "page_populate",
+	[SYS_madvise] = "madvise",
+};
+
+static uint32_t hist[NSYSCALLS][NBUCKET];
+static uint32_t pending[NSYSCALLS];
+static struct TraceRec recs[64];
+
+static const char *
+sysname(uint32_t num)
+{
+	if (num < NSYSCALLS && sysnames[num])
+		return sysnames[num];
+	return "?";
+}
+
+static int
+ilog2(uint64_t x)
+{
+	int n = 0;
+
+	while (x >>= 1)
+		n++;
+	return n;
+}
+
+// Print and account for all trace records not made by 'self'.
+static void
+drain(envid_t self)
+{
+	struct TraceRec *t;
+	int i, n;
+
+	while ((n = sys_trace_read(recs, ARRAY_SIZE(recs))) > 0)
+		for (i = 0; i < n; i++) {
+			t = &recs[i];
+			if (t->tr_envid == self)
+				continue;
+			if (t->tr_flags & TRACE_OVERRUN)
+				cprintf("... records lost on CPU %d ...\n", t->tr_cpu);
+			cprintf("[%08x] %s(%x, %x, %x, %x, %x)", t->tr_envid,
+			       sysname(t->tr_num), t->tr_args[0], t->tr_args[1],
+			       t->tr_args[2], t->tr_args[3], t->tr_args[4]);
+			if (t->tr_flags & TRACE_PENDING) {
+				cprintf(" = ? (switched away)\n");
+				if (t->tr_num < NSYSCALLS)
+					pending[t->tr_num]++;
+				continue;
+			}
+			cprintf(" = %d  %llu ticks\n", t->tr_ret, t->tr_cycles);
+			if (t->tr_num < NSYSCALLS)
+				hist[t->tr_num][MIN(ilog2(t->tr_cycles), NBUCKET - 1)]++;
+		}
+}
+
+static void
+report(void)
+{
+	uint32_t num, total;
+	int b;
+
+	cprintf("\nlatency histograms (TSC ticks):\n");
+	for (num = 0; num < NSYSCALLS; num++) {
+		for (total = 0, b = 0; b < NBUCKET; b++)
+			total += hist[num][b];
+		if (total == 0 && pending[num] == 0)
+			continue;
+		cprintf("%s: %d returned, %d switched away\n",
+		       sysname(num), total, pending[num]);
+		for (b = 0; b < NBUCKET; b++)
+			if (hist[num][b])
+				cprintf("  [2^%d, 2^%d)\t%d\n", b, b + 1, hist[num][b]);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	static const char *defargv[] = { "hello", 0 };
+	const char **args = (const char **) argv + 1;
+	envid_t self = sys_getenvid(), child;
+	int r;
+
+	if (argc < 2)
+		args = defargv;
+
+	// Trace ourselves while spawning so the child starts out traced,
+	// and discard records left over from earlier tracing.
+	drain(self);
+	if ((r = sys_trace_ctl(0, 1)) < 0)
+		panic("sys_trace_ctl: %e", r);
+	child = spawn(args[0], args);
+	sys_trace_ctl(0, 0);
+	if (child < 0)
+		panic("spawn %s: %e", args[0], child);
+
+	while (envs[ENVX(child)].env_id == child
+	       && envs[ENVX(child)].env_status != ENV_FREE) {
+		drain(self);
+		sys_yield();
+	}
+	drain(self);
+	report();
+}
@@ -0,0 +1,93 @@
+// Test arenas: allocation, alignment, growth, reset and free_all.
+// Test pools: get and put, and four threads taking and returning
+// objects at once through the lock-free list.
+
+#include <inc/lib.h>
+
+#define ARENA	((char *) 0x10000000)
+#define NOBJ	64
+#define NTHR	4
+#define NITER	10000
+
+struct Obj {
+	uint32_t link;
+	volatile uint32_t owner;
+};
+
+static struct Obj objs[NOBJ];
+static struct Pool pool;
+
+static bool
+mapped(void *va)
+{
+	return (uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P);
+}
+
+static void *
+churn(void *arg)
+{
+	struct Obj *o;
+	int i;
+
+	for (i = 0; i < NITER; i++) {
+		if (!(o = pool_get(&pool)))
+			continue;
+		if (o->owner)
+			panic("object %d taken twice", o - objs);
+		o->owner = (uint32_t) arg;
+		sys_yield();
+		if (o->owner != (uint32_t) arg)
+			panic("object %d changed hands", o - objs);
+		o->owner = 0;
+		pool_put(&pool, o);
+	}
+	return NULL;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct Arena a;
+	struct Thread *t[NTHR];
+	char *p, *q;
+	int i, n, r;
+
+	arena_init(&a, ARENA, 4 * PGSIZE);
+	p = arena_alloc(&a, 3);
+	q = arena_alloc(&a, 10);
+	if (p != ARENA || q != ARENA + 8)
+		panic("arena gave %08x then %08x", p, q);
+	if (!arena_alloc(&a, 2 * PGSIZE) || !mapped(ARENA + 2 * PGSIZE))
+		panic("arena did not grow");
+	if (arena_alloc(&a, 2 * PGSIZE))
+		panic("arena went past its range");
+	if (strcmp(arena_strndup(&a, "walk/this/path", 4), "walk") != 0)
+		panic("arena_strndup");
+	arena_reset(&a);
+	if (arena_alloc(&a, 1) != ARENA || !mapped(ARENA + 2 * PGSIZE))
+		panic("arena_reset");
+	arena_free_all(&a);
+	if (mapped(ARENA))
+		panic("arena_free_all left pages mapped");
+	cprintf("arena is good\n");
+
+	pool_init(&pool, objs, sizeof(objs[0]));
+	if (pool_get(&pool))
+		panic("new pool is not empty");
+	for (i = 0; i < NOBJ; i++)
+		pool_put(&pool, &objs[i]);
+	if (pool_get(&pool) != &objs[NOBJ - 1])
+		panic("pool is not last in, first out");
+	pool_put(&pool, &objs[NOBJ - 1]);
+
+	for (i = 0; i < NTHR; i++)
+		if ((r = thread_create(&t[i], churn, (void *) (i + 1))) < 0)
+			panic("thread_create: %e", r);
+	for (i = 0; i < NTHR; i++)
+		thread_join(t[i], NULL);
+	for (n = 0; pool_get(&pool); n++)
+		;
+	if (n != NOBJ)
+		panic("pool holds %d objects, want %d", n, NOBJ);
+	cprintf("pool is good\n");
+}
@@ -0,0 +1,80 @@
+// Test demand-paged spawn: a spawned copy of this program checks that
+// its data and bss pages are mapped only when first touched, bss from
+// a shared zero page, and that system calls and fork cope with pages
+// not yet mapped.
+
+#include <inc/lib.h>
+
+#define MSG	"demand-paged syscall is good\n"
+
+static char data[4 * PGSIZE] __attribute__((aligned(PGSIZE))) = "lazy data";
+static char msg[PGSIZE] __attribute__((aligned(PGSIZE))) = MSG;
+static char zeros[4 * PGSIZE] __attribute__((aligned(PGSIZE)));
+static uint32_t word[PGSIZE / 4] __attribute__((aligned(PGSIZE)));
+
+static bool
+mapped(void *va)
+{
+	return (uvpd[PDX(va)] & PTE_P) && (uvpt[PGNUM(va)] & PTE_P);
+}
+
+static void
+child(void)
+{
+	envid_t env;
+	int r;
+
+	if (mapped(data + PGSIZE) || mapped(msg) || mapped(zeros + PGSIZE)
+	    || mapped(word))
+		panic("pages mapped before first touch");
+
+	if (zeros[PGSIZE] != 0 || zeros[2 * PGSIZE] != 0)
+		panic("bss is not zero");
+	if ((uvpt[PGNUM(zeros + PGSIZE)] & PTE_W)
+	    || PTE_ADDR(uvpt[PGNUM(zeros + PGSIZE)]) != PTE_ADDR(uvpt[PGNUM(zeros + 2 * PGSIZE)]))
+		panic("bss pages read are not the shared zero page");
+	zeros[PGSIZE] = 1;
+	if (zeros[2 * PGSIZE] != 0 || !(uvpt[PGNUM(zeros + PGSIZE)] & PTE_W))
+		panic("write to a bss page went wrong");
+	cprintf("demand-zero bss is good\n");
+
+	if (strcmp(data, "lazy data") != 0 || data[PGSIZE] != 0)
+		panic("data page holds the wrong contents");
+	if (uvpt[PGNUM(data + PGSIZE)] & PTE_W)
+		panic("data page mapped writable before first write");
+	data[PGSIZE] = 'w';
+	if (!(uvpt[PGNUM(data + PGSIZE)] & PTE_W))
+		panic("write to a data page went wrong");
+	cprintf("demand-paged data is good\n");
+
+	// The kernel pages these in for the system calls themselves.
+	sys_cputs(msg, sizeof(MSG) - 1);
+	if ((r = sys_futex_wait(&word[0], 1, 0)) != -E_AGAIN)
+		panic("futex_wait on an untouched bss word returned %e", r);
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		if (mapped(data + 2 * PGSIZE))
+			panic("fork mapped an untouched page");
+		if (data[2 * PGSIZE] != 0 || data[PGSIZE] != 'w')
+			panic("forked child sees the wrong data");
+		exit();
+	}
+	wait(env);
+	cprintf("demand paging after fork is good\n");
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t env;
+
+	if (argc > 1 && strcmp(argv[1], "child") == 0) {
+		child();
+		return;
+	}
+	if ((env = spawnl("/testdemand", "testdemand", "child", (char *) 0)) < 0)
+		panic("spawn: %e", env);
+	wait(env);
+}
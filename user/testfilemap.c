@@ -0,0 +1,70 @@
+// Test mapping file blocks from the file server's cache, that writes
+// to the file leave a mapped block alone, and copy-on-write faults
+// resolved by the kernel.
+
+#include <inc/lib.h>
+
+#define MAPVA	((char *) 0x10000000)
+
+static char buf[PGSIZE];
+
+void
+umain(int argc, char **argv)
+{
+	envid_t env;
+	int fd, n, r;
+
+	if ((fd = open("/newmotd", O_RDONLY)) < 0)
+		panic("open /newmotd: %e", fd);
+	if ((n = readn(fd, buf, sizeof(buf))) < 0)
+		panic("readn: %e", n);
+	if ((r = file_map(fd, 0, MAPVA)) < 0)
+		panic("file_map: %e", r);
+	if (memcmp(MAPVA, buf, n) != 0)
+		panic("mapped block differs from file contents");
+	if (uvpt[PGNUM(MAPVA)] & PTE_W)
+		panic("file block mapped writable");
+	if ((r = file_map(fd, 1, MAPVA)) != -E_INVAL)
+		panic("unaligned file_map returned %e", r);
+	if ((r = file_map(fd, ROUNDUP(n, BLKSIZE), MAPVA)) != -E_INVAL)
+		panic("file_map past end returned %e", r);
+	close(fd);
+	cprintf("file_map is good\n");
+
+	// A write to the file goes to a new page, not to the mapped one.
+	if ((fd = open("/mapwrite", O_RDWR | O_CREAT)) < 0)
+		panic("open /mapwrite: %e", fd);
+	if ((r = write(fd, "old", 4)) != 4)
+		panic("write: %e", r);
+	if ((r = file_map(fd, 0, MAPVA + 2 * PGSIZE)) < 0)
+		panic("file_map: %e", r);
+	seek(fd, 0);
+	if ((r = write(fd, "new", 4)) != 4)
+		panic("write: %e", r);
+	seek(fd, 0);
+	if ((r = readn(fd, buf, 4)) != 4 || strcmp(buf, "new") != 0)
+		panic("read back '%s' after write", buf);
+	if (strcmp(MAPVA + 2 * PGSIZE, "old") != 0)
+		panic("write changed the mapped block to '%s'", MAPVA + 2 * PGSIZE);
+	close(fd);
+	cprintf("file_map after write is good\n");
+
+	// Map the block copy-on-write and write to it.
+	if ((r = sys_page_map(0, MAPVA, 0, MAPVA + PGSIZE, PTE_P | PTE_U | PTE_COW)) < 0)
+		panic("sys_page_map: %e", r);
+	MAPVA[PGSIZE] = '!';
+	if (MAPVA[0] == '!' || !(uvpt[PGNUM(MAPVA + PGSIZE)] & PTE_W)
+	    || (uvpt[PGNUM(MAPVA + PGSIZE)] & PTE_COW))
+		panic("COW write to a file block went wrong");
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		buf[0] = 'c';
+		exit();
+	}
+	wait(env);
+	buf[0] = 'p';
+	if (buf[0] != 'p')
+		panic("COW write after fork went wrong");
+	cprintf("kernel cow is good\n");
+}
@@ -0,0 +1,47 @@
+// Check that each environment keeps its own x87 and SSE state
+// across context switches.
+
+#include <inc/lib.h>
+
+static void
+check(int id)
+{
+	uint32_t in[4] = { id, id * 2, id * 3, id * 4 }, out[4];
+	uint16_t fcw_in = 0x0f7f, fcw_out;	// round toward zero
+	int i, st0;
+
+	asm volatile("fldcw %0" : : "m" (fcw_in));
+	asm volatile("fildl %0" : : "m" (id));
+	asm volatile("movups %0, %%xmm0" : : "m" (in));
+
+	for (i = 0; i < 50; i++)
+		sys_yield();
+
+	asm volatile("movups %%xmm0, %0" : "=m" (out));
+	asm volatile("fistpl %0" : "=m" (st0));
+	asm volatile("fnstcw %0" : "=m" (fcw_out));
+
+	if (st0 != id)
+		panic("x87 stack of %d clobbered: got %d", id, st0);
+	if (fcw_out != fcw_in)
+		panic("x87 control word of %d clobbered: got %x", id, fcw_out);
+	if (memcmp(in, out, sizeof(in)) != 0)
+		panic("xmm0 of %d clobbered", id);
+}
+
+void
+umain(int argc, char **argv)
+{
+	int i;
+	envid_t kids[4];
+
+	for (i = 0; i < 4; i++)
+		if ((kids[i] = fork()) == 0) {
+			check(i + 2);
+			return;
+		}
+	check(1);
+	for (i = 0; i < 4; i++)
+		wait(kids[i]);
+	cprintf("testfpu: FPU state is good\n");
+}
@@ -0,0 +1,94 @@
+// Test futex-based mutexes, semaphores and condition variables across
+// environments sharing a PTE_SHARE page, and futex wait timeouts.
+
+#include <inc/lib.h>
+
+#define NCHILD	4
+#define NITER	200
+
+struct Shared {
+	struct Mutex mu;
+	uint32_t counter;
+	struct Sem sem;
+	struct Cond cond;
+	uint32_t flag;
+};
+
+static struct Shared *sh = (struct Shared *) 0x10000000;
+
+static void
+counter_child(void)
+{
+	uint32_t t;
+	int i;
+
+	for (i = 0; i < NITER; i++) {
+		mutex_lock(&sh->mu);
+		t = sh->counter;
+		sys_yield();
+		sh->counter = t + 1;
+		mutex_unlock(&sh->mu);
+	}
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCHILD], env;
+	uint32_t word = 7;
+	int i, r;
+
+	if ((r = sys_page_alloc(0, sh, PTE_P | PTE_U | PTE_W | PTE_SHARE)) < 0)
+		panic("sys_page_alloc: %e", r);
+
+	for (i = 0; i < NCHILD; i++) {
+		if ((kids[i] = fork()) < 0)
+			panic("fork: %e", kids[i]);
+		if (kids[i] == 0) {
+			counter_child();
+			return;
+		}
+	}
+	for (i = 0; i < NCHILD; i++)
+		wait(kids[i]);
+	if (sh->counter != NCHILD * NITER)
+		panic("counter is %d, want %d", sh->counter, NCHILD * NITER);
+	cprintf("futex mutex is good\n");
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		for (i = 0; i < 10; i++) {
+			sys_yield();
+			sem_post(&sh->sem);
+		}
+		return;
+	}
+	for (i = 0; i < 10; i++)
+		sem_wait(&sh->sem);
+	wait(env);
+	cprintf("futex sem is good\n");
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		sys_yield();
+		mutex_lock(&sh->mu);
+		sh->flag = 1;
+		cond_signal(&sh->cond);
+		mutex_unlock(&sh->mu);
+		return;
+	}
+	mutex_lock(&sh->mu);
+	while (!sh->flag)
+		cond_wait(&sh->cond, &sh->mu);
+	mutex_unlock(&sh->mu);
+	wait(env);
+	cprintf("futex cond is good\n");
+
+	if ((r = sys_futex_wait(&word, 8, 0)) != -E_AGAIN)
+		panic("futex_wait on a changed value returned %e", r);
+	if ((r = sys_futex_wait(&word, 7, 50)) != -E_TIMEOUT)
+		panic("futex_wait with timeout returned %e", r);
+	cprintf("futex timeout is good\n");
+}
@@ -0,0 +1,68 @@
+// Test selective receive: a server takes messages from one client, or
+// with one tag, while other senders wait queued in the kernel.
+
+#include <inc/lib.h>
+
+#define NCLIENT	3
+#define NSTEP	4
+
+// Message values carry the endpoint in the top byte.
+#define TAG(ep)		((ep) << 24)
+#define TAGMASK		0xFF000000
+
+static void
+client(envid_t server, int id)
+{
+	int i;
+
+	// A multi-step conversation: NSTEP messages in a row.
+	for (i = 0; i < NSTEP; i++)
+		ipc_send(server, id * 100 + i, 0, 0);
+	// Then one message on endpoint 'id'.
+	ipc_send(server, TAG(id) | id, 0, 0);
+}
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[NCLIENT], who;
+	int i, id, v;
+
+	for (id = 0; id < NCLIENT; id++) {
+		if ((kids[id] = fork()) < 0)
+			panic("fork: %e", kids[id]);
+		if (kids[id] == 0) {
+			client(thisenv->env_parent_id, id + 1);
+			return;
+		}
+	}
+	// Let every client block in its first send.
+	for (i = 0; i < 10; i++)
+		sys_yield();
+
+	// Hold each conversation in turn, last client first.
+	for (id = NCLIENT; id > 0; id--)
+		for (i = 0; i < NSTEP; i++) {
+			v = ipc_recvsel(kids[id - 1], 0, 0, &who, 0, 0);
+			if (v != id * 100 + i || who != kids[id - 1])
+				panic("conversation %d: step %d got %d from %08x",
+				      id, i, v, who);
+		}
+	cprintf("ipcsel from is good\n");
+
+	// Take the endpoint messages in endpoint order, from any sender.
+	for (id = 1; id <= NCLIENT; id++) {
+		v = ipc_recvsel(0, TAG(id), TAGMASK, &who, 0, 0);
+		if (v != (TAG(id) | id) || who != kids[id - 1])
+			panic("endpoint %d got %08x from %08x", id, v, who);
+	}
+	cprintf("ipcsel tag is good\n");
+
+	if ((v = sys_ipc_recvsel(0, 1, 0, (void *) UTOP, 0)) != -E_INVAL)
+		panic("tag outside mask returned %e", v);
+	for (id = 0; id < NCLIENT; id++)
+		wait(kids[id]);
+	if ((v = ipc_recvsel(kids[0], 0, 0, 0, 0, 0)) != -E_BAD_ENV)
+		panic("receive from a dead env returned %e", v);
+	cprintf("ipcsel errors are good\n");
+}
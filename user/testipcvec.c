@@ -0,0 +1,96 @@
+// Test scatter-gather IPC: several page ranges in one message, moving
+// pages out of the sender, and a receive window too small for a message.
+// Also moving a single page with IPC_PERM_MOVE.
+
+#include <inc/lib.h>
+
+#define SRC	((char *) 0x10000000)
+#define WIN	((char *) 0x20000000)
+#define NPAGES	16
+
+static void
+child(void)
+{
+	envid_t who;
+	uint32_t n;
+	int i, v;
+
+	v = ipc_recvv(&who, WIN, NPAGES, &n);
+	if (v != 1 || n != NPAGES)
+		panic("share: value %d, %d pages", v, n);
+	for (i = 0; i < NPAGES; i++)
+		if (WIN[i * PGSIZE] != 'a' + i)
+			panic("share: page %d holds %c", i, WIN[i * PGSIZE]);
+	ipc_send(who, 0, 0, 0);
+
+	v = ipc_recvv(&who, WIN, NPAGES, &n);
+	if (v != 2 || n != 4 || WIN[3 * PGSIZE] != 'a' + 3)
+		panic("move: value %d, %d pages", v, n);
+	ipc_send(who, 0, 0, 0);
+
+	v = ipc_recvv(&who, WIN, 2, &n);
+	if (v != 3 || n != 2)
+		panic("window: value %d, %d pages", v, n);
+
+	v = ipc_recvv(&who, WIN, NPAGES, &n);
+	if (v != 4 || n != 1 || WIN[0] != 'a' + 8)
+		panic("page move: value %d, %d pages", v, n);
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct IpcVec vec[2];
+	envid_t env;
+	int i, r;
+
+	for (i = 0; i < NPAGES; i++) {
+		if ((r = sys_page_alloc(0, SRC + i * PGSIZE, PTE_P | PTE_U | PTE_W)) < 0)
+			panic("sys_page_alloc: %e", r);
+		SRC[i * PGSIZE] = 'a' + i;
+	}
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		child();
+		return;
+	}
+
+	// Two ranges, shared, land contiguously in the child's window.
+	vec[0] = (struct IpcVec) { SRC, 5, PTE_P | PTE_U };
+	vec[1] = (struct IpcVec) { SRC + 5 * PGSIZE, NPAGES - 5, PTE_P | PTE_U };
+	ipc_sendv(env, 1, vec, 2, 0);
+	ipc_recv(0, 0, 0);
+	if (!(uvpt[PGNUM(SRC)] & PTE_P))
+		panic("share unmapped the sender's page");
+	cprintf("ipcvec share is good\n");
+
+	vec[0] = (struct IpcVec) { SRC, 4, PTE_P | PTE_U };
+	ipc_sendv(env, 2, vec, 1, IPC_MOVE);
+	ipc_recv(0, 0, 0);
+	for (i = 0; i < 4; i++)
+		if (uvpt[PGNUM(SRC + i * PGSIZE)] & PTE_P)
+			panic("move left page %d mapped", i);
+	if (!(uvpt[PGNUM(SRC + 4 * PGSIZE)] & PTE_P))
+		panic("move unmapped too much");
+	cprintf("ipcvec move is good\n");
+
+	// Four pages do not fit in a two-page window.
+	vec[0] = (struct IpcVec) { SRC + 4 * PGSIZE, 4, PTE_P | PTE_U };
+	if ((r = sys_ipc_sendv(env, 3, vec, 1, 0)) != -E_INVAL)
+		panic("oversized send returned %e", r);
+	vec[0].iv_npages = 2;
+	ipc_sendv(env, 3, vec, 1, 0);
+	cprintf("ipcvec window is good\n");
+
+	// A page cannot be moved twice in one message.
+	vec[0] = (struct IpcVec) { SRC + 8 * PGSIZE, 2, PTE_P | PTE_U };
+	vec[1] = (struct IpcVec) { SRC + 9 * PGSIZE, 2, PTE_P | PTE_U };
+	if ((r = sys_ipc_sendv(env, 4, vec, 2, IPC_MOVE)) != -E_INVAL)
+		panic("overlapping move returned %e", r);
+	ipc_send(env, 4, SRC + 8 * PGSIZE, PTE_P | PTE_U | IPC_PERM_MOVE);
+	if (uvpt[PGNUM(SRC + 8 * PGSIZE)] & PTE_P)
+		panic("page move left the page mapped");
+	cprintf("ipcvec page move is good\n");
+}
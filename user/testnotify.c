@@ -0,0 +1,51 @@
+// Test asynchronous notifications: bits posted before a wait are kept
+// and merged, a waiter takes only the bits it asks for, and a blocked
+// waiter is woken by a later post.
+
+#include <inc/lib.h>
+
+#define EV_TIMER	0x1
+#define EV_IO		0x2
+#define EV_PIPE		0x4
+
+void
+umain(int argc, char **argv)
+{
+	envid_t parent = sys_getenvid(), env;
+	int r;
+
+	if ((r = sys_notify(parent, EV_TIMER)) < 0)
+		panic("sys_notify: %e", r);
+	sys_notify(parent, EV_IO);
+	sys_notify(parent, EV_IO);
+	if (thisenv->env_notify_pending != (EV_TIMER | EV_IO))
+		panic("pending is %x", thisenv->env_notify_pending);
+	if ((r = sys_notify_wait(EV_IO | EV_PIPE)) != EV_IO)
+		panic("first wait took %x", r);
+	if ((r = sys_notify_wait(NOTIFY_ALL)) != EV_TIMER)
+		panic("second wait took %x", r);
+	cprintf("notify pending is good\n");
+
+	if ((env = fork()) < 0)
+		panic("fork: %e", env);
+	if (env == 0) {
+		// Wait for the parent to block first.
+		while (envs[ENVX(parent)].env_status != ENV_NOT_RUNNABLE)
+			sys_yield();
+		sys_notify(parent, EV_IO);
+		sys_notify(parent, EV_PIPE);
+		return;
+	}
+	if ((r = sys_notify_wait(EV_PIPE)) != EV_PIPE)
+		panic("blocking wait took %x", r);
+	if (thisenv->env_notify_pending != EV_IO)
+		panic("pending after wake is %x", thisenv->env_notify_pending);
+	wait(env);
+	cprintf("notify wakeup is good\n");
+
+	if ((r = sys_notify_wait(0)) != -E_INVAL)
+		panic("empty mask returned %e", r);
+	if ((r = sys_notify(parent, 0x80000000)) != -E_INVAL)
+		panic("reserved bit returned %e", r);
+	cprintf("notify errors are good\n");
+}
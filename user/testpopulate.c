@@ -0,0 +1,104 @@
+// Test sys_page_populate and sys_madvise on a demand-zero region and
+// on copy-on-write pages, and time touching a region page by page
+// against populating it first.
+
+#include <inc/lib.h>
+#include <inc/x86.h>
+
+#define REGION	((char *) 0x10000000)
+#define NPAGES	256
+#define COWSRC	((char *) 0x20000000)
+#define COWDST	((char *) 0x20001000)
+
+static void
+zero_region(char *va, uint32_t npages)
+{
+	struct PagerRegion pr;
+	int r;
+
+	memset(&pr, 0, sizeof(pr));
+	pr.pr_va = pr.pr_fileend = (uintptr_t) va;
+	pr.pr_end = (uintptr_t) va + npages * PGSIZE;
+	pr.pr_perm = PTE_P | PTE_U | PTE_W;
+	if ((r = sys_env_set_pager(0, &pr)) < 0)
+		panic("sys_env_set_pager: %e", r);
+}
+
+static bool
+mapped(char *va, bool write)
+{
+	pte_t pte;
+
+	if (!(uvpd[PDX(va)] & PTE_P) || !((pte = uvpt[PGNUM(va)]) & PTE_P))
+		return 0;
+	return !write || (pte & PTE_W);
+}
+
+void
+umain(int argc, char **argv)
+{
+	uint64_t start, faults, populate;
+	int i, r;
+
+	zero_region(REGION, 2 * NPAGES);
+
+	// Touching each page takes a fault; populating takes one call.
+	start = read_tsc();
+	for (i = 0; i < NPAGES; i++)
+		REGION[i * PGSIZE] = i;
+	faults = read_tsc() - start;
+	start = read_tsc();
+	if ((r = sys_page_populate(0, REGION + NPAGES * PGSIZE,
+				   NPAGES * PGSIZE, POPULATE_WRITE)) != NPAGES)
+		panic("populate mapped %d pages, want %d", r, NPAGES);
+	for (i = NPAGES; i < 2 * NPAGES; i++)
+		REGION[i * PGSIZE] = i;
+	populate = read_tsc() - start;
+	cprintf("populate: faults: %llu ticks\n", faults);
+	cprintf("populate: populate: %llu ticks\n", populate);
+
+	// Populating for reading maps the zero page, read-only.
+	if ((r = sys_madvise(0, REGION, NPAGES * PGSIZE, MADV_DONTNEED)) < 0)
+		panic("MADV_DONTNEED: %e", r);
+	for (i = 0; i < NPAGES; i++)
+		if (mapped(REGION + i * PGSIZE, 0))
+			panic("MADV_DONTNEED left page %d mapped", i);
+	if ((r = sys_page_populate(0, REGION, 4 * PGSIZE, 0)) != 4)
+		panic("read populate mapped %d pages", r);
+	if (mapped(REGION, 1) || REGION[0] != 0)
+		panic("read populate gave a writable or dirty page");
+
+	// A copy-on-write page gets its own copy.
+	if ((r = sys_page_alloc(0, COWSRC, PTE_P | PTE_U | PTE_W)) < 0)
+		panic("sys_page_alloc: %e", r);
+	strcpy(COWSRC, "cow");
+	if ((r = sys_page_map(0, COWSRC, 0, COWDST, PTE_P | PTE_U | PTE_COW)) < 0)
+		panic("sys_page_map: %e", r);
+	if ((r = sys_page_populate(0, COWDST, PGSIZE, POPULATE_WRITE)) != 1)
+		panic("cow populate mapped %d pages", r);
+	if (!mapped(COWDST, 1) || PTE_ADDR(uvpt[PGNUM(COWDST)]) == PTE_ADDR(uvpt[PGNUM(COWSRC)])
+	    || strcmp(COWDST, "cow") != 0)
+		panic("cow populate did not copy the page");
+
+	// Pages outside any region are left alone.
+	if ((r = sys_page_populate(0, (void *) 0x30000000, PGSIZE, POPULATE_WRITE)) != 0)
+		panic("populate outside a region mapped %d pages", r);
+	cprintf("populate is good\n");
+
+	// One fault in a sequential range maps the pages after it.
+	if ((r = sys_madvise(0, REGION, NPAGES * PGSIZE, MADV_DONTNEED)) < 0
+	    || (r = sys_madvise(0, REGION, NPAGES * PGSIZE, MADV_SEQUENTIAL)) < 0)
+		panic("sys_madvise: %e", r);
+	REGION[0] = 1;
+	if (!mapped(REGION + PGSIZE, 1) || !mapped(REGION + 4 * PGSIZE, 1))
+		panic("MADV_SEQUENTIAL did not map ahead");
+	if ((r = sys_madvise(0, REGION, NPAGES * PGSIZE, MADV_NORMAL)) < 0)
+		panic("MADV_NORMAL: %e", r);
+	REGION[100 * PGSIZE] = 1;
+	if (mapped(REGION + 101 * PGSIZE, 0))
+		panic("MADV_NORMAL still maps ahead");
+	if ((r = sys_madvise(0, REGION, NPAGES * PGSIZE, MADV_WILLNEED)) < 0
+	    || !mapped(REGION + 200 * PGSIZE, 0))
+		panic("MADV_WILLNEED did not map the range");
+	cprintf("madvise is good\n");
+}
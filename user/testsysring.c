@@ -0,0 +1,43 @@
+// Test batched system calls through the syscall ring.
+
+#include <inc/lib.h>
+
+#define NPAGES	200
+#define BASE	((uint32_t) UTEMP)
+
+void
+umain(int argc, char **argv)
+{
+	int i, r;
+
+	// More pages than fit in the ring at once.
+	for (i = 0; i < NPAGES; i++)
+		sysring_push(SYS_page_alloc, 0, BASE + i * PGSIZE,
+			     PTE_P|PTE_U|PTE_W, 0, 0);
+	if ((r = sysring_flush()) < 0)
+		panic("batched sys_page_alloc: %e", r);
+	for (i = 0; i < NPAGES; i++)
+		*(int *) (BASE + i * PGSIZE) = i;
+	for (i = 0; i < NPAGES; i++)
+		if (*(int *) (BASE + i * PGSIZE) != i)
+			panic("page %d has wrong contents", i);
+	cprintf("sysring alloc is good\n");
+
+	for (i = 0; i < NPAGES; i++)
+		sysring_push(SYS_page_unmap, 0, BASE + i * PGSIZE, 0, 0, 0);
+	if ((r = sysring_flush()) < 0)
+		panic("batched sys_page_unmap: %e", r);
+	for (i = 0; i < NPAGES; i++)
+		if (uvpt[PGNUM(BASE + i * PGSIZE)] & PTE_P)
+			panic("page %d still mapped", i);
+	cprintf("sysring unmap is good\n");
+
+	// Errors are reported, and calls that may block are refused.
+	sysring_push(SYS_page_unmap, 0, BASE + 1, 0, 0, 0);
+	if ((r = sysring_flush()) != -E_INVAL)
+		panic("misaligned unmap returned %e", r);
+	sysring_push(SYS_yield, 0, 0, 0, 0, 0);
+	if ((r = sysring_flush()) != -E_INVAL)
+		panic("queued sys_yield returned %e", r);
+	cprintf("sysring errors are good\n");
+}
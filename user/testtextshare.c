@@ -0,0 +1,37 @@
+// Test that envs spawned from the same binary share its text pages:
+// two spawned copies of this program report the physical page holding
+// umain, which must be the same and read-only.
+
+#include <inc/lib.h>
+
+void
+umain(int argc, char **argv)
+{
+	envid_t kids[2], who;
+	uint32_t pte[2];
+	int i;
+
+	if (argc > 1 && strcmp(argv[1], "child") == 0) {
+		ipc_send(thisenv->env_parent_id, uvpt[PGNUM(umain)], 0, 0);
+		// Stay alive until the parent has heard from both copies.
+		ipc_recv(0, 0, 0);
+		return;
+	}
+
+	for (i = 0; i < 2; i++)
+		if ((kids[i] = spawnl("/testtextshare", "testtextshare",
+				      "child", (char *) 0)) < 0)
+			panic("spawn: %e", kids[i]);
+	for (i = 0; i < 2; i++) {
+		pte[i] = ipc_recv(&who, 0, 0);
+		if (pte[i] & PTE_W)
+			panic("text page of %08x is writable", who);
+	}
+	if (PTE_ADDR(pte[0]) != PTE_ADDR(pte[1]))
+		panic("text pages differ: %08x, %08x", pte[0], pte[1]);
+	for (i = 0; i < 2; i++) {
+		ipc_send(kids[i], 0, 0, 0);
+		wait(kids[i]);
+	}
+	cprintf("text sharing is good\n");
+}
@@ -0,0 +1,107 @@
+// Test sys_vfork, whose child runs in our address space while we are
+// suspended, and spawnfa, which spawns with the child's file
+// descriptors redirected and ours left alone.
+
+#include <inc/lib.h>
+
+static volatile envid_t spawned;
+
+// Run 'prog' with standard output on a pipe, after 'fa' if it is not
+// NULL, and read what it writes into 'buf'.
+static int
+capture(const char *prog, const char **argv, struct SpawnFileActions *fa,
+	char *buf, int n)
+{
+	struct SpawnFileActions none;
+	envid_t env;
+	int p[2], r;
+
+	if (!fa) {
+		spawn_file_actions_init(&none);
+		fa = &none;
+	}
+	if ((r = pipe(p)) < 0)
+		panic("pipe: %e", r);
+	spawn_file_actions_addclose(fa, p[0]);
+	spawn_file_actions_adddup2(fa, p[1], 1);
+	spawn_file_actions_addclose(fa, p[1]);
+	if ((env = spawnfa(prog, argv, fa)) < 0)
+		panic("spawnfa %s: %e", prog, env);
+	if ((r = close(p[1])) < 0)
+		panic("spawnfa closed our pipe: %e", r);
+	if ((r = readn(p[0], buf, n - 1)) < 0)
+		panic("readn: %e", r);
+	buf[r] = 0;
+	close(p[0]);
+	wait(env);
+	return r;
+}
+
+void
+umain(int argc, char **argv)
+{
+	struct SpawnFileActions fa;
+	char buf[256], want[256];
+	volatile int x = 0;
+	envid_t env;
+	int fd, n;
+
+	// The child's writes land in our memory, and we run only once it
+	// is gone.
+	if ((env = sys_vfork()) < 0)
+		panic("sys_vfork: %e", env);
+	if (env == 0) {
+		x = 1;
+		sys_yield();
+		x = 2;
+		sys_env_destroy(0);
+	}
+	if (x != 2)
+		panic("vfork: parent ran with x = %d", x);
+	if (envs[ENVX(env)].env_id == env && envs[ENVX(env)].env_status != ENV_FREE)
+		panic("vfork: child %08x still exists", env);
+	cprintf("vfork is good\n");
+
+	capture("/echo", (const char *[]) { "echo", "hello", 0 }, NULL, buf, sizeof(buf));
+	if (strcmp(buf, "hello\n") != 0)
+		panic("spawnfa dup2: read '%s'", buf);
+
+	if ((fd = open("/motd", O_RDONLY)) < 0)
+		panic("open /motd: %e", fd);
+	n = readn(fd, want, sizeof(want) - 1);
+	want[n] = 0;
+	close(fd);
+	spawn_file_actions_init(&fa);
+	spawn_file_actions_addopen(&fa, 0, "/motd", O_RDONLY);
+	capture("/cat", (const char *[]) { "cat", 0 }, &fa, buf, sizeof(buf));
+	if (strcmp(buf, want) != 0)
+		panic("spawnfa open: read '%s'", buf);
+	cprintf("spawnfa is good\n");
+
+	// A vfork child can spawn for us without copying anything.
+	if ((env = sys_vfork()) < 0)
+		panic("sys_vfork: %e", env);
+	if (env == 0) {
+		spawned = spawnl("/echo", "echo", "-n", "", 0);
+		sys_env_destroy(0);
+	}
+	if (spawned <= 0)
+		panic("vfork child's spawn: %e", spawned);
+	wait(spawned);
+	cprintf("vfork spawn is good\n");
+
+	// A child that ends with exit() leaves our descriptors open.
+	if ((fd = open("/motd", O_RDONLY)) < 0)
+		panic("open /motd: %e", fd);
+	if ((env = sys_vfork()) < 0)
+		panic("sys_vfork: %e", env);
+	if (env == 0)
+		exit();
+	if ((n = readn(fd, buf, sizeof(buf) - 1)) < 0)
+		panic("vfork child's exit closed our fd: %e", n);
+	buf[n] = 0;
+	if (strcmp(buf, want) != 0)
+		panic("read '%s' after vfork exit", buf);
+	close(fd);
+	cprintf("vfork exit is good\n");
+}